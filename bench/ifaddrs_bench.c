@@ -0,0 +1,302 @@
+// ifaddrs_bench [-n interfaces] [-m addresses] [-i iterations]
+//
+// builds a fixture of interfaces inside a private user and network namespace
+// and compares getifaddrs from the netlink build, the ioctl build and glibc
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "netns_fixture.h"
+
+// every allocation of the process goes through here, glibc included
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t alloc_count;
+
+void *malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static struct rtnl rtnl;
+
+// dummy is a module that may not be around, a veth pair counts as two
+static int create_links(int first, const char *kind) {
+    union rtnl_req req;
+    init_link_request(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+
+    char name[IFNAMSIZ];
+    link_name(name, "bench", first);
+    rtnl_put(&req.hdr, IFLA_IFNAME, name, strlen(name) + 1);
+
+    struct rtattr *linkinfo = rtnl_put(&req.hdr, IFLA_LINKINFO, NULL, 0);
+    rtnl_put(&req.hdr, IFLA_INFO_KIND, kind, strlen(kind));
+    if (strcmp(kind, "veth") == 0) {
+        struct rtattr *data = rtnl_put(&req.hdr, IFLA_INFO_DATA, NULL, 0);
+        struct rtattr *peer = rtnl_put(
+            &req.hdr, VETH_INFO_PEER, &(struct ifinfomsg){0},
+            sizeof(struct ifinfomsg)
+        );
+        link_name(name, "bench", first + 1);
+        rtnl_put(&req.hdr, IFLA_IFNAME, name, strlen(name) + 1);
+        rtnl_nest_end(&req.hdr, peer);
+        rtnl_nest_end(&req.hdr, data);
+    }
+    rtnl_nest_end(&req.hdr, linkinfo);
+
+    if (rtnl_talk(&rtnl, &req.hdr) < 0) {
+        return -1;
+    }
+    return strcmp(kind, "veth") == 0 ? 2 : 1;
+}
+
+static void set_up(const char *name) {
+    union rtnl_req req;
+    init_link_request(&req, RTM_NEWLINK, 0);
+    struct ifinfomsg *ifi = NLMSG_DATA(&req.hdr);
+    if ((ifi->ifi_index = if_nametoindex(name)) == 0) {
+        die(name);
+    }
+    ifi->ifi_flags = IFF_UP;
+    ifi->ifi_change = IFF_UP;
+    if (rtnl_talk(&rtnl, &req.hdr) < 0) {
+        die("RTM_NEWLINK");
+    }
+}
+
+static void add_address(int index, int family, const void *addr, int prefix) {
+    union rtnl_req req;
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    req.hdr.nlmsg_type = RTM_NEWADDR;
+    req.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_EXCL;
+
+    struct ifaddrmsg *ifa = NLMSG_DATA(&req.hdr);
+    ifa->ifa_family = family;
+    ifa->ifa_prefixlen = prefix;
+    ifa->ifa_index = index;
+    // no duplicate address detection, tentative addresses are not listed
+    ifa->ifa_flags = IFA_F_NODAD;
+
+    size_t len = family == AF_INET ? 4 : 16;
+    rtnl_put(&req.hdr, IFA_LOCAL, addr, len);
+    rtnl_put(&req.hdr, IFA_ADDRESS, addr, len);
+    if (rtnl_talk(&rtnl, &req.hdr) < 0) {
+        die("RTM_NEWADDR");
+    }
+}
+
+static void build_fixture(int links, int addrs) {
+    rtnl_open(&rtnl);
+    // link local addresses would otherwise trickle in while measuring
+    write_file("/proc/sys/net/ipv6/conf/default/accept_dad", "0");
+    set_up("lo");
+
+    const char *kind = "dummy";
+    for (int i = 0; i < links;) {
+        int made = create_links(i, kind);
+        if (made < 0 && i == 0 && strcmp(kind, "dummy") == 0) {
+            kind = "veth";
+            continue;
+        }
+        if (made < 0) {
+            die("RTM_NEWLINK");
+        }
+        i += made;
+    }
+    // a veth pair may have overshot by one
+    for (int i = 0;; i++) {
+        char name[IFNAMSIZ];
+        link_name(name, "bench", i);
+        int index = if_nametoindex(name);
+        if (index == 0) {
+            break;
+        }
+        set_up(name);
+
+        for (int j = 0; j < addrs; j++) {
+            struct in_addr in = {htonl(0x0a000000 | (i << 8) | (j + 1))};
+            add_address(index, AF_INET, &in, 24);
+
+            struct in6_addr in6 = {{{0xfd, 0x00}}};
+            in6.s6_addr[12] = i >> 8;
+            in6.s6_addr[13] = i;
+            in6.s6_addr[14] = j >> 8;
+            in6.s6_addr[15] = j + 1;
+            add_address(index, AF_INET6, &in6, 64);
+        }
+    }
+    close(rtnl.fd);
+
+    printf("fixture: %d %s interfaces, %d IPv4 + %d IPv6 addresses each\n",
+           links, kind, addrs, addrs);
+}
+
+static int run_once(struct backend *b) {
+    struct ifaddrs *ifap;
+    if (b->get(&ifap) < 0) {
+        return -1;
+    }
+    int entries = 0;
+    for (struct ifaddrs *ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+        entries++;
+    }
+    b->free(ifap);
+    return entries;
+}
+
+// syscalls of iterations calls, counted from a traced child
+static long count_syscalls(struct backend *b, int iterations) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("fork");
+    }
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        for (int i = 0; i < iterations; i++) {
+            run_once(b);
+        }
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(
+        PTRACE_SETOPTIONS, pid, NULL,
+        (void *)(long)(PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL)
+    );
+
+    long count = 0;
+    bool entering = true;
+    int sig = 0;
+    for (;;) {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)sig) < 0) {
+            return -1;
+        }
+        if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+            break;
+        }
+        sig = 0;
+        if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+            count += entering;
+            entering = !entering;
+        } else {
+            sig = WSTOPSIG(status);
+        }
+    }
+    return count;
+}
+
+static void run_backend(struct backend *b, int iterations) {
+    int entries = run_once(b);
+    if (entries < 0) {
+        printf("%-8s  failed: %s\n", b->name, strerror(errno));
+        return;
+    }
+    for (int i = 0; i < 10; i++) {
+        run_once(b);
+    }
+
+    uint64_t *samples = malloc(iterations * sizeof(*samples));
+    if (samples == NULL) {
+        die("malloc");
+    }
+    size_t allocs = alloc_count;
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        run_once(b);
+        samples[i] = now_ns() - start;
+    }
+    allocs = alloc_count - allocs;
+    qsort(samples, iterations, sizeof(*samples), compare_u64);
+
+    // the fixed cost of the traced child is measured with no calls at all
+    int traced = iterations < 100 ? iterations : 100;
+    long syscalls = count_syscalls(b, traced) - count_syscalls(b, 0);
+
+    printf("%-8s %8d", b->name, entries);
+    int percentiles[] = {50, 90, 99, 100};
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(*percentiles); i++) {
+        uint64_t ns = samples[(size_t)(iterations - 1) * percentiles[i] / 100];
+        printf(" %9.1f", ns / 1000.0);
+    }
+    printf(" %9.1f %9.1f\n", (double)syscalls / traced,
+           (double)allocs / iterations);
+    free(samples);
+}
+
+int main(int argc, char **argv) {
+    int links = 64;
+    int addrs = 4;
+    int iterations = 1000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:i:")) != -1) {
+        switch (opt) {
+        case 'n':
+            links = atoi(optarg);
+            break;
+        case 'm':
+            addrs = atoi(optarg);
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        default:
+            fprintf(
+                stderr, "usage: %s [-n interfaces] [-m addresses] "
+                        "[-i iterations]\n",
+                argv[0]
+            );
+            return 2;
+        }
+    }
+    if (links < 0 || links > 65535 || addrs < 0 || addrs > 254 ||
+        iterations <= 0) {
+        fprintf(stderr, "%s: argument out of range\n", argv[0]);
+        return 2;
+    }
+
+    struct backend backends[] = {
+        {.name = "netlink", .path = IFADDRS_BENCH_NETLINK},
+        {.name = "ioctl", .path = IFADDRS_BENCH_IOCTL},
+        {.name = "glibc"},
+    };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(*backends); i++) {
+        load_backend(&backends[i]);
+    }
+
+    enter_namespace();
+    build_fixture(links, addrs);
+    settle(&backends[2], "");
+
+    printf("%-8s %8s %9s %9s %9s %9s %9s %9s\n", "backend", "entries",
+           "p50 us", "p90 us", "p99 us", "max us", "syscalls", "allocs");
+    for (size_t i = 0; i < sizeof(backends) / sizeof(*backends); i++) {
+        run_backend(&backends[i], iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,455 @@
+// ifaddrs_churn [-n interfaces] [-m addresses] [-w writers] [-r readers]
+//               [-t seconds]
+//
+// times getifaddrs from the netlink build, the ioctl build and glibc while
+// writer threads keep adding and deleting links and addresses inside a
+// private user and network namespace, and checks every result it gets
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "netns_fixture.h"
+
+// dummy is a module that may not be around, a veth pair gets a peer named
+// after the link with a "p" appended
+static int create_link(struct rtnl *rtnl, const char *name, const char *kind) {
+    union rtnl_req req;
+    init_link_request(&req, RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+    rtnl_put(&req.hdr, IFLA_IFNAME, name, strlen(name) + 1);
+
+    struct rtattr *linkinfo = rtnl_put(&req.hdr, IFLA_LINKINFO, NULL, 0);
+    rtnl_put(&req.hdr, IFLA_INFO_KIND, kind, strlen(kind));
+    if (strcmp(kind, "veth") == 0) {
+        struct rtattr *data = rtnl_put(&req.hdr, IFLA_INFO_DATA, NULL, 0);
+        struct rtattr *peer = rtnl_put(
+            &req.hdr, VETH_INFO_PEER, &(struct ifinfomsg){0},
+            sizeof(struct ifinfomsg)
+        );
+        char peer_name[IFNAMSIZ];
+        if (snprintf(peer_name, sizeof(peer_name), "%sp", name) >=
+            (int)sizeof(peer_name)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        rtnl_put(&req.hdr, IFLA_IFNAME, peer_name, strlen(peer_name) + 1);
+        rtnl_nest_end(&req.hdr, peer);
+        rtnl_nest_end(&req.hdr, data);
+    }
+    rtnl_nest_end(&req.hdr, linkinfo);
+    return rtnl_talk(rtnl, &req.hdr);
+}
+
+// takes the veth peer along
+static int delete_link(struct rtnl *rtnl, const char *name) {
+    union rtnl_req req;
+    init_link_request(&req, RTM_DELLINK, 0);
+    rtnl_put(&req.hdr, IFLA_IFNAME, name, strlen(name) + 1);
+    return rtnl_talk(rtnl, &req.hdr);
+}
+
+static int set_up(struct rtnl *rtnl, const char *name) {
+    union rtnl_req req;
+    init_link_request(&req, RTM_NEWLINK, 0);
+    struct ifinfomsg *ifi = NLMSG_DATA(&req.hdr);
+    ifi->ifi_flags = IFF_UP;
+    ifi->ifi_change = IFF_UP;
+    rtnl_put(&req.hdr, IFLA_IFNAME, name, strlen(name) + 1);
+    return rtnl_talk(rtnl, &req.hdr);
+}
+
+static int change_address(
+    struct rtnl *rtnl, int type, const char *name, int family,
+    const void *addr, int prefix
+) {
+    union rtnl_req req;
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    req.hdr.nlmsg_type = type;
+    req.hdr.nlmsg_flags = type == RTM_NEWADDR ? NLM_F_CREATE | NLM_F_EXCL : 0;
+
+    struct ifaddrmsg *ifa = NLMSG_DATA(&req.hdr);
+    ifa->ifa_family = family;
+    ifa->ifa_prefixlen = prefix;
+    if ((ifa->ifa_index = if_nametoindex(name)) == 0) {
+        return -1;
+    }
+    // no duplicate address detection, tentative addresses are not listed
+    ifa->ifa_flags = IFA_F_NODAD;
+
+    size_t len = family == AF_INET ? 4 : 16;
+    rtnl_put(&req.hdr, IFA_LOCAL, addr, len);
+    rtnl_put(&req.hdr, IFA_ADDRESS, addr, len);
+    return rtnl_talk(rtnl, &req.hdr);
+}
+
+// addresses are 10.x.y.z and fd00::x:y:z, x tells the owner apart
+static void
+make_addresses(int x, int y, int z, struct in_addr *in, struct in6_addr *in6) {
+    in->s_addr = htonl(0x0a000000 | (x << 16) | (y << 8) | z);
+    memset(in6, 0, sizeof(*in6));
+    in6->s6_addr[0] = 0xfd;
+    in6->s6_addr[11] = x;
+    in6->s6_addr[13] = y;
+    in6->s6_addr[15] = z;
+}
+
+static const char *link_kind = "dummy";
+
+// stable%d interfaces never change and must be in every result, churn%d
+// interfaces get addresses added and deleted, flap%d interfaces come and go
+static void build_fixture(int links, int addrs, int writers) {
+    struct rtnl rtnl;
+    rtnl_open(&rtnl);
+    // link local addresses would otherwise trickle in while measuring
+    write_file("/proc/sys/net/ipv6/conf/default/accept_dad", "0");
+    if (set_up(&rtnl, "lo") < 0) {
+        die("RTM_NEWLINK");
+    }
+
+    char name[IFNAMSIZ];
+    for (int i = 0; i < links + writers; i++) {
+        if (i < links) {
+            link_name(name, "stable", i);
+        } else {
+            link_name(name, "churn", i - links);
+        }
+        int ret = create_link(&rtnl, name, link_kind);
+        if (ret < 0 && i == 0) {
+            link_kind = "veth";
+            ret = create_link(&rtnl, name, link_kind);
+        }
+        if (ret < 0 || set_up(&rtnl, name) < 0) {
+            die("RTM_NEWLINK");
+        }
+        if (i >= links) {
+            continue;
+        }
+        for (int j = 0; j < addrs; j++) {
+            struct in_addr in;
+            struct in6_addr in6;
+            make_addresses(i >> 8, i, j + 1, &in, &in6);
+            if (change_address(&rtnl, RTM_NEWADDR, name, AF_INET, &in, 24) <
+                    0 ||
+                change_address(
+                    &rtnl, RTM_NEWADDR, name, AF_INET6, &in6, 64
+                ) < 0) {
+                die("RTM_NEWADDR");
+            }
+        }
+    }
+    close(rtnl.fd);
+
+    printf("fixture: %d stable %s interfaces, %d IPv4 + %d IPv6 addresses "
+           "each\n",
+           links, link_kind, addrs, addrs);
+}
+
+static atomic_bool stopping;
+static atomic_ulong writer_ops;
+
+struct writer {
+    pthread_t thread;
+    int id;
+    int addrs;
+};
+
+// each round brings up a new interface with an address of its own, flaps
+// addresses on an interface that stays, and deletes the new interface again
+static void *writer_main(void *arg) {
+    struct writer *w = arg;
+    struct rtnl rtnl;
+    rtnl_open(&rtnl);
+
+    char churn[IFNAMSIZ];
+    char flap[IFNAMSIZ];
+    link_name(churn, "churn", w->id);
+    link_name(flap, "flap", w->id);
+    // above what the stable interfaces use
+    int x = 0x80 + w->id;
+
+    while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+        unsigned long ops = 0;
+        struct in_addr in;
+        struct in6_addr in6;
+
+        if (create_link(&rtnl, flap, link_kind) == 0) {
+            ops++;
+            ops += set_up(&rtnl, flap) == 0;
+            make_addresses(x, 0, 1, &in, &in6);
+            ops += change_address(
+                       &rtnl, RTM_NEWADDR, flap, AF_INET, &in, 24
+                   ) == 0;
+            ops += change_address(
+                       &rtnl, RTM_NEWADDR, flap, AF_INET6, &in6, 64
+                   ) == 0;
+        }
+        for (int type = RTM_NEWADDR;; type = RTM_DELADDR) {
+            for (int j = 0; j < w->addrs; j++) {
+                make_addresses(x, 1, j + 1, &in, &in6);
+                ops += change_address(
+                           &rtnl, type, churn, AF_INET, &in, 24
+                       ) == 0;
+                ops += change_address(
+                           &rtnl, type, churn, AF_INET6, &in6, 64
+                       ) == 0;
+            }
+            if (type == RTM_DELADDR) {
+                break;
+            }
+        }
+        ops += delete_link(&rtnl, flap) == 0;
+        atomic_fetch_add_explicit(&writer_ops, ops, memory_order_relaxed);
+    }
+    close(rtnl.fd);
+    return NULL;
+}
+
+static size_t address_size(int family) {
+    switch (family) {
+    case AF_INET:
+        return sizeof(struct sockaddr_in);
+    case AF_INET6:
+        return sizeof(struct sockaddr_in6);
+    }
+    return 0;
+}
+
+static bool same_entry(const struct ifaddrs *a, const struct ifaddrs *b) {
+    if (strcmp(a->ifa_name, b->ifa_name) != 0 || a->ifa_addr == NULL ||
+        b->ifa_addr == NULL ||
+        a->ifa_addr->sa_family != b->ifa_addr->sa_family) {
+        return false;
+    }
+    // the ioctl build repeats the link entry for every alias
+    size_t len = address_size(a->ifa_addr->sa_family);
+    return len > 0 && memcmp(a->ifa_addr, b->ifa_addr, len) == 0;
+}
+
+// a result is consistent if it has all the stable entries, lists no address
+// twice and, where it lists links at all, has the link of every address
+static bool consistent(const struct backend *b, const struct ifaddrs *list) {
+    int counts[3];
+    count_entries(list, "stable", counts);
+    if (memcmp(counts, b->baseline, sizeof(counts)) != 0) {
+        return false;
+    }
+
+    bool links = b->baseline[0] > 0;
+    for (const struct ifaddrs *ifa = list; ifa != NULL; ifa = ifa->ifa_next) {
+        bool has_link = !links;
+        for (const struct ifaddrs *other = list; other != NULL;
+             other = other->ifa_next) {
+            if (other != ifa && same_entry(ifa, other)) {
+                return false;
+            }
+            has_link = has_link ||
+                       (other->ifa_addr != NULL &&
+                        other->ifa_addr->sa_family == AF_PACKET &&
+                        strcmp(other->ifa_name, ifa->ifa_name) == 0);
+        }
+        if (!has_link) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct reader {
+    pthread_t thread;
+    struct backend *backend;
+    atomic_bool *done;
+    uint64_t *samples;
+    size_t count;
+    size_t cap;
+    unsigned long failed;
+    unsigned long inconsistent;
+};
+
+static void *reader_main(void *arg) {
+    struct reader *r = arg;
+    struct backend *b = r->backend;
+
+    while (!atomic_load_explicit(r->done, memory_order_relaxed)) {
+        if (r->count == r->cap) {
+            r->cap = r->cap ? r->cap * 2 : 65536;
+            r->samples = realloc(r->samples, r->cap * sizeof(*r->samples));
+            if (r->samples == NULL) {
+                die("realloc");
+            }
+        }
+
+        struct ifaddrs *ifap;
+        uint64_t start = now_ns();
+        int ret = b->get(&ifap);
+        r->samples[r->count++] = now_ns() - start;
+        if (ret < 0) {
+            r->failed++;
+            continue;
+        }
+        r->inconsistent += !consistent(b, ifap);
+        b->free(ifap);
+    }
+    return NULL;
+}
+
+static void run_backend(struct backend *b, int readers, int seconds) {
+    struct ifaddrs_stats before;
+    if (b->stats_enable != NULL) {
+        b->stats_enable(1);
+        b->stats_total(&before);
+    }
+
+    atomic_bool done = false;
+    struct reader *r = calloc(readers, sizeof(*r));
+    if (r == NULL) {
+        die("calloc");
+    }
+    unsigned long ops = atomic_load(&writer_ops);
+    for (int i = 0; i < readers; i++) {
+        r[i].backend = b;
+        r[i].done = &done;
+        if ((errno = pthread_create(&r[i].thread, NULL, reader_main, &r[i])) !=
+            0) {
+            die("pthread_create");
+        }
+    }
+    nanosleep(&(struct timespec){seconds, 0}, NULL);
+    atomic_store(&done, true);
+
+    size_t count = 0;
+    unsigned long failed = 0;
+    unsigned long inconsistent = 0;
+    for (int i = 0; i < readers; i++) {
+        pthread_join(r[i].thread, NULL);
+        count += r[i].count;
+        failed += r[i].failed;
+        inconsistent += r[i].inconsistent;
+    }
+    ops = atomic_load(&writer_ops) - ops;
+
+    uint64_t *samples = malloc((count ? count : 1) * sizeof(*samples));
+    if (samples == NULL) {
+        die("malloc");
+    }
+    count = 0;
+    for (int i = 0; i < readers; i++) {
+        memcpy(samples + count, r[i].samples, r[i].count * sizeof(*samples));
+        count += r[i].count;
+        free(r[i].samples);
+    }
+    free(r);
+    qsort(samples, count, sizeof(*samples), compare_u64);
+
+    printf("%-8s %9zu %7lu", b->name, count, failed);
+    int permille[] = {500, 990, 999, 1000};
+    for (size_t i = 0; i < sizeof(permille) / sizeof(*permille); i++) {
+        uint64_t ns = count ? samples[(count - 1) * permille[i] / 1000] : 0;
+        printf(" %9.1f", ns / 1000.0);
+    }
+    free(samples);
+
+    if (b->stats_enable != NULL) {
+        struct ifaddrs_stats after;
+        b->stats_total(&after);
+        b->stats_enable(0);
+        unsigned long long retries = 0;
+        for (int i = 0; i < IFADDRS_PHASES; i++) {
+            retries += after.phase[i].retries - before.phase[i].retries;
+        }
+        printf(" %9llu %9llu", retries, after.fallbacks - before.fallbacks);
+    } else {
+        printf(" %9s %9s", "-", "-");
+    }
+    printf(" %9lu %9.0f\n", inconsistent, (double)ops / seconds);
+}
+
+int main(int argc, char **argv) {
+    int links = 16;
+    int addrs = 4;
+    int writers = 2;
+    int readers = 4;
+    int seconds = 2;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:w:r:t:")) != -1) {
+        switch (opt) {
+        case 'n':
+            links = atoi(optarg);
+            break;
+        case 'm':
+            addrs = atoi(optarg);
+            break;
+        case 'w':
+            writers = atoi(optarg);
+            break;
+        case 'r':
+            readers = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        default:
+            fprintf(
+                stderr, "usage: %s [-n interfaces] [-m addresses] "
+                        "[-w writers] [-r readers] [-t seconds]\n",
+                argv[0]
+            );
+            return 2;
+        }
+    }
+    if (links < 0 || links > 65535 || addrs < 0 || addrs > 254 ||
+        writers < 0 || writers > 64 || readers <= 0 || seconds <= 0) {
+        fprintf(stderr, "%s: argument out of range\n", argv[0]);
+        return 2;
+    }
+
+    struct backend backends[] = {
+        {.name = "netlink", .path = IFADDRS_BENCH_NETLINK},
+        {.name = "ioctl", .path = IFADDRS_BENCH_IOCTL},
+        {.name = "glibc"},
+    };
+    size_t nbackends = sizeof(backends) / sizeof(*backends);
+    for (size_t i = 0; i < nbackends; i++) {
+        load_backend(&backends[i]);
+    }
+
+    enter_namespace();
+    build_fixture(links, addrs, writers);
+    for (size_t i = 0; i < nbackends; i++) {
+        settle(&backends[i], "stable");
+    }
+
+    struct writer *w = calloc(writers ? writers : 1, sizeof(*w));
+    if (w == NULL) {
+        die("calloc");
+    }
+    for (int i = 0; i < writers; i++) {
+        w[i].id = i;
+        w[i].addrs = addrs;
+        if ((errno = pthread_create(&w[i].thread, NULL, writer_main, &w[i])) !=
+            0) {
+            die("pthread_create");
+        }
+    }
+
+    printf("churn: %d writers, %d readers, %d s per backend\n", writers,
+           readers, seconds);
+    printf("%-8s %9s %7s %9s %9s %9s %9s %9s %9s %9s %9s\n", "backend",
+           "calls", "failed", "p50 us", "p99 us", "p999 us", "max us",
+           "retries", "fallbacks", "inconsist", "writes/s");
+    for (size_t i = 0; i < nbackends; i++) {
+        run_backend(&backends[i], readers, seconds);
+    }
+
+    atomic_store(&stopping, true);
+    for (int i = 0; i < writers; i++) {
+        pthread_join(w[i].thread, NULL);
+    }
+    free(w);
+    return 0;
+}
@@ -0,0 +1,375 @@
+// ifaddrs_replay capture FILE
+// ifaddrs_replay replay FILE [-i iterations]
+// ifaddrs_replay synth [-n links] [-m addresses] [-o FILE] [-i iterations]
+//
+// measures parsing and allocation alone, by feeding recorded or generated
+// RTM_GETLINK and RTM_GETADDR dumps to getifaddrs_replay()
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_arp.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ifaddrs.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static size_t alloc_count;
+
+void *malloc(size_t size) {
+    alloc_count++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    alloc_count++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    alloc_count++;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static void die(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+// a dump file is just messages back to back, kept 4-byte aligned
+struct dump {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t messages;
+};
+
+static void *dump_reserve(struct dump *d, size_t len) {
+    if (d->len + len > d->cap) {
+        size_t cap = d->cap ? d->cap : 65536;
+        while (cap < d->len + len) {
+            cap *= 2;
+        }
+        if ((d->data = realloc(d->data, cap)) == NULL) {
+            die("realloc");
+        }
+        d->cap = cap;
+    }
+    return d->data + d->len;
+}
+
+static struct nlmsghdr *
+msg_begin(struct dump *d, uint16_t type, const void *body, size_t len) {
+    struct nlmsghdr *nlh = dump_reserve(d, NLMSG_SPACE(len));
+    memset(nlh, 0, NLMSG_SPACE(len));
+    nlh->nlmsg_len = NLMSG_LENGTH(len);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_MULTI;
+    memcpy(NLMSG_DATA(nlh), body, len);
+    return nlh;
+}
+
+// attributes are appended in place, nlh is the message being built at the
+// end of the dump and may move
+static void
+msg_put(struct dump *d, struct nlmsghdr **nlh, int type, const void *data,
+        size_t len) {
+    size_t used = NLMSG_ALIGN((*nlh)->nlmsg_len);
+    *nlh = dump_reserve(d, used + RTA_SPACE(len));
+
+    struct rtattr *rta = (struct rtattr *)((char *)*nlh + used);
+    memset(rta, 0, RTA_SPACE(len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    (*nlh)->nlmsg_len = used + RTA_SPACE(len);
+}
+
+static void msg_end(struct dump *d, struct nlmsghdr *nlh) {
+    d->len = (char *)nlh - d->data + NLMSG_ALIGN(nlh->nlmsg_len);
+    d->messages++;
+}
+
+static void put_done(struct dump *d) {
+    int error = 0;
+    msg_end(d, msg_begin(d, NLMSG_DONE, &error, sizeof(error)));
+}
+
+static void synth_links(struct dump *d, int links) {
+    for (int i = 0; i < links; i++) {
+        struct ifinfomsg ifi = {0};
+        ifi.ifi_family = AF_UNSPEC;
+        ifi.ifi_type = ARPHRD_ETHER;
+        ifi.ifi_index = i + 1;
+        ifi.ifi_flags = IFF_UP | IFF_BROADCAST | IFF_RUNNING | IFF_MULTICAST;
+        struct nlmsghdr *nlh = msg_begin(d, RTM_NEWLINK, &ifi, sizeof(ifi));
+
+        char name[IFNAMSIZ];
+        snprintf(name, sizeof(name), "synth%d", i);
+        msg_put(d, &nlh, IFLA_IFNAME, name, strlen(name) + 1);
+        uint32_t mtu = 1500;
+        msg_put(d, &nlh, IFLA_MTU, &mtu, sizeof(mtu));
+        unsigned char mac[6] = {0x02, 0, 0, i >> 16, i >> 8, i};
+        msg_put(d, &nlh, IFLA_ADDRESS, mac, sizeof(mac));
+        memset(mac, 0xff, sizeof(mac));
+        msg_put(d, &nlh, IFLA_BROADCAST, mac, sizeof(mac));
+        struct rtnl_link_stats stats = {0};
+        msg_put(d, &nlh, IFLA_STATS, &stats, sizeof(stats));
+        struct rtnl_link_stats64 stats64 = {0};
+        msg_put(d, &nlh, IFLA_STATS64, &stats64, sizeof(stats64));
+        msg_end(d, nlh);
+    }
+    put_done(d);
+}
+
+// the kernel dumps every IPv4 address before the first IPv6 one
+static void synth_addrs(struct dump *d, int links, int addrs, int family) {
+    uint32_t n = 0;
+    for (int i = 0; i < links; i++) {
+        for (int j = family == AF_INET ? 0 : 1; j < addrs; j += 2, n++) {
+            struct ifaddrmsg ifa = {0};
+            ifa.ifa_family = family;
+            ifa.ifa_flags = IFA_F_PERMANENT;
+            ifa.ifa_index = i + 1;
+            struct nlmsghdr *nlh =
+                msg_begin(d, RTM_NEWADDR, &ifa, sizeof(ifa));
+
+            if (family == AF_INET) {
+                ((struct ifaddrmsg *)NLMSG_DATA(nlh))->ifa_prefixlen = 24;
+                unsigned char addr[4] = {10, n >> 16, n >> 8, n};
+                msg_put(d, &nlh, IFA_ADDRESS, addr, sizeof(addr));
+                msg_put(d, &nlh, IFA_LOCAL, addr, sizeof(addr));
+                addr[3] = 255;
+                msg_put(d, &nlh, IFA_BROADCAST, addr, sizeof(addr));
+                char name[IFNAMSIZ];
+                snprintf(name, sizeof(name), "synth%d", i);
+                msg_put(d, &nlh, IFA_LABEL, name, strlen(name) + 1);
+            } else {
+                ((struct ifaddrmsg *)NLMSG_DATA(nlh))->ifa_prefixlen = 64;
+                unsigned char addr[16] = {0xfd};
+                addr[13] = n >> 16;
+                addr[14] = n >> 8;
+                addr[15] = n;
+                msg_put(d, &nlh, IFA_ADDRESS, addr, sizeof(addr));
+            }
+            uint32_t flags = IFA_F_PERMANENT;
+            msg_put(d, &nlh, IFA_FLAGS, &flags, sizeof(flags));
+            struct ifa_cacheinfo ci = {0xffffffff, 0xffffffff, 0, 0};
+            msg_put(d, &nlh, IFA_CACHEINFO, &ci, sizeof(ci));
+            msg_end(d, nlh);
+        }
+    }
+}
+
+static void capture_one(struct dump *d, int fd, uint16_t type, uint32_t seq) {
+    struct {
+        struct nlmsghdr hdr;
+        struct rtgenmsg gen;
+    } req = {{NLMSG_LENGTH(sizeof(struct rtgenmsg)), type,
+              NLM_F_REQUEST | NLM_F_DUMP, seq, 0},
+             {AF_UNSPEC}};
+    if (send(fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+        die("send");
+    }
+
+    static char buf[1 << 20];
+    for (;;) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            die("recv");
+        }
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_seq != seq) {
+                continue;
+            }
+            memcpy(dump_reserve(d, NLMSG_ALIGN(nlh->nlmsg_len)), nlh,
+                   NLMSG_ALIGN(nlh->nlmsg_len));
+            d->len += NLMSG_ALIGN(nlh->nlmsg_len);
+            d->messages++;
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                return;
+            }
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                fprintf(stderr, "dump failed\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+static void capture(struct dump *d) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        die("socket");
+    }
+    capture_one(d, fd, RTM_GETLINK, 1);
+    capture_one(d, fd, RTM_GETADDR, 2);
+    close(fd);
+}
+
+static void save(struct dump *d, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL || fwrite(d->data, 1, d->len, f) != d->len || fclose(f)) {
+        die(path);
+    }
+}
+
+static void load(struct dump *d, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        die(path);
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) < 0) {
+        die(path);
+    }
+    void *data = dump_reserve(d, st.st_size);
+    if (fread(data, 1, st.st_size, f) != (size_t)st.st_size) {
+        die(path);
+    }
+    fclose(f);
+    d->len = st.st_size;
+    for (size_t off = 0; off + sizeof(struct nlmsghdr) <= d->len;
+         off += NLMSG_ALIGN(((struct nlmsghdr *)(d->data + off))->nlmsg_len)) {
+        if (((struct nlmsghdr *)(d->data + off))->nlmsg_len == 0) {
+            break;
+        }
+        d->messages++;
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run(struct dump *d, int iterations) {
+    size_t entries = 0;
+    uint64_t best = UINT64_MAX;
+    uint64_t total = 0;
+    size_t allocs = alloc_count;
+    for (int i = 0; i < iterations; i++) {
+        struct ifaddrs *ifap;
+        uint64_t start = now_ns();
+        if (getifaddrs_replay(&ifap, NULL, d->data, d->len) < 0) {
+            die("getifaddrs_replay");
+        }
+        uint64_t elapsed = now_ns() - start;
+        total += elapsed;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+
+        entries = 0;
+        for (struct ifaddrs *ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+            entries++;
+        }
+        freeifaddrs(ifap);
+    }
+    allocs = alloc_count - allocs;
+
+    double mean = (double)total / iterations;
+    printf("dump: %zu bytes, %zu messages\n", d->len, d->messages);
+    printf("entries: %zu\n", entries);
+    printf("per call: mean %.1f us, best %.1f us, %.1f allocations\n",
+           mean / 1000, best / 1000.0, (double)allocs / iterations);
+    printf("throughput: %.1f MB/s, %.2f M entries/s\n",
+           d->len / mean * 1000, entries / mean * 1000);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s capture FILE\n"
+            "       %s replay FILE [-i iterations]\n"
+            "       %s synth [-n links] [-m addresses] [-o FILE] "
+            "[-i iterations]\n",
+            prog, prog, prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+    const char *mode = argv[1];
+    const char *file = NULL;
+    int links = 1000;
+    int addrs = 10;
+    int iterations = 20;
+
+    int opt;
+    optind = 2;
+    if (strcmp(mode, "synth") != 0) {
+        if (argc < 3) {
+            usage(argv[0]);
+        }
+        file = argv[2];
+        optind = 3;
+    }
+    while ((opt = getopt(argc, argv, "n:m:o:i:")) != -1) {
+        switch (opt) {
+        case 'n':
+            links = atoi(optarg);
+            break;
+        case 'm':
+            addrs = atoi(optarg);
+            break;
+        case 'o':
+            file = optarg;
+            break;
+        case 'i':
+            iterations = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (links <= 0 || links > 1 << 24 || addrs < 0 ||
+        (long)links * addrs > 1 << 24 || iterations <= 0) {
+        fprintf(stderr, "%s: argument out of range\n", argv[0]);
+        return 2;
+    }
+
+    struct dump d = {0};
+    if (strcmp(mode, "capture") == 0) {
+        capture(&d);
+        save(&d, file);
+        printf("captured %zu messages, %zu bytes\n", d.messages, d.len);
+        return 0;
+    } else if (strcmp(mode, "replay") == 0) {
+        load(&d, file);
+    } else if (strcmp(mode, "synth") == 0) {
+        synth_links(&d, links);
+        synth_addrs(&d, links, addrs, AF_INET);
+        synth_addrs(&d, links, addrs, AF_INET6);
+        put_done(&d);
+        if (file != NULL) {
+            save(&d, file);
+        }
+    } else {
+        usage(argv[0]);
+    }
+
+    run(&d, iterations);
+    free(d.data);
+    return 0;
+}
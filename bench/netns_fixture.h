@@ -0,0 +1,244 @@
+#ifndef IFADDRS_NETNS_FIXTURE_H
+#define IFADDRS_NETNS_FIXTURE_H
+
+// what the benchmarks share: a private user and network namespace, rtnetlink
+// requests to fill it, the getifaddrs implementations to compare and timing
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ifaddrs.h>
+// after it, struct ifaddr in here claims ifa_broadaddr and ifa_dstaddr
+#include <net/if.h>
+
+typedef int (*getifaddrs_fn)(struct ifaddrs **ifap);
+typedef void (*freeifaddrs_fn)(struct ifaddrs *ifa);
+typedef void (*stats_enable_fn)(int on);
+typedef void (*stats_total_fn)(struct ifaddrs_stats *stats);
+
+struct backend {
+    const char *name;
+    // a build of this library, NULL for glibc
+    const char *path;
+    getifaddrs_fn get;
+    freeifaddrs_fn free;
+    // only in the builds of this library
+    stats_enable_fn stats_enable;
+    stats_total_fn stats_total;
+    // entries by family once settle() found them steady, see family_slot()
+    int baseline[3];
+};
+
+static inline void die(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+// the kernel would refuse a longer name, a fixture that needs one is a bug
+static inline void link_name(char *name, const char *prefix, int i) {
+    if (snprintf(name, IFNAMSIZ, "%s%d", prefix, i) >= IFNAMSIZ) {
+        errno = ENAMETOOLONG;
+        die(prefix);
+    }
+}
+
+static inline int write_file(const char *path, const char *data) {
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t len = write(fd, data, strlen(data));
+    close(fd);
+    return len == (ssize_t)strlen(data) ? 0 : -1;
+}
+
+// before any thread exists, unshare() refuses otherwise
+static inline void enter_namespace(void) {
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNET) == 0) {
+        char map[64];
+        write_file("/proc/self/setgroups", "deny");
+        snprintf(map, sizeof(map), "0 %u 1", (unsigned int)uid);
+        if (write_file("/proc/self/uid_map", map) < 0) {
+            die("uid_map");
+        }
+        snprintf(map, sizeof(map), "0 %u 1", (unsigned int)gid);
+        if (write_file("/proc/self/gid_map", map) < 0) {
+            die("gid_map");
+        }
+        return;
+    }
+    // user namespaces can be disabled, root does not need one
+    if (unshare(CLONE_NEWNET) < 0) {
+        die("unshare");
+    }
+}
+
+// every thread that changes the fixture talks to the kernel over its own
+// socket
+struct rtnl {
+    int fd;
+    uint32_t seq;
+};
+
+// a union, so that the compiler sees attributes written past hdr land in it
+union rtnl_req {
+    struct nlmsghdr hdr;
+    char data[512];
+};
+
+static inline void rtnl_open(struct rtnl *rtnl) {
+    rtnl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (rtnl->fd < 0) {
+        die("socket");
+    }
+    rtnl->seq = 0;
+}
+
+static inline void *rtnl_tail(struct nlmsghdr *nlh) {
+    return (char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static inline struct rtattr *
+rtnl_put(struct nlmsghdr *nlh, int type, const void *data, size_t len) {
+    struct rtattr *rta = rtnl_tail(nlh);
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    if (len > 0) {
+        memcpy(RTA_DATA(rta), data, len);
+    }
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+    return rta;
+}
+
+static inline void rtnl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest) {
+    nest->rta_len = (char *)rtnl_tail(nlh) - (char *)nest;
+}
+
+static inline int rtnl_talk(struct rtnl *rtnl, struct nlmsghdr *nlh) {
+    nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+    nlh->nlmsg_seq = ++rtnl->seq;
+    if (send(rtnl->fd, nlh, nlh->nlmsg_len, 0) < 0) {
+        return -1;
+    }
+
+    char buf[4096];
+    for (;;) {
+        ssize_t len = recv(rtnl->fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            return -1;
+        }
+        for (struct nlmsghdr *reply = (struct nlmsghdr *)buf;
+             NLMSG_OK(reply, len); reply = NLMSG_NEXT(reply, len)) {
+            if (reply->nlmsg_seq == rtnl->seq &&
+                reply->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(reply);
+                errno = -err->error;
+                return err->error == 0 ? 0 : -1;
+            }
+        }
+    }
+}
+
+static inline void init_link_request(union rtnl_req *req, int type, int flags) {
+    memset(req, 0, sizeof(*req));
+    req->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    req->hdr.nlmsg_type = type;
+    req->hdr.nlmsg_flags = flags;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static inline void load_backend(struct backend *b) {
+    if (b->path == NULL) {
+        b->get = getifaddrs;
+        b->free = freeifaddrs;
+        return;
+    }
+    // kept local so that the two builds do not resolve to each other
+    void *handle = dlopen(b->path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        exit(1);
+    }
+    b->get = (getifaddrs_fn)dlsym(handle, "getifaddrs");
+    b->free = (freeifaddrs_fn)dlsym(handle, "freeifaddrs");
+    b->stats_enable = (stats_enable_fn)dlsym(handle, "ifaddrs_stats_enable");
+    b->stats_total = (stats_total_fn)dlsym(handle, "ifaddrs_stats_total");
+    if (b->get == NULL || b->free == NULL || b->stats_enable == NULL ||
+        b->stats_total == NULL) {
+        fprintf(stderr, "%s: missing symbols\n", b->path);
+        exit(1);
+    }
+}
+
+static inline int family_slot(int family) {
+    switch (family) {
+    case AF_PACKET:
+        return 0;
+    case AF_INET:
+        return 1;
+    case AF_INET6:
+        return 2;
+    }
+    return -1;
+}
+
+// entries by family on the interfaces whose name starts with prefix
+static inline void
+count_entries(const struct ifaddrs *list, const char *prefix, int counts[3]) {
+    counts[0] = counts[1] = counts[2] = 0;
+    for (const struct ifaddrs *ifa = list; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL ||
+            strncmp(ifa->ifa_name, prefix, strlen(prefix)) != 0) {
+            continue;
+        }
+        int slot = family_slot(ifa->ifa_addr->sa_family);
+        if (slot >= 0) {
+            counts[slot]++;
+        }
+    }
+}
+
+// carrier and the link local addresses that follow it come up in the
+// background, wait until the entries on the prefix interfaces stop changing
+static inline void settle(struct backend *b, const char *prefix) {
+    struct ifaddrs *ifap;
+    int last[3] = {-1, -1, -1};
+    for (int i = 0; i < 50; i++) {
+        if (b->get(&ifap) < 0) {
+            die(b->name);
+        }
+        count_entries(ifap, prefix, b->baseline);
+        b->free(ifap);
+        if (memcmp(last, b->baseline, sizeof(last)) == 0) {
+            return;
+        }
+        memcpy(last, b->baseline, sizeof(last));
+        nanosleep(&(struct timespec){0, 200000000}, NULL);
+    }
+}
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef IFADDRS_H
 #define IFADDRS_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -22,9 +24,355 @@ struct ifaddrs {
     void *ifa_data; /* Address-specific data */
 };
 
+#define IFADDRS_FAMILY_PACKET 0x1 /* AF_PACKET link entries */
+#define IFADDRS_FAMILY_INET 0x2   /* AF_INET addresses */
+#define IFADDRS_FAMILY_INET6 0x4  /* AF_INET6 addresses */
+
+struct ifaddrs_filter {
+    unsigned int families; /* IFADDRS_FAMILY_* mask, 0 for all */
+    int ifindex;           /* Only this interface, 0 for any */
+    int master;            /* Only interfaces enslaved to this one, 0 for any */
+    unsigned int flags;    /* IFF_* flags that must all be set */
+};
+
 int getifaddrs(struct ifaddrs **ifap);
 void freeifaddrs(struct ifaddrs *ifa);
 
+/* Like getifaddrs(), but only returns entries matching filter, which may be
+ * NULL. Whatever the kernel can check is pushed into the dump requests. */
+int getifaddrs_filter(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter
+);
+
+#define IFADDRS_EX_MTU 0x1       /* mtu is set */
+#define IFADDRS_EX_OPERSTATE 0x2 /* operstate is set */
+#define IFADDRS_EX_KIND 0x4      /* kind is set */
+#define IFADDRS_EX_STATS64 0x8   /* stats64 is set */
+#define IFADDRS_EX_ADDR 0x10     /* addr_flags, prefixlen and scope are set */
+#define IFADDRS_EX_LIFETIME 0x20 /* preferred_lft and valid_lft are set */
+
+struct ifaddrs_ex_stats {
+    unsigned long long rx_packets;
+    unsigned long long tx_packets;
+    unsigned long long rx_bytes;
+    unsigned long long tx_bytes;
+    unsigned long long rx_errors;
+    unsigned long long tx_errors;
+    unsigned long long rx_dropped;
+    unsigned long long tx_dropped;
+    unsigned long long multicast;
+    unsigned long long collisions;
+};
+
+/* What the dumps say about an entry beyond struct ifaddrs. Addresses get the
+ * mtu, operstate and kind of their link as well. */
+struct ifaddrs_ex {
+    unsigned int has; /* IFADDRS_EX_* bits */
+    int ifindex;      /* 0 if unknown */
+    unsigned int mtu;
+    unsigned int operstate; /* IF_OPER_* from <linux/if.h> */
+    char kind[16];          /* Link type, e.g. "veth", empty for none */
+    struct ifaddrs_ex_stats stats64;
+    unsigned int addr_flags; /* IFA_F_* from <linux/if_addr.h> */
+    unsigned int prefixlen;
+    unsigned int scope;         /* RT_SCOPE_* from <linux/rtnetlink.h> */
+    unsigned int preferred_lft; /* Seconds left, 0xffffffff for forever */
+    unsigned int valid_lft;     /* Seconds left, 0xffffffff for forever */
+};
+
+/* Like getifaddrs_filter(), but keeps an extended record for every entry.
+ * Free the result with freeifaddrs(). */
+int getifaddrs_ex(struct ifaddrs **ifap, const struct ifaddrs_filter *filter);
+/* The record of an entry from getifaddrs_ex(), NULL for entries from any
+ * other call. Valid as long as the entry is. */
+const struct ifaddrs_ex *ifaddrs_ex(const struct ifaddrs *ifa);
+
+#define IFADDRS_OPT_EX 0x1       /* Extended records, as getifaddrs_ex() */
+#define IFADDRS_OPT_NO_STATS 0x2 /* Leave ifa_data NULL, skip link counters */
+
+struct ifaddrs_options {
+    unsigned int flags; /* IFADDRS_OPT_* */
+};
+
+/* Like getifaddrs_filter(), with opts, which may be NULL. Without the link
+ * counters the kernel copies a fraction of the bytes, if it is 4.20 or later.
+ * Free the result with freeifaddrs(). */
+int getifaddrs_opts(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    const struct ifaddrs_options *opts
+);
+
+/* The entries of one interface, by name, or by ifindex if name is NULL, as
+ * getifaddrs_filter() with its ifindex would return them. Only that interface
+ * is asked for, so the cost does not grow with the number of interfaces on
+ * the host. Fails with ENODEV if there is no such interface. Free the result
+ * with freeifaddrs(). */
+int getifaddrs_for_interface(
+    struct ifaddrs **ifap, const char *name, int ifindex
+);
+
+struct ifaddrs_ifstats {
+    int ifindex;
+    struct ifaddrs_ex_stats stats64;
+};
+
+/* Fills stats with the counters of up to n links, in ifindex order, from a
+ * single dump and without allocating, so it can be polled. Returns the number
+ * of links, which is more than n if stats was too short, or -1 with errno
+ * set. */
+int getifstats(struct ifaddrs_ifstats *stats, size_t n);
+
+/* Called for each entry getifaddrs() would return, in the same order. ifa
+ * and everything it points to are only valid during the call, ifa_next is
+ * always NULL. Return 0 to go on, anything else to stop. */
+typedef int (*getifaddrs_foreach_cb)(const struct ifaddrs *ifa, void *ctx);
+
+/* Walks the entries while the dumps are being received, without building a
+ * list. It only allocates for a datagram bigger than its stack buffer.
+ * Returns 0 after the last entry, what cb stopped with, or -1 with errno set.
+ * EINTR means the kernel tables changed during the walk after some entries
+ * had already been seen. */
+int getifaddrs_foreach(getifaddrs_foreach_cb cb, void *ctx);
+
+/* getifaddrs_filter() for event loops, it never blocks.
+ * getifaddrs_async_start() sends the first request and returns the netlink
+ * socket to wait on for input, or -1 with errno set. Each time the socket is
+ * readable, getifaddrs_async_step() takes in what has arrived: it returns 1
+ * while more is to come, 0 once the result is in *ifap, and -1 with errno
+ * set on failure. After 0 or -1 the operation is gone and its socket closed,
+ * getifaddrs_async_cancel() abandons it before that. filter may be NULL, it
+ * is copied. */
+struct getifaddrs_async;
+int getifaddrs_async_start(
+    struct getifaddrs_async **op, const struct ifaddrs_filter *filter
+);
+int getifaddrs_async_step(struct getifaddrs_async *op, struct ifaddrs **ifap);
+void getifaddrs_async_cancel(struct getifaddrs_async *op);
+
+/* A getifaddrs() result shared read-only between threads. */
+struct ifaddrs_snapshot;
+
+/* Returns a reference to the current snapshot, taking a new one first if it
+ * is older than the maximum age. Only the thread that refreshes it waits for
+ * the dumps, the others go on with the previous snapshot meanwhile.
+ * Returns NULL with errno set if there is none and none could be taken. */
+struct ifaddrs_snapshot *ifaddrs_snapshot_acquire(void);
+/* Drops a reference, the snapshot is freed along with the last one. */
+void ifaddrs_snapshot_release(struct ifaddrs_snapshot *snap);
+/* The entries, valid until the reference is released. Never freeifaddrs(). */
+const struct ifaddrs *
+ifaddrs_snapshot_list(const struct ifaddrs_snapshot *snap);
+/* How old a snapshot may get before it is refreshed, 1000 ms by default. */
+void ifaddrs_snapshot_set_max_age(unsigned int ms);
+
+/* A getifaddrs() result in shared memory, published by one writer and read
+ * in place by any number of processes that map the same file. Entries and
+ * everything they refer to are addressed by offsets from the start of the
+ * mapping. */
+struct ifaddrs_shm;
+
+#define IFADDRS_SHM_ADDR 0x1      /* addr is set */
+#define IFADDRS_SHM_NETMASK 0x2   /* netmask is set */
+#define IFADDRS_SHM_BROADADDR 0x4 /* broadaddr is set */
+#define IFADDRS_SHM_DSTADDR 0x8   /* dstaddr is set */
+
+struct ifaddrs_shm_entry {
+    unsigned int next;     /* Offset of the next entry, 0 after the last */
+    unsigned int flags;    /* Flags from SIOCGIFFLAGS */
+    unsigned int has;      /* IFADDRS_SHM_* bits */
+    unsigned int data;     /* Offset of ifa_data, 0 if there is none */
+    unsigned int data_len; /* Size of ifa_data */
+    char name[16];
+    /* Sockaddrs in place, cast to struct sockaddr */
+    unsigned int addr[7];
+    unsigned int netmask[7];
+    unsigned int broadaddr[7];
+    unsigned int dstaddr[7];
+};
+
+/* Writer side. Maps fd, or a new memfd if fd is -1, sized to hold two
+ * results of up to size bytes each (1 MiB if 0), and publishes an empty one.
+ * Returns NULL with errno set on failure. */
+struct ifaddrs_shm *ifaddrs_shm_create(int fd, size_t size);
+/* Reader side, maps fd read-only. Returns NULL with errno set on failure. */
+struct ifaddrs_shm *ifaddrs_shm_open(int fd);
+/* The file behind the mapping, e.g. to pass to readers. */
+int ifaddrs_shm_fd(const struct ifaddrs_shm *shm);
+/* Unmaps, and closes the file if ifaddrs_shm_create() made it. */
+void ifaddrs_shm_close(struct ifaddrs_shm *shm);
+
+/* Serializes list, which may come from getifaddrs() or be NULL, without
+ * disturbing readers of the previous result. ENOSPC if it does not fit.
+ * Returns 0, or -1 with errno set. */
+int ifaddrs_shm_publish(struct ifaddrs_shm *shm, const struct ifaddrs *list);
+
+/* Reads follow the seqlock pattern and make no syscalls:
+ *
+ *     unsigned int seq;
+ *     do {
+ *         seq = ifaddrs_shm_read_begin(shm);
+ *         for (e = ifaddrs_shm_first(shm, seq); e; e = ifaddrs_shm_next(shm, e))
+ *             ...
+ *     } while (ifaddrs_shm_read_retry(shm, seq));
+ *
+ * Anything read is only to be trusted once read_retry() returned 0. */
+unsigned int ifaddrs_shm_read_begin(const struct ifaddrs_shm *shm);
+const struct ifaddrs_shm_entry *
+ifaddrs_shm_first(const struct ifaddrs_shm *shm, unsigned int seq);
+const struct ifaddrs_shm_entry *ifaddrs_shm_next(
+    const struct ifaddrs_shm *shm, const struct ifaddrs_shm_entry *e
+);
+/* ifa_data of e, NULL if there is none. */
+const void *ifaddrs_shm_data(
+    const struct ifaddrs_shm *shm, const struct ifaddrs_shm_entry *e
+);
+int ifaddrs_shm_read_retry(const struct ifaddrs_shm *shm, unsigned int seq);
+
+/* Copies the current result into a list for freeifaddrs().
+ * Returns 0, or -1 with errno set. */
+int ifaddrs_shm_to_list(const struct ifaddrs_shm *shm, struct ifaddrs **ifap);
+
+/* Which interface an address belongs to, looked up in sorted tables built
+ * from a getifaddrs() result instead of walking the list. */
+struct ifaddrs_owner_index;
+
+struct ifaddrs_owner {
+    int ifindex;            /* Interface with this address, 0 if none */
+    int prefix_ifindex;     /* Interface of the longest prefix holding it */
+    unsigned int prefixlen; /* Length of that prefix */
+};
+
+/* Builds an index of the AF_INET and AF_INET6 entries of list, which may be
+ * freed afterwards. list comes from getifaddrs() of this library or of the C
+ * library, whose entries are looked up by name for their ifindex. Returns NULL
+ * with errno set on failure. */
+struct ifaddrs_owner_index *
+ifaddrs_owner_index_create(const struct ifaddrs *list);
+/* Replaces what the index holds with the entries of list. Lookups never wait
+ * for it, those already running finish on the previous tables. Returns 0, or
+ * -1 with errno set. */
+int ifaddrs_owner_index_refresh(
+    struct ifaddrs_owner_index *index, const struct ifaddrs *list
+);
+/* No lookup may be running. */
+void ifaddrs_owner_index_destroy(struct ifaddrs_owner_index *index);
+/* Fills owner for an AF_INET or AF_INET6 address. A link-local address with
+ * a sin6_scope_id only matches on that interface, without one it belongs to
+ * the first interface listed with it. Returns 1 if it is one of the addresses
+ * of the index, 0 if not, or -1 with errno set. */
+int ifaddrs_lookup_owner(
+    struct ifaddrs_owner_index *index, const struct sockaddr *addr,
+    struct ifaddrs_owner *owner
+);
+/* The same for n addresses of one family, packed as struct in_addr or struct
+ * in6_addr, into owners[n]. Returns how many are addresses of the index, or
+ * -1 with errno set. */
+int ifaddrs_lookup_owner_batch(
+    struct ifaddrs_owner_index *index, int family, const void *addrs,
+    size_t n, struct ifaddrs_owner *owners
+);
+
+/* Serve getifaddrs() from a table kept current by netlink notifications
+ * instead of dumping the kernel tables on every call. Counters change
+ * without notifications, a call that returns them asks for them as
+ * getifstats() does. Returns 0, or -1 with errno set. */
+int getifaddrs_cache_enable(void);
+void getifaddrs_cache_disable(void);
+
+/* Keep the sockets each thread talks to the kernel over open from one call
+ * to the next instead of opening new ones every time. They are close-on-exec
+ * and closed when the thread exits, and a child process started with fork()
+ * opens its own. Turning it off closes the sockets of the calling thread at
+ * once and those of the other threads on their next call.
+ * getifaddrs_async_start() always opens a socket of its own. */
+void ifaddrs_socket_cache_enable(int on);
+
+#define IFADDRS_BACKEND_NETLINK 0x1 /* Netlink sockets can be opened */
+#define IFADDRS_BACKEND_GETLINK 0x2 /* RTM_GETLINK is allowed */
+#define IFADDRS_BACKEND_GETADDR 0x4 /* RTM_GETADDR is allowed */
+#define IFADDRS_BACKEND_STRICT 0x8  /* Strict checking is available */
+
+/* The first time the kernel refuses one of these, e.g. RTM_GETLINK for apps on
+ * Android, it is remembered for the whole process and later calls go straight
+ * to what works instead of asking again. Returns the ones not refused so far,
+ * 0 in the ioctl build. */
+unsigned int ifaddrs_backend(void);
+/* Forgets what was refused and asks the kernel again with a small request of
+ * each kind, e.g. after setns(). Sockets kept by the socket cache are reopened
+ * on their next use. Returns what ifaddrs_backend() then does. */
+unsigned int ifaddrs_backend_reprobe(void);
+
+/* What to do when the kernel keeps interrupting the dumps because the
+ * tables change while they are being read. */
+#define IFADDRS_RETRY_BOTH 0x1  /* Redo the link dump with the address dump */
+#define IFADDRS_RETRY_STALE 0x2 /* Fall back to the last full result */
+
+struct ifaddrs_retry_policy {
+    unsigned int max_retries;    /* Restarts per call, 0 for no limit */
+    unsigned int backoff_us;     /* Wait before every restart but the first */
+    unsigned int max_backoff_us; /* Limit for the wait, 0 for no limit */
+    unsigned int flags;          /* IFADDRS_RETRY_* */
+};
+
+/* Applies to all threads. NULL restores the default: as many immediate
+ * restarts of just the interrupted dump as it takes. Once out of retries,
+ * calls fail with EAGAIN, except that calls without a filter return a copy
+ * of the last full result under IFADDRS_RETRY_STALE, which costs a copy of
+ * every result while it is set. getifaddrs_async_step() never waits.
+ * Returns 0, or -1 with errno set. */
+int ifaddrs_set_retry_policy(const struct ifaddrs_retry_policy *policy);
+void ifaddrs_get_retry_policy(struct ifaddrs_retry_policy *policy);
+/* 1 if list is the last full result served under IFADDRS_RETRY_STALE rather
+ * than a current one, 0 otherwise. */
+int ifaddrs_is_stale(const struct ifaddrs *list);
+
+/* Phases a call spends its time in. */
+#define IFADDRS_PHASE_SETUP 0   /* Opening sockets, joining the results */
+#define IFADDRS_PHASE_GETLINK 1 /* RTM_GETLINK dump */
+#define IFADDRS_PHASE_GETADDR 2 /* RTM_GETADDR dump */
+#define IFADDRS_PHASE_IOCTL 3   /* SIOCGIFCONF fallback */
+#define IFADDRS_PHASE_CACHE 4   /* Cache mode catching up on notifications */
+#define IFADDRS_PHASES 5
+
+struct ifaddrs_phase_stats {
+    unsigned long long syscalls;   /* System calls made */
+    unsigned long long bytes;      /* Bytes received from the kernel */
+    unsigned long long messages;   /* Messages or ioctl entries parsed */
+    unsigned long long allocs;     /* Heap allocations */
+    unsigned long long retries;    /* Dumps interrupted */
+    unsigned long long elapsed_ns; /* Time spent */
+};
+
+struct ifaddrs_stats {
+    unsigned long long calls;     /* Calls made while counting */
+    unsigned long long fallbacks; /* Results taken from the ioctl fallback */
+    unsigned long long unknown;   /* Messages of unexpected type or family */
+    struct ifaddrs_phase_stats phase[IFADDRS_PHASES];
+};
+
+/* Counting is off by default, and then costs one relaxed load per event.
+ * getifaddrs() and its variants, getifaddrs_foreach() and getifstats() are
+ * counted as calls, and so is getifaddrs_async_start(). ifaddrs_stats_last()
+ * after getifaddrs_async_step() covers just that step. */
+void ifaddrs_stats_enable(int on);
+/* What the last counted call made by this thread did. */
+void ifaddrs_stats_last(struct ifaddrs_stats *stats);
+/* Sums over all counted calls in the process since the last reset. */
+void ifaddrs_stats_total(struct ifaddrs_stats *stats);
+void ifaddrs_stats_reset(void);
+
+#ifdef IFADDRS_REPLAY
+/* Only in builds with IFADDRS_REPLAY defined. Runs getifaddrs_filter()
+ * against recorded replies instead of the kernel: dump holds the messages of
+ * an RTM_GETLINK dump up to its NLMSG_DONE, followed by those of an
+ * RTM_GETADDR dump up to its NLMSG_DONE. dump must be 4-byte aligned.
+ * Returns 0, or -1 with errno set. */
+int getifaddrs_replay(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    const void *dump, size_t len
+);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
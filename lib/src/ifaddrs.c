@@ -1,16 +1,26 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <linux/if_ether.h>
+#include <linux/memfd.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <netinet/in.h>
 #include <netpacket/packet.h>
-#include <stdio.h>
+#include <poll.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #define ifaddr __libc_ifaddr
 #include <net/if.h>
@@ -25,6 +35,58 @@
 #include "macros.h"
 #include <ifaddrs_internal.h>
 
+static struct ifaddrs_snapshots snapshots = {
+    NULL, 0, {0, 0}, SNAPSHOT_MAX_AGE_MS, PTHREAD_MUTEX_INITIALIZER
+};
+
+static struct ifaddrs_retry retry_policy = {
+    0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, NULL
+};
+
+// what the last SIOCGIFCONF needed, the next one starts with that much room
+static atomic_size_t ifconf_hint = IFCONF_BUF_SIZE;
+
+static struct ifaddrs_sockets sockets = {
+    false, 0, PTHREAD_ONCE_INIT, 0, false
+};
+static _Thread_local struct socket_cache socket_cache = {
+    0, false, -1, false, -1, false, 0, false, false, 0
+};
+
+static atomic_bool stats_enabled;
+// process-wide sums, word by word of struct ifaddrs_stats
+static atomic_ullong stats_total[STATS_WORDS];
+// what the call this thread is in has done so far, and the one before it
+static _Thread_local struct ifaddrs_stats stats_call;
+static _Thread_local struct ifaddrs_stats stats_last;
+static _Thread_local int stats_phase;
+// calls nest, e.g. getifaddrs_foreach() falling back to getifaddrs()
+static _Thread_local int stats_depth;
+// counting was on when the outermost call began
+static _Thread_local bool stats_counting;
+
+#ifndef IFADDRS_USE_IOCTL
+static struct ifaddrs_cache cache = {
+    PTHREAD_MUTEX_INITIALIZER, false, false, false, -1, 0, NULL, 0, {0}, {0},
+    NULL, 0, {0, 0}, 0
+};
+// largest datagram any session has had to receive so far
+static atomic_size_t netlink_buf_hint = NETLINK_BUF_SIZE;
+// BACKEND_NO_* bits for what the kernel has refused so far
+static atomic_uint backend_denied;
+
+static const struct netlink_transport netlink_kernel_transport = {
+    netlink_kernel_send, netlink_kernel_recv, netlink_kernel_close
+};
+#ifdef IFADDRS_REPLAY
+static const struct netlink_transport netlink_replay_transport = {
+    netlink_replay_send, netlink_replay_recv, netlink_replay_close
+};
+// sessions opened by this thread replay this instead of asking the kernel
+static _Thread_local struct netlink_replay *netlink_replay_current;
+#endif
+#endif
+
 static bool is_zero(char *ptr, size_t size) {
     for (size_t i = 0; i < size; i++) {
         if (ptr[i] != 0) {
@@ -35,810 +97,4913 @@ static bool is_zero(char *ptr, size_t size) {
 }
 
 int getifaddrs(struct ifaddrs **ifap) {
+    return getifaddrs_filter(ifap, NULL);
+}
+
+int getifaddrs_filter(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter
+) {
+    stats_call_begin(true);
+    int ret = getifaddrs_run(ifap, filter, 0);
+    stats_call_end();
+    return ret;
+}
+
+int getifaddrs_ex(struct ifaddrs **ifap, const struct ifaddrs_filter *filter) {
+    stats_call_begin(true);
+    int ret = getifaddrs_run(ifap, filter, IFADDRS_OPT_EX);
+    stats_call_end();
+    return ret;
+}
+
+int getifaddrs_opts(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    const struct ifaddrs_options *opts
+) {
+    unsigned int flags = opts ? opts->flags : 0;
+    if (flags & ~(IFADDRS_OPT_EX | IFADDRS_OPT_NO_STATS)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    stats_call_begin(true);
+    int ret = getifaddrs_run(ifap, filter, flags);
+    stats_call_end();
+    return ret;
+}
+
+const struct ifaddrs_ex *ifaddrs_ex(const struct ifaddrs *ifa) {
+    return ifa ? TO_INTERNAL(ifa)->ex : NULL;
+}
+
+int getifaddrs_for_interface(
+    struct ifaddrs **ifap, const char *name, int ifindex
+) {
+    stats_call_begin(true);
+    int ret = for_interface_run(ifap, name, ifindex);
+    stats_call_end();
+    return ret;
+}
+
+static int
+for_interface_run(struct ifaddrs **ifap, const char *name, int ifindex) {
+    if (ifap == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+    *ifap = NULL;
+    if (name ? strnlen(name, IFNAMSIZ) >= IFNAMSIZ : ifindex <= 0) {
+        errno = ENODEV;
+        return -1;
+    }
+
 #ifndef IFADDRS_USE_IOCTL
-    struct ifaddrs *l3addr;
-    struct ifaddrs *l2end;
-    while (!(l2end = getifaddrs_getlink(ifap))) {
-        if (errno != EINTR) {
-            break;
-        } else {
-            continue;
+    // the cache has the whole table already
+    if (!atomic_load(&cache.enabled) && !NETLINK_REPLAYING()) {
+        struct netlink_session nl;
+        if (netlink_open(&nl) == 0) {
+            struct ifaddrs_arena *arena;
+            ERR_0(arena = arena_create())
+                netlink_close(&nl);
+            ERR_END
+            struct ifaddrs_list result;
+            int ret = getifaddrs_getone(arena, &nl, name, ifindex, &result);
+            int save_errno = errno;
+            netlink_close(&nl);
+            if (ret == 0) {
+                *ifap = result.head;
+                return 0;
+            }
+            arena_destroy(arena);
+            errno = save_errno;
+            if (errno == ENODEV || errno == EAGAIN) {
+                return -1;
+            }
         }
     }
-    // struct ifaddrs *l2end = NULL;
-    struct ifaddrs *l3end;
-    while (!(l3end = getifaddrs_getaddr(&l3addr, (bool)l2end))) {
-        if (errno != EINTR) {
-            break;
-        } else {
-            continue;
-        }
+#endif
+
+    // the full dumps, narrowed down to the interface afterwards
+    struct ifaddrs_filter filter = {0, ifindex, 0, 0};
+    char ifname[IFNAMSIZ];
+    if (name) {
+        filter.ifindex = if_nametoindex(name);
+    } else if (!if_indextoname(ifindex, ifname)) {
+        filter.ifindex = 0;
     }
-    if (!l3end) {
-        l3end = getifaddrs_ioctl(&l3addr, !l2end);
+    ERR_0(filter.ifindex)
+        save_errno = ENODEV;
+    ERR_END
+    return getifaddrs_run(ifap, &filter, 0);
+}
+
+static int getifaddrs_run(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    unsigned int opts
+) {
+    if (ifap == NULL) {
+        errno = EFAULT;
+        return -1;
     }
-    if (l2end) {
-        ERR_0(l3end)
-            // system configuration is not sane...
-            freeifaddrs(*ifap);
-            *ifap = NULL;
+
+    *ifap = NULL;
+
+    struct ifaddrs_arena *arena;
+    ERR_0(arena = arena_create())
+    ERR_END
+    arena->ex = opts & IFADDRS_OPT_EX;
+    arena->no_stats = opts & IFADDRS_OPT_NO_STATS;
+
+    struct ifaddrs_list result = {NULL, NULL};
+#ifndef IFADDRS_USE_IOCTL
+    // links that are only needed for the join go into a scratch arena
+    bool want_links = filter_family(filter, AF_PACKET);
+    bool want_addrs =
+        filter_family(filter, AF_INET) || filter_family(filter, AF_INET6);
+    struct ifaddrs_arena *link_arena = arena;
+    if (!want_links) {
+        ERR_0(link_arena = arena_create())
+            arena_destroy(arena);
         ERR_END
-        match_getaddr_with_getlink(*ifap, l3addr);
-        l2end->ifa_next = l3addr;
+        // addresses copy from the records of their links
+        link_arena->ex = arena->ex;
+        // but never from their counters
+        link_arena->no_stats = true;
+    }
+
+    struct ifaddrs_list links = {NULL, NULL};
+    struct ifaddrs_list addrs = {NULL, NULL};
+    bool has_links = false;
+    bool has_addrs = false;
+    bool cached = false;
+    // the dumps kept being interrupted until the retry policy gave up
+    bool exhausted = false;
+    // a message did not fit even after starting over
+    bool lost = false;
+    bool fell_back = false;
+    if (atomic_load(&cache.enabled) && !NETLINK_REPLAYING()) {
+        struct stats_timer timer = stats_enter(IFADDRS_PHASE_CACHE);
+        cached =
+            getifaddrs_cached(arena, link_arena, filter, &links, &addrs) == 0;
+        stats_leave(timer);
+    }
+    if (cached) {
+        has_links = true;
+        has_addrs = true;
     } else {
-        // looks like an android device
-        ERR_0(l3end)
-            freeifaddrs(l3addr);
-        ERR_END
-        *ifap = l3addr;
+        // both dumps share one socket and one receive buffer
+        struct netlink_session nl;
+        bool opened = netlink_open(&nl) == 0;
+        if (opened) {
+            if (filter && filter->ifindex) {
+                netlink_strict(&nl);
+            }
+
+            struct retry_state retry = {0};
+            struct ifaddrs_arena_mark link_mark = arena_mark(link_arena);
+            // a message bigger than the buffer is lost with its datagram and
+            // the session with it. The buffer hint has grown to fit since,
+            // both dumps start over once on a new session.
+            bool restarted = false;
+            for (;;) {
+                int l2ret;
+                while ((l2ret = getifaddrs_getlink(
+                            link_arena, &nl, filter, &links
+                        )) < 0 &&
+                       errno == EINTR && retry_next(&retry, true)) {
+                    continue;
+                }
+                has_links = l2ret == 0;
+                if (l2ret < 0 && errno == EINTR) {
+                    exhausted = true;
+                    break;
+                }
+                if (l2ret < 0 && errno == EMSGSIZE) {
+                    lost = restarted;
+                    if (!restarted &&
+                        netlink_restart(&nl, filter, &opened)) {
+                        restarted = true;
+                        continue;
+                    }
+                    break;
+                }
+                if (!want_addrs) {
+                    has_addrs = true;
+                    break;
+                }
+
+                struct link_index idx;
+                if (has_links) {
+                    link_index_build(&idx, links.head);
+                }
+                int l3ret;
+                while ((l3ret = getifaddrs_getaddr(
+                            arena, &nl, filter, has_links ? &idx : NULL,
+                            &addrs
+                        )) < 0 &&
+                       errno == EINTR &&
+                       !(has_links &&
+                         (retry_flags(&retry) & IFADDRS_RETRY_BOTH)) &&
+                       retry_next(&retry, true)) {
+                    continue;
+                }
+                bool interrupted = l3ret < 0 && errno == EINTR;
+                bool too_big = l3ret < 0 && errno == EMSGSIZE;
+                has_addrs = l3ret == 0;
+                if (has_links) {
+                    link_index_free(&idx);
+                }
+                if (too_big) {
+                    lost = restarted;
+                    if (!restarted &&
+                        netlink_restart(&nl, filter, &opened)) {
+                        restarted = true;
+                        arena_rollback(link_arena, link_mark);
+                        continue;
+                    }
+                    break;
+                }
+                if (interrupted && has_links &&
+                    (retry_flags(&retry) & IFADDRS_RETRY_BOTH) &&
+                    retry_next(&retry, true)) {
+                    // addresses are joined with links from the same attempt
+                    arena_rollback(link_arena, link_mark);
+                    continue;
+                }
+                exhausted = interrupted;
+                break;
+            }
+        }
+        if (opened) {
+            netlink_close(&nl);
+        }
+        if (!has_addrs && !exhausted && !lost && !NETLINK_REPLAYING()) {
+            struct stats_timer timer = stats_enter(IFADDRS_PHASE_IOCTL);
+            addrs.tail = getifaddrs_ioctl(arena, &addrs.head, !has_links);
+            stats_leave(timer);
+            if (addrs.tail) {
+                stats_add(STATS_FALLBACKS, 1);
+                IFADDRS_PROBE(fallback);
+                has_addrs = true;
+                fell_back = true;
+                filter_ioctl_result(&addrs, filter);
+            }
+        }
+    }
+
+    ERR_0(has_addrs)
+        if (lost) {
+            save_errno = EMSGSIZE;
+        }
+        // system configuration is not sane...
+        if (link_arena != arena) {
+            arena_destroy(link_arena);
+        }
+        bool ex = arena->ex;
+        arena_destroy(arena);
+        if (exhausted) {
+            return retry_stale(ifap, filter, ex);
+        }
+    ERR_END
+
+    if (has_links && want_links) {
+        // looks like an android device otherwise
+        result = links;
+    }
+    if (!result.tail) {
+        result = addrs;
+    } else if (addrs.head) {
+        result.tail->ifa_next = addrs.head;
+        result.tail = addrs.tail;
+    }
+    if (link_arena != arena) {
+        arena_destroy(link_arena);
+    }
+    // a stale list may be served to any caller, so it has to be complete
+    if (!filter && !fell_back && !arena->no_stats &&
+        (atomic_load(&retry_policy.flags) & IFADDRS_RETRY_STALE)) {
+        retry_save(result.head);
     }
-    return 0;
 #else
-    return getifaddrs_ioctl(ifap, true) ? 0 : -1;
+    struct stats_timer timer = stats_enter(IFADDRS_PHASE_IOCTL);
+    result.tail = getifaddrs_ioctl(arena, &result.head, true);
+    stats_leave(timer);
+    ERR_0(result.tail)
+        arena_destroy(arena);
+    ERR_END
+    filter_ioctl_result(&result, filter);
 #endif
-}
 
-void freeifaddrs(struct ifaddrs *ifa) {
-    while (ifa) {
-        struct ifaddrs *next = ifa->ifa_next;
-        free_ifaddr(TO_INTERNAL(ifa));
-        ifa = next;
+    if (!result.head) {
+        arena_destroy(arena);
+        return 0;
     }
+    *ifap = result.head;
+    return 0;
 }
 
-static void free_ifaddr(struct ifaddrs_internal *ifa) {
+void freeifaddrs(struct ifaddrs *ifa) {
     if (!ifa) {
         return;
     }
-    struct ifaddrs *ifp = &ifa->inner;
-    free(ifp->ifa_name);
-    free(ifp->ifa_addr);
-    free(ifp->ifa_netmask);
-    free(ifp->ifa_broadaddr);
-#ifndef IFADDRS_USE_UNION
-    free(ifp->ifa_dstaddr);
-#endif
-    free(ifp->ifa_data);
+    arena_destroy(TO_INTERNAL(ifa)->arena);
+}
+
+int getifaddrs_foreach(getifaddrs_foreach_cb cb, void *ctx) {
+    if (!cb) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    free(ifa);
+    stats_call_begin(true);
+    int ret = foreach_run(cb, ctx);
+    stats_call_end();
+    return ret;
 }
 
-static void free_dstaddr(struct ifaddrs *ifa) {
-    if (!ifa) {
-        return;
+static int foreach_run(getifaddrs_foreach_cb cb, void *ctx) {
+#ifndef IFADDRS_USE_IOCTL
+    _Alignas(max_align_t) unsigned char arena_buf[FOREACH_ARENA_SIZE] = {0};
+    struct nlmsghdr buf[FOREACH_BUF_SIZE / sizeof(struct nlmsghdr)];
+    struct link_slot links[LINK_SLOTS] = {{0}};
+
+    struct netlink_session nl;
+    if (NETLINK_REPLAYING() ||
+        netlink_open_with(&nl, buf, sizeof(buf), true) < 0) {
+        return foreach_list(cb, ctx);
+    }
+
+    struct ifaddrs_arena *arena = arena_create_in(arena_buf, sizeof(arena_buf));
+    struct ifaddrs_arena_mark mark = arena_mark(arena);
+    struct foreach_ctx fctx = {arena, mark, cb, ctx, 0, links, -1};
+
+    struct getlink_msg link_request;
+    init_getlink_request(&link_request, NULL);
+    struct stats_timer timer = stats_enter(IFADDRS_PHASE_GETLINK);
+    int ret = netlink_dump(
+        &nl, &link_request.hdr, RTM_NEWLINK, foreach_link_cb, &fctx
+    );
+    stats_leave(timer);
+    if (ret == 0) {
+        struct getaddr_msg addr_request;
+        init_getaddr_request(&addr_request, NULL);
+        timer = stats_enter(IFADDRS_PHASE_GETADDR);
+        ret = netlink_dump(
+            &nl, &addr_request.hdr, RTM_NEWADDR, foreach_addr_cb, &fctx
+        );
+        stats_leave(timer);
     }
-    free(ifa->ifa_dstaddr);
-    ifa->ifa_dstaddr = NULL;
+
+    int save_errno = errno;
+    // frees whatever an oversized entry had to take from the heap
+    arena_rollback(arena, mark);
+    close_ioctl_socket(fctx.ioctl_sockfd);
+    netlink_close(&nl);
+    errno = save_errno;
+    return ret < 0 ? -1 : fctx.stopped;
+#else
+    return foreach_list(cb, ctx);
+#endif
 }
 
-static void free_broadaddr(struct ifaddrs *ifa) {
-    if (!ifa) {
-        return;
+int getifstats(struct ifaddrs_ifstats *stats, size_t n) {
+    if (!stats && n) {
+        errno = EFAULT;
+        return -1;
     }
-    free(ifa->ifa_broadaddr);
-    ifa->ifa_broadaddr = NULL;
+
+    stats_call_begin(true);
+    int ret = getifstats_run(stats, n);
+    stats_call_end();
+    return ret;
 }
 
-static struct ifaddrs_internal *
-alloc_ifaddr(size_t socklen, bool hardware_address) {
-    struct ifaddrs_internal *ifa;
-    if (!(ifa = calloc(1, sizeof(struct ifaddrs_internal)))) {
-        return NULL;
+static int getifstats_run(struct ifaddrs_ifstats *stats, size_t n) {
+#ifndef IFADDRS_USE_IOCTL
+    struct getstats_ctx ctx = {stats, n, 0, NULL};
+    ERR_NEG(getstats_dump(&ctx))
+    ERR_END
+    return ctx.count > INT_MAX ? INT_MAX : (int)ctx.count;
+#else
+    (void)stats;
+    (void)n;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+int getifaddrs_async_start(
+    struct getifaddrs_async **op, const struct ifaddrs_filter *filter
+) {
+    stats_call_begin(true);
+    int ret = async_start(op, filter);
+    stats_call_end();
+    return ret;
+}
+
+static int
+async_start(struct getifaddrs_async **op, const struct ifaddrs_filter *filter) {
+    if (op == NULL) {
+        errno = EFAULT;
+        return -1;
     }
-    struct ifaddrs *ifp = &ifa->inner;
+    *op = NULL;
 
-    if (!(ifp->ifa_name = calloc(1, IFNAMSIZ)) ||
-        !(ifp->ifa_addr = calloc(1, socklen)) ||
-        !(ifp->ifa_broadaddr = calloc(1, socklen))) {
-        free_ifaddr(ifa);
-        return NULL;
+#ifndef IFADDRS_USE_IOCTL
+    struct getifaddrs_async *a;
+    ERR_0(a = calloc(1, sizeof(*a)))
+    ERR_END
+    a->actx.ioctl_sockfd = -1;
+    if (filter) {
+        a->filter_copy = *filter;
+        a->filter = &a->filter_copy;
     }
+    a->want_links = filter_family(a->filter, AF_PACKET);
+    a->want_addrs =
+        filter_family(a->filter, AF_INET) || filter_family(a->filter, AF_INET6);
 
-    if (!hardware_address) {
-        if (!(ifp->ifa_netmask = calloc(1, socklen))) {
-            free_ifaddr(ifa);
-            return NULL;
-        }
+    ERR_0(a->arena = arena_create())
+        async_free(a);
+    ERR_END
+    a->link_arena = a->arena;
+    if (!a->want_links) {
+        ERR_0(a->link_arena = arena_create())
+            async_free(a);
+        ERR_END
+        a->link_arena->no_stats = true;
     }
 
-#ifndef IFADDRS_USE_UNION
-    if (!hardware_address) {
-        if (!(ifp->ifa_dstaddr = calloc(1, socklen))) {
-            free_ifaddr(ifa);
-            return NULL;
+    // the caller polls it and it is made non-blocking, it cannot be shared
+    ERR_NEG(netlink_open_with(&a->nl, NULL, 0, false))
+        a->nl.transport = NULL;
+        async_free(a);
+    ERR_END
+    // recorded replies cannot be waited for
+    ERR(a->nl.fd < 0)
+        async_free(a);
+        save_errno = ENOTSUP;
+    ERR_END
+    int fl;
+    ERR_NEG(fl = fcntl(a->nl.fd, F_GETFL))
+        async_free(a);
+    ERR_END
+    ERR_NEG(fcntl(a->nl.fd, F_SETFL, fl | O_NONBLOCK))
+        async_free(a);
+    ERR_END
+    if (a->filter && a->filter->ifindex) {
+        netlink_strict(&a->nl);
+    }
+
+    // the join needs the links even when they are not part of the result
+    a->phase = ASYNC_GETLINK;
+    a->has_links = true;
+    a->link_mark = arena_mark(a->link_arena);
+    a->mark = a->link_mark;
+    init_getlink_request(&a->link_request, a->filter);
+    if (a->link_arena->no_stats) {
+        getlink_skip_stats(&a->link_request);
+    }
+    init_getaddr_request(&a->addr_request, a->filter);
+    struct stats_timer timer = stats_enter(a->phase);
+    int ret = async_send(a);
+    stats_leave(timer);
+    if (ret < 0 && (errno == EACCES || errno == EPERM)) {
+        // refused before, the address dump goes first. Without addresses to
+        // ask for, its reply only wakes the caller up for the empty result.
+        ret = async_without_links(a);
+        if (ret == 0) {
+            timer = stats_enter(a->phase);
+            ret = async_send(a);
+            stats_leave(timer);
         }
     }
+    ERR_NEG(ret)
+        async_free(a);
+    ERR_END
+
+    *op = a;
+    return a->nl.fd;
+#else
+    (void)filter;
+    errno = ENOTSUP;
+    return -1;
 #endif
+}
 
-    return ifa;
+int getifaddrs_async_step(struct getifaddrs_async *op, struct ifaddrs **ifap) {
+    if (op == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    stats_call_begin(false);
+    int ret = async_step(op, ifap);
+    stats_call_end();
+    return ret;
 }
 
+static int async_step(struct getifaddrs_async *op, struct ifaddrs **ifap) {
 #ifndef IFADDRS_USE_IOCTL
-#define DUMP_BUF_SIZE 8192
-// for AF_PACKET
-static struct ifaddrs *getifaddrs_getlink(struct ifaddrs **ifap) {
     if (ifap == NULL) {
+        async_free(op);
         errno = EFAULT;
-        return NULL;
+        return -1;
     }
-
     *ifap = NULL;
 
-    int sockfd;
-    ERR_NEG(sockfd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE))
-    NULL_END
+    for (;;) {
+        if (!op->has_links && !op->want_addrs) {
+            // the link dump was refused and nothing else was asked for
+            return async_finish(op, ifap);
+        }
+        struct stats_timer timer = stats_enter(op->phase);
+        int ret;
+        if (!op->sent) {
+            ret = async_send(op);
+        } else {
+            ret = netlink_dump_step(&op->nl, &op->dump);
+        }
+        if (ret < 0 && errno == EINTR) {
+            stats_add(STATS_RETRIES, 1);
+            IFADDRS_PROBE(dump_retry, op->phase);
+        }
+        stats_leave(timer);
+        if (ret < 0) {
+            if (errno == EAGAIN) {
+                return 1;
+            }
+            if (op->phase == ASYNC_GETLINK &&
+                (errno == EACCES || errno == EPERM)) {
+                // like getifaddrs_filter(), the addresses can do without
+                ERR_NEG(async_without_links(op))
+                    async_free(op);
+                ERR_END
+                continue;
+            }
+            if (errno != EINTR || !retry_next(&op->retry, false)) {
+                break;
+            }
+            if (op->phase == ASYNC_GETADDR && op->has_links &&
+                (retry_flags(&op->retry) & IFADDRS_RETRY_BOTH)) {
+                // addresses are joined with links from the same attempt
+                arena_rollback(op->arena, op->mark);
+                link_index_free(&op->idx);
+                op->phase = ASYNC_GETLINK;
+                op->mark = op->link_mark;
+            }
+            // start the phase over, once what is left of it is drained
+            op->sent = false;
+            continue;
+        }
+        if (ret == 0) {
+            continue;
+        }
 
-    struct getlink_msg {
-        struct nlmsghdr hdr;
-        struct ifinfomsg ifi __attribute__((aligned(NLMSG_ALIGNTO)));
-    } request = {0};
-    request.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    request.hdr.nlmsg_type = RTM_GETLINK;
-    request.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-    request.hdr.nlmsg_seq = 1;
-    request.ifi.ifi_family = AF_UNSPEC;
-    request.ifi.ifi_change = 0xFFFFFFFF;
+        if (op->phase == ASYNC_GETLINK && op->want_addrs) {
+            link_index_build(&op->idx, op->lctx.list.head);
+            op->phase = ASYNC_GETADDR;
+            op->mark = arena_mark(op->arena);
+            op->sent = false;
+            continue;
+        }
+        return async_finish(op, ifap);
+    }
 
-    struct sockaddr_nl sa = {AF_NETLINK};
-    socklen_t salen = sizeof(sa);
+    int ret = -1;
+    if (errno == EINTR) {
+        // out of retries
+        ret = retry_stale(ifap, op->filter, op->arena->ex);
+    }
+    int save_errno = errno;
+    async_free(op);
+    errno = save_errno;
+    return ret;
+#else
+    (void)op;
+    (void)ifap;
+    errno = EINVAL;
+    return -1;
+#endif
+}
 
-    ERR_WITH_RETRY(
-        sendto(
-            sockfd, &request, sizeof(request), 0, (struct sockaddr *)&sa, salen
-        ) < (ssize_t)sizeof(request)
-    )
-        close(sockfd);
-    NULL_END
+void getifaddrs_async_cancel(struct getifaddrs_async *op) {
+#ifndef IFADDRS_USE_IOCTL
+    if (op) {
+        async_free(op);
+    }
+#else
+    (void)op;
+#endif
+}
 
-    // kernel recommend 32k for dump
-    struct nlmsghdr *buf;
-    ERR_0(buf = calloc(1, DUMP_BUF_SIZE))
-        close(sockfd);
-    NULL_END
+struct ifaddrs_snapshot *ifaddrs_snapshot_acquire(void) {
+    struct ifaddrs_snapshot *snap = snapshot_get();
+    uint64_t max_age = atomic_load(&snapshots.max_age_ms) * 1000000ULL;
+    if (snap && monotonic_ns() - snap->taken_ns <= max_age) {
+        return snap;
+    }
 
-    struct iovec iov = {buf, DUMP_BUF_SIZE};
-    struct msghdr msg = {&sa, salen, &iov, 1, NULL, 0, 0};
+    if (snap) {
+        // somebody is refreshing already, a slightly stale one will do
+        if (pthread_mutex_trylock(&snapshots.refresh_lock) != 0) {
+            return snap;
+        }
+    } else {
+        pthread_mutex_lock(&snapshots.refresh_lock);
+    }
 
-    struct ifaddrs *ifp = *ifap;
+    struct ifaddrs_snapshot *fresh = snapshot_get();
+    if (fresh != snap && fresh &&
+        monotonic_ns() - fresh->taken_ns <= max_age) {
+        // refreshed while we were waiting for the lock
+        pthread_mutex_unlock(&snapshots.refresh_lock);
+        if (snap) {
+            ifaddrs_snapshot_release(snap);
+        }
+        return fresh;
+    }
+    if (fresh) {
+        ifaddrs_snapshot_release(fresh);
+    }
 
-    int finish = 0;
-    while (!finish) {
-        ssize_t len;
-        ERR_NEG_WITH_RETRY(len = recvmsg(sockfd, &msg, 0))
-            freeifaddrs(*ifap);
-            *ifap = NULL;
-            free(buf);
-            close(sockfd);
-        NULL_END
+    fresh = snapshot_refresh();
+    int save_errno = errno;
+    pthread_mutex_unlock(&snapshots.refresh_lock);
+    if (!fresh) {
+        // keep serving the old one rather than failing
+        errno = save_errno;
+        return snap;
+    }
+    if (snap) {
+        ifaddrs_snapshot_release(snap);
+    }
+    return fresh;
+}
 
-        ERR(msg.msg_flags & MSG_TRUNC)
-            freeifaddrs(*ifap);
-            *ifap = NULL;
-            free(buf);
-            close(sockfd);
-        NULL_END
+void ifaddrs_snapshot_release(struct ifaddrs_snapshot *snap) {
+    if (!snap) {
+        return;
+    }
+    if (atomic_fetch_sub(&snap->refs, 1) == 1) {
+        freeifaddrs(snap->list);
+        free(snap);
+    }
+}
 
-        for (struct nlmsghdr *nlh = buf; NLMSG_OK(nlh, len);
-             nlh = NLMSG_NEXT(nlh, len)) {
-            if (nlh->nlmsg_type == NLMSG_DONE) {
-                finish = 1;
-                break;
-            }
-            ERR(nlh->nlmsg_type == NLMSG_ERROR)
-                freeifaddrs(*ifap);
-                *ifap = NULL;
-                free(buf);
-                close(sockfd);
-            NULL_END
+const struct ifaddrs *
+ifaddrs_snapshot_list(const struct ifaddrs_snapshot *snap) {
+    return snap ? snap->list : NULL;
+}
 
-            if (nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
-                errno = EINTR;
-                freeifaddrs(*ifap);
-                *ifap = NULL;
-                free(buf);
-                close(sockfd);
-                return NULL;
-            }
+void ifaddrs_snapshot_set_max_age(unsigned int ms) {
+    atomic_store(&snapshots.max_age_ms, ms);
+}
 
-            if (nlh->nlmsg_type != RTM_NEWLINK) {
-                fprintf(stderr, "Unknown message type %d\n", nlh->nlmsg_type);
-                continue;
-            }
+// new reference to the published snapshot, if any
+static struct ifaddrs_snapshot *snapshot_get(void) {
+    unsigned int epoch;
+    for (;;) {
+        epoch = atomic_load(&snapshots.epoch);
+        atomic_fetch_add(&snapshots.readers[epoch], 1);
+        if (atomic_load(&snapshots.epoch) == epoch) {
+            break;
+        }
+        // a refresh flipped the epoch and may not wait for this counter
+        atomic_fetch_sub(&snapshots.readers[epoch], 1);
+    }
+    struct ifaddrs_snapshot *snap = atomic_load(&snapshots.current);
+    if (snap) {
+        atomic_fetch_add(&snap->refs, 1);
+    }
+    atomic_fetch_sub(&snapshots.readers[epoch], 1);
+    return snap;
+}
+
+// take and publish a new snapshot with refresh_lock held, returns a reference
+// for the caller
+static struct ifaddrs_snapshot *snapshot_refresh(void) {
+    struct ifaddrs_snapshot *snap;
+    if (!(snap = malloc(sizeof(*snap)))) {
+        return NULL;
+    }
+    if (getifaddrs(&snap->list) < 0) {
+        free(snap);
+        return NULL;
+    }
+    snap->taken_ns = monotonic_ns();
+    // one for being published, one for the caller
+    atomic_init(&snap->refs, 2);
 
-            struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    struct ifaddrs_snapshot *prev = atomic_exchange(&snapshots.current, snap);
+    if (prev) {
+        // a reader that saw prev announced itself before the exchange, in
+        // the epoch that is about to end
+        unsigned int epoch = atomic_load(&snapshots.epoch);
+        atomic_store(&snapshots.epoch, !epoch);
+        while (atomic_load(&snapshots.readers[epoch]) != 0) {
+            sched_yield();
+        }
+        ifaddrs_snapshot_release(prev);
+    }
+    return snap;
+}
 
-            struct ifaddrs_internal *outer;
-            if (ifi->ifi_family == AF_UNSPEC) {
-                ERR_0(outer = alloc_ifaddr(sizeof(struct sockaddr_ll), true))
-                    freeifaddrs(*ifap);
-                    *ifap = NULL;
-                    free(buf);
-                    close(sockfd);
-                NULL_END
-            } else {
-                fprintf(
-                    stderr, "Unknown address family: %d\n", ifi->ifi_family
-                );
-                continue;
-            }
-            struct ifaddrs *ifaddr = &outer->inner;
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-            ifaddr->ifa_flags = ifi->ifi_flags;
-            outer->index = ifi->ifi_index;
+struct ifaddrs_owner_index *
+ifaddrs_owner_index_create(const struct ifaddrs *list) {
+    struct ifaddrs_owner_index *index;
+    ERR_0(index = calloc(1, sizeof(*index)))
+    NULL_END
+    struct owner_table *table;
+    ERR_0(table = owner_table_build(list))
+        free(index);
+    NULL_END
+    atomic_init(&index->current, table);
+    pthread_mutex_init(&index->refresh_lock, NULL);
+    return index;
+}
 
-            ERR_0(ifaddr->ifa_data = malloc(sizeof(struct rtnl_link_stats)))
-                free_ifaddr(outer);
-                freeifaddrs(*ifap);
-                *ifap = NULL;
-                free(buf);
-                close(sockfd);
-            NULL_END
+int ifaddrs_owner_index_refresh(
+    struct ifaddrs_owner_index *index, const struct ifaddrs *list
+) {
+    if (!index) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct owner_table *table;
+    ERR_0(table = owner_table_build(list))
+    ERR_END
 
-            bool has_broadaddr = false, has_addr = false;
-            ssize_t rtl = IFLA_PAYLOAD(nlh);
-            for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, rtl);
-                 rta = RTA_NEXT(rta, rtl)) {
-                size_t payload = RTA_PAYLOAD(rta);
-                void *data = RTA_DATA(rta);
-                if (rta->rta_type == IFLA_IFNAME) {
-                    strncpy(ifaddr->ifa_name, data, IFNAMSIZ);
-                    ifaddr->ifa_name[IFNAMSIZ - 1] = '\0';
-                } else if (rta->rta_type == IFLA_STATS) {
-                    memcpy(
-                        ifaddr->ifa_data, data, sizeof(struct rtnl_link_stats)
-                    );
-                } else if (rta->rta_type == IFLA_ADDRESS) {
-                    has_addr = true;
-                    struct sockaddr_ll *sll =
-                        (struct sockaddr_ll *)ifaddr->ifa_addr;
-                    sll->sll_family = AF_PACKET;
-                    if (payload > sizeof(sll->sll_addr)) {
-                        free(ifaddr->ifa_addr);
-                        continue;
-                    }
-                    memcpy(&sll->sll_addr, data, sizeof(sll->sll_addr));
-                    sll->sll_halen = payload;
-                    sll->sll_hatype = ifi->ifi_type;
-                    sll->sll_ifindex = ifi->ifi_index;
-                } else if (rta->rta_type == IFLA_BROADCAST) {
-                    has_broadaddr = true;
-                    struct sockaddr_ll *sll =
-                        (struct sockaddr_ll *)ifaddr->ifa_broadaddr;
-                    sll->sll_family = AF_PACKET;
-                    if (payload > sizeof(sll->sll_addr)) {
-                        free(ifaddr->ifa_broadaddr);
-                        continue;
-                    }
-                    memcpy(&sll->sll_addr, data, sizeof(sll->sll_addr));
-                    sll->sll_halen = payload;
-                    sll->sll_hatype = ifi->ifi_type;
-                    sll->sll_ifindex = ifi->ifi_index;
-                }
-            }
+    pthread_mutex_lock(&index->refresh_lock);
+    struct owner_table *prev = atomic_exchange(&index->current, table);
+    // a lookup still on prev announced itself in the epoch that is about to
+    // end, later ones see the flip and announce themselves again
+    unsigned int epoch = atomic_load(&index->epoch);
+    atomic_store(&index->epoch, !epoch);
+    while (atomic_load(&index->readers[epoch]) != 0) {
+        sched_yield();
+    }
+    pthread_mutex_unlock(&index->refresh_lock);
+    free(prev);
+    return 0;
+}
 
-            if (!has_addr) {
-                free(ifaddr->ifa_addr);
-                ifaddr->ifa_addr = NULL;
-            }
-            if (!has_broadaddr) {
-                free_broadaddr(ifaddr);
-            }
+void ifaddrs_owner_index_destroy(struct ifaddrs_owner_index *index) {
+    if (!index) {
+        return;
+    }
+    free(atomic_load(&index->current));
+    pthread_mutex_destroy(&index->refresh_lock);
+    free(index);
+}
+
+int ifaddrs_lookup_owner(
+    struct ifaddrs_owner_index *index, const struct sockaddr *addr,
+    struct ifaddrs_owner *owner
+) {
+    if (!index || !addr || !owner) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (addr->sa_family != AF_INET && addr->sa_family != AF_INET6) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    unsigned int epoch;
+    struct owner_table *t = owner_enter(index, &epoch);
+    bool found;
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *)addr;
+        found = owner_lookup4(t, ntohl(sin->sin_addr.s_addr), owner);
+    } else {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)addr;
+        uint32_t scope = IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)
+                             ? sin6->sin6_scope_id
+                             : 0;
+        found = owner_lookup6(t, &sin6->sin6_addr, scope, owner);
+    }
+    owner_leave(index, epoch);
+    return found;
+}
+
+int ifaddrs_lookup_owner_batch(
+    struct ifaddrs_owner_index *index, int family, const void *addrs,
+    size_t n, struct ifaddrs_owner *owners
+) {
+    if (!index || (n && (!addrs || !owners))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (family != AF_INET && family != AF_INET6) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    unsigned int epoch;
+    struct owner_table *t = owner_enter(index, &epoch);
+    int found = 0;
+    if (family == AF_INET6) {
+        const struct in6_addr *in6 = addrs;
+        for (size_t i = 0; i < n; i++) {
+            found += owner_lookup6(t, &in6[i], 0, &owners[i]);
+        }
+        owner_leave(index, epoch);
+        return found;
+    }
+
+    const struct in_addr *in = addrs;
+    size_t i = 0;
+#ifdef OWNER_X86
+    // with more prefixes than one window holds, each group is searched for
+    // eight addresses at a time
+    if (t->avx2 && t->p4 > OWNER_WINDOW) {
+        for (; i + 8 <= n; i += 8) {
+            uint32_t block[8], pos[8];
+            for (size_t j = 0; j < 8; j++) {
+                block[j] = ntohl(in[i + j].s_addr);
+            }
+            owner_prefix4_avx2(t, block, pos);
+            for (size_t j = 0; j < 8; j++) {
+                struct ifaddrs_owner *owner = &owners[i + j];
+                owner->prefix_ifindex = 0;
+                owner->prefixlen = 0;
+                if (pos[j] < t->p4) {
+                    owner->prefix_ifindex = t->net4_index[pos[j]];
+                    owner->prefixlen = t->len4[pos[j]];
+                }
+                size_t k = owner_find4(t, t->addr4, t->n4, block[j]);
+                owner->ifindex = k < t->n4 ? t->addr4_index[k] : 0;
+                found += k < t->n4;
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        found += owner_lookup4(t, ntohl(in[i].s_addr), &owners[i]);
+    }
+    owner_leave(index, epoch);
+    return found;
+}
+
+// packed, sorted tables of the addresses and prefixes in list
+static struct owner_table *owner_table_build(const struct ifaddrs *list) {
+    size_t n4 = 0, n6 = 0;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr) {
+            continue;
+        }
+        if (ifa->ifa_addr->sa_family == AF_INET) {
+            n4++;
+        } else if (ifa->ifa_addr->sa_family == AF_INET6) {
+            n6++;
+        }
+    }
+
+    size_t size = ARENA_ALIGN(sizeof(struct owner_table)) +
+                  2 * ARENA_ALIGN((n4 + OWNER_WINDOW) * sizeof(uint32_t)) +
+                  2 * ARENA_ALIGN(n4 * sizeof(int)) + ARENA_ALIGN(n4) +
+                  ARENA_ALIGN(n4 * sizeof(struct owner_group)) +
+                  2 * ARENA_ALIGN(n6 * sizeof(struct in6_addr)) +
+                  2 * ARENA_ALIGN(n6 * sizeof(int)) +
+                  ARENA_ALIGN(n6 * sizeof(struct owner_group));
+    stats_add(STATS_ALLOCS, 1);
+    unsigned char *p;
+    ERR_0(p = calloc(1, size))
+    NULL_END
+    struct owner_table *t = (struct owner_table *)p;
+    p += ARENA_ALIGN(sizeof(struct owner_table));
+#define OWNER_CARVE(field, count)                                              \
+    do {                                                                       \
+        t->field = (void *)p;                                                  \
+        p += ARENA_ALIGN((count) * sizeof(*t->field));                         \
+    } while (0)
+    OWNER_CARVE(addr4, n4 + OWNER_WINDOW);
+    OWNER_CARVE(addr4_index, n4);
+    OWNER_CARVE(net4, n4 + OWNER_WINDOW);
+    OWNER_CARVE(len4, n4);
+    OWNER_CARVE(net4_index, n4);
+    OWNER_CARVE(group4, n4);
+    OWNER_CARVE(addr6, n6);
+    OWNER_CARVE(addr6_index, n6);
+    OWNER_CARVE(net6, n6);
+    OWNER_CARVE(net6_index, n6);
+    OWNER_CARVE(group6, n6);
+#undef OWNER_CARVE
+#ifdef OWNER_X86
+    t->avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (n4 + n6 == 0) {
+        return t;
+    }
+
+    struct owner_entry *entries;
+    stats_add(STATS_ALLOCS, 1);
+    ERR_0(entries = calloc(n4 + n6, sizeof(*entries)))
+        free(t);
+    NULL_END
+    size_t n = 0;
+    // an ioctl result leaves the ifindex of ipv4 entries to be asked for
+    const char *last_name = NULL;
+    int last_index = 0;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET &&
+                               ifa->ifa_addr->sa_family != AF_INET6)) {
+            continue;
+        }
+        struct owner_entry *e = &entries[n];
+        e->family = ifa->ifa_addr->sa_family;
+        e->pos = n++;
+        if (!last_name || strcmp(last_name, ifa->ifa_name) != 0) {
+            last_name = ifa->ifa_name;
+            last_index = owner_ifindex(ifa);
+        }
+        e->index = last_index;
+
+        size_t len;
+        const unsigned char *addr, *mask;
+        if (e->family == AF_INET) {
+            const struct sockaddr_in *sin = (void *)ifa->ifa_addr;
+            const struct sockaddr_in *nm = (void *)ifa->ifa_netmask;
+            len = sizeof(struct in_addr);
+            addr = (const unsigned char *)&sin->sin_addr;
+            mask = nm ? (const unsigned char *)&nm->sin_addr : NULL;
+        } else {
+            const struct sockaddr_in6 *sin6 = (void *)ifa->ifa_addr;
+            const struct sockaddr_in6 *nm = (void *)ifa->ifa_netmask;
+            len = sizeof(struct in6_addr);
+            addr = (const unsigned char *)&sin6->sin6_addr;
+            mask = nm ? (const unsigned char *)&nm->sin6_addr : NULL;
+        }
+        // network byte order compares like the numbers do
+        memcpy(&e->addr, addr, len);
+        if (mask) {
+            e->has_prefix = true;
+            e->prefixlen = owner_prefixlen(mask, len);
+            owner_mask(e->net.s6_addr, addr, e->prefixlen);
+        }
+    }
+
+    // an address on more than one interface belongs to the first one listed
+    qsort(entries, n, sizeof(*entries), owner_cmp_addr);
+    size_t run = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct owner_entry *e = &entries[i];
+        if (i && e->family == e[-1].family &&
+            memcmp(&e->addr, &e[-1].addr, sizeof(e->addr)) == 0) {
+            if (!owner_scoped(e) || owner_seen(&entries[run], i - run, e)) {
+                continue;
+            }
+        } else {
+            run = i;
+        }
+        if (e->family == AF_INET) {
+            uint32_t addr;
+            memcpy(&addr, &e->addr, sizeof(addr));
+            t->addr4[t->n4] = ntohl(addr);
+            t->addr4_index[t->n4++] = e->index;
+        } else {
+            t->addr6[t->n6] = e->addr;
+            t->addr6_index[t->n6++] = e->index;
+        }
+    }
+
+    qsort(entries, n, sizeof(*entries), owner_cmp_prefix);
+    run = 0;
+    for (size_t i = 0; i < n; i++) {
+        struct owner_entry *e = &entries[i];
+        if (!e->has_prefix) {
+            break;
+        }
+        if (i && e->family == e[-1].family &&
+            e->prefixlen == e[-1].prefixlen &&
+            memcmp(&e->net, &e[-1].net, sizeof(e->net)) == 0) {
+            if (!owner_scoped(e) || owner_seen(&entries[run], i - run, e)) {
+                continue;
+            }
+        } else {
+            run = i;
+        }
+        if (e->family == AF_INET) {
+            uint32_t net;
+            memcpy(&net, &e->net, sizeof(net));
+            owner_group_add(t->group4, &t->g4, t->p4, e->prefixlen);
+            t->net4[t->p4] = ntohl(net);
+            t->len4[t->p4] = e->prefixlen;
+            t->net4_index[t->p4++] = e->index;
+        } else {
+            owner_group_add(t->group6, &t->g6, t->p6, e->prefixlen);
+            t->net6[t->p6] = e->net;
+            t->net6_index[t->p6++] = e->index;
+        }
+    }
+    free(entries);
+    return t;
+}
+
+// entries of this library know their ifindex, except ipv4 ones from the
+// ioctl fallback and copies out of shared memory. Those of the C library are
+// looked up by name.
+static int owner_ifindex(const struct ifaddrs *ifa) {
+    int index = own_node(ifa) ? TO_INTERNAL(ifa)->index : 0;
+    if (index) {
+        return index;
+    }
+    char name[IFNAMSIZ];
+    strncpy(name, ifa->ifa_name, IFNAMSIZ);
+    name[IFNAMSIZ - 1] = '\0';
+    char *colon = strchr(name, ':');
+    if (colon) {
+        *colon = '\0';
+    }
+    return if_nametoindex(name);
+}
+
+// whether ifa was allocated by alloc_ifaddr(). What is read of a node of the
+// C library is still within it, its sockaddrs follow struct ifaddrs.
+static bool own_node(const struct ifaddrs *ifa) {
+    const struct ifaddrs_internal *outer = TO_INTERNAL(ifa);
+    if (outer->magic != IFADDRS_MAGIC) {
+        return false;
+    }
+    size_t offset = ARENA_ALIGN(sizeof(*outer));
+    if (outer->ex) {
+        offset += ARENA_ALIGN(sizeof(struct ifaddrs_ex));
+    }
+    return ifa->ifa_name == (const char *)outer + offset;
+}
+
+// link-local addresses and their prefixes are only the same on the same link
+static bool owner_scoped(const struct owner_entry *e) {
+    return e->family == AF_INET6 && IN6_IS_ADDR_LINKLOCAL(&e->addr);
+}
+
+// whether one of run[n] is on the link of e already
+static bool owner_seen(
+    const struct owner_entry *run, size_t n, const struct owner_entry *e
+) {
+    for (size_t i = 0; i < n; i++) {
+        if (run[i].index == e->index) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// leading ones of a netmask
+static unsigned int owner_prefixlen(const unsigned char *mask, size_t len) {
+    unsigned int bits = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char byte = mask[i];
+        while (byte & 0x80) {
+            bits++;
+            byte <<= 1;
+        }
+        if (mask[i] != 0xff) {
+            break;
+        }
+    }
+    return bits;
+}
+
+// the first len bits of addr, the rest of net is left zero
+static void
+owner_mask(unsigned char *net, const unsigned char *addr, unsigned int len) {
+    memcpy(net, addr, len / 8);
+    if (len % 8) {
+        net[len / 8] = addr[len / 8] & (0xffU << (8 - len % 8));
+    }
+}
+
+// counts a prefix into the last group, or starts a group for a shorter one
+static void owner_group_add(
+    struct owner_group *groups, size_t *count, size_t pos, unsigned int len
+) {
+    if (*count && groups[*count - 1].len == len) {
+        groups[*count - 1].count++;
+        return;
+    }
+    groups[(*count)++] = (struct owner_group){pos, 1, len};
+}
+
+// by family and address, then by position in the list
+static int owner_cmp_addr(const void *a, const void *b) {
+    const struct owner_entry *x = a, *y = b;
+    if (x->family != y->family) {
+        return x->family < y->family ? -1 : 1;
+    }
+    int cmp = memcmp(&x->addr, &y->addr, sizeof(x->addr));
+    if (cmp) {
+        return cmp;
+    }
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+// entries with a prefix first, by family, longest prefix, network and
+// position in the list
+static int owner_cmp_prefix(const void *a, const void *b) {
+    const struct owner_entry *x = a, *y = b;
+    if (x->has_prefix != y->has_prefix) {
+        return x->has_prefix ? -1 : 1;
+    }
+    if (x->family != y->family) {
+        return x->family < y->family ? -1 : 1;
+    }
+    if (x->prefixlen != y->prefixlen) {
+        return x->prefixlen > y->prefixlen ? -1 : 1;
+    }
+    int cmp = memcmp(&x->net, &y->net, sizeof(x->net));
+    if (cmp) {
+        return cmp;
+    }
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+// the current tables, safe to use until owner_leave()
+static struct owner_table *
+owner_enter(struct ifaddrs_owner_index *index, unsigned int *epoch) {
+    for (;;) {
+        unsigned int e = atomic_load(&index->epoch);
+        atomic_fetch_add(&index->readers[e], 1);
+        if (atomic_load(&index->epoch) == e) {
+            *epoch = e;
+            return atomic_load(&index->current);
+        }
+        // a refresh flipped the epoch and may not wait for this counter
+        atomic_fetch_sub(&index->readers[e], 1);
+    }
+}
+
+static void owner_leave(struct ifaddrs_owner_index *index, unsigned int epoch) {
+    atomic_fetch_sub(&index->readers[epoch], 1);
+}
+
+// the longest prefix is the first group, longest first, that has the address
+// masked to its length. One binary search per prefix length.
+static bool owner_lookup4(
+    const struct owner_table *t, uint32_t addr, struct ifaddrs_owner *owner
+) {
+    owner->prefix_ifindex = 0;
+    owner->prefixlen = 0;
+    for (size_t g = 0; g < t->g4; g++) {
+        const struct owner_group *group = &t->group4[g];
+        uint32_t mask = group->len ? ~(uint32_t)0 << (32 - group->len) : 0;
+        const uint32_t *net = t->net4 + group->start;
+        size_t k = owner_find4(t, net, group->count, addr & mask);
+        if (k < group->count) {
+            owner->prefix_ifindex = t->net4_index[group->start + k];
+            owner->prefixlen = group->len;
+            break;
+        }
+    }
+
+    size_t k = owner_find4(t, t->addr4, t->n4, addr);
+    owner->ifindex = k < t->n4 ? t->addr4_index[k] : 0;
+    return k < t->n4;
+}
+
+// a scope of 0 takes the first interface listed with a link-local address or
+// prefix, any other only the one with that ifindex
+static bool owner_lookup6(
+    const struct owner_table *t, const struct in6_addr *addr, uint32_t scope,
+    struct ifaddrs_owner *owner
+) {
+    owner->prefix_ifindex = 0;
+    owner->prefixlen = 0;
+    for (size_t g = 0; g < t->g6; g++) {
+        const struct owner_group *group = &t->group6[g];
+        struct in6_addr key = IN6ADDR_ANY_INIT;
+        owner_mask(key.s6_addr, addr->s6_addr, group->len);
+        const struct in6_addr *net = t->net6 + group->start;
+        const int *index = t->net6_index + group->start;
+        size_t k = owner_find6(net, group->count, &key);
+        k = owner_pick6(net, index, group->count, k, scope);
+        if (k < group->count) {
+            owner->prefix_ifindex = index[k];
+            owner->prefixlen = group->len;
+            break;
+        }
+    }
+
+    size_t k = owner_find6(t->addr6, t->n6, addr);
+    k = owner_pick6(t->addr6, t->addr6_index, t->n6, k, scope);
+    owner->ifindex = k < t->n6 ? t->addr6_index[k] : 0;
+    return k < t->n6;
+}
+
+// index of x in the sorted v[n], n if it is not there. The binary search
+// stops at OWNER_WINDOW entries, which are compared at once, v is padded for
+// the vector loads.
+static size_t owner_find4(
+    const struct owner_table *t, const uint32_t *v, size_t n, uint32_t x
+) {
+    size_t lo = 0, len = n;
+    while (len > OWNER_WINDOW) {
+        size_t half = len / 2;
+        if (v[lo + half] <= x) {
+            lo += half;
+            len -= half;
+        } else {
+            len = half;
+        }
+    }
+
+    size_t i;
+#ifdef OWNER_X86
+    if (t->avx2) {
+        i = owner_find4_avx2(v + lo, len, x);
+    } else {
+        i = owner_find4_sse2(v + lo, len, x);
+    }
+#else
+    (void)t;
+    for (i = 0; i < len && v[lo + i] != x; i++) {
+        continue;
+    }
+#endif
+    return i < len ? lo + i : n;
+}
+
+// the same for ipv6, all the way down. Link-local entries can be there more
+// than once, this is the first of them.
+static size_t
+owner_find6(const struct in6_addr *v, size_t n, const struct in6_addr *x) {
+    size_t lo = 0, len = n;
+    while (len > 0) {
+        size_t half = len / 2;
+        if (memcmp(&v[lo + half], x, sizeof(*x)) < 0) {
+            lo += half + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    return lo < n && memcmp(&v[lo], x, sizeof(*x)) == 0 ? lo : n;
+}
+
+// of the entries equal to v[k], the one on link scope, n if there is none
+static size_t owner_pick6(
+    const struct in6_addr *v, const int *index, size_t n, size_t k,
+    uint32_t scope
+) {
+    if (k == n || !scope) {
+        return k;
+    }
+    for (size_t i = k; i < n && memcmp(&v[i], &v[k], sizeof(v[k])) == 0;
+         i++) {
+        if ((uint32_t)index[i] == scope) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#ifdef OWNER_X86
+// four at a time, v is padded to a multiple of four
+static size_t owner_find4_sse2(const uint32_t *v, size_t n, uint32_t x) {
+    __m128i a = _mm_set1_epi32(x);
+    for (size_t i = 0; i < n; i += 4) {
+        __m128i w = _mm_loadu_si128((const __m128i *)(v + i));
+        unsigned int hits =
+            _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, w)));
+        if (n - i < 4) {
+            hits &= (1U << (n - i)) - 1;
+        }
+        if (hits) {
+            return i + __builtin_ctz(hits);
+        }
+    }
+    return n;
+}
+
+// eight at a time, v is padded to a multiple of eight
+__attribute__((target("avx2"))) static size_t
+owner_find4_avx2(const uint32_t *v, size_t n, uint32_t x) {
+    __m256i a = _mm256_set1_epi32(x);
+    for (size_t i = 0; i < n; i += 8) {
+        __m256i w = _mm256_loadu_si256((const __m256i *)(v + i));
+        unsigned int hits =
+            _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, w)));
+        if (n - i < 8) {
+            hits &= (1U << (n - i)) - 1;
+        }
+        if (hits) {
+            return i + __builtin_ctz(hits);
+        }
+    }
+    return n;
+}
+
+// the longest prefix for each of eight addresses, p4 for none. Each group is
+// binary searched for all of them at once with gathers, until every one has
+// matched.
+__attribute__((target("avx2"))) static void owner_prefix4_avx2(
+    const struct owner_table *t, const uint32_t *addrs, uint32_t *pos
+) {
+    // the compares are signed, flipping the top bit keeps the order
+    const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+    const int *net = (const int *)t->net4;
+    __m256i a = _mm256_loadu_si256((const __m256i *)addrs);
+    __m256i found = _mm256_set1_epi32(t->p4);
+    __m256i done = _mm256_setzero_si256();
+    for (size_t g = 0; g < t->g4; g++) {
+        const struct owner_group *group = &t->group4[g];
+        uint32_t mask = group->len ? ~(uint32_t)0 << (32 - group->len) : 0;
+        __m256i key = _mm256_and_si256(a, _mm256_set1_epi32(mask));
+        __m256i biased = _mm256_xor_si256(key, bias);
+        __m256i lo = _mm256_set1_epi32(group->start);
+        for (size_t len = group->count; len > 1; len -= len / 2) {
+            __m256i mid = _mm256_add_epi32(lo, _mm256_set1_epi32(len / 2));
+            __m256i v = _mm256_i32gather_epi32(net, mid, 4);
+            __m256i above =
+                _mm256_cmpgt_epi32(_mm256_xor_si256(v, bias), biased);
+            lo = _mm256_blendv_epi8(mid, lo, above);
+        }
+        __m256i hit =
+            _mm256_cmpeq_epi32(_mm256_i32gather_epi32(net, lo, 4), key);
+        hit = _mm256_andnot_si256(done, hit);
+        found = _mm256_blendv_epi8(found, lo, hit);
+        done = _mm256_or_si256(done, hit);
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(done)) == 0xff) {
+            break;
+        }
+    }
+    _mm256_storeu_si256((__m256i *)pos, found);
+}
+#endif
+
+struct ifaddrs_shm *ifaddrs_shm_create(int fd, size_t size) {
+    if (size == 0) {
+        size = SHM_SLOT_SIZE;
+    }
+    size = SHM_ALIGN(size);
+    size_t len = SHM_ALIGN(sizeof(struct ifaddrs_shm_header)) + 2 * size;
+    if (len > UINT32_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    bool owns_fd = fd < 0;
+    if (owns_fd) {
+        ERR_NEG(fd = syscall(SYS_memfd_create, "ifaddrs", MFD_CLOEXEC))
+        NULL_END
+    }
+    ERR_NEG(ftruncate(fd, len))
+        if (owns_fd) {
+            close(fd);
+        }
+    NULL_END
+
+    struct ifaddrs_shm *shm;
+    ERR_0(shm = shm_map(fd, owns_fd, true))
+        if (owns_fd) {
+            close(fd);
+        }
+    NULL_END
+
+    struct ifaddrs_shm_header *hdr = shm->hdr;
+    hdr->magic = SHM_MAGIC;
+    hdr->version = SHM_VERSION;
+    hdr->size = len;
+    hdr->slot_size = size;
+    hdr->slot[0] = SHM_ALIGN(sizeof(struct ifaddrs_shm_header));
+    hdr->slot[1] = hdr->slot[0] + size;
+    atomic_store(&hdr->seq, 0);
+    return shm;
+}
+
+struct ifaddrs_shm *ifaddrs_shm_open(int fd) {
+    struct ifaddrs_shm *shm;
+    ERR_0(shm = shm_map(fd, false, false))
+    NULL_END
+
+    struct ifaddrs_shm_header *hdr = shm->hdr;
+    if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION ||
+        hdr->size > shm->len || hdr->slot[0] > hdr->size ||
+        hdr->slot[1] > hdr->size ||
+        hdr->slot_size > hdr->size - hdr->slot[0] ||
+        hdr->slot_size > hdr->size - hdr->slot[1]) {
+        ifaddrs_shm_close(shm);
+        errno = EINVAL;
+        return NULL;
+    }
+    return shm;
+}
+
+int ifaddrs_shm_fd(const struct ifaddrs_shm *shm) {
+    return shm->fd;
+}
+
+void ifaddrs_shm_close(struct ifaddrs_shm *shm) {
+    if (!shm) {
+        return;
+    }
+    munmap(shm->hdr, shm->len);
+    if (shm->owns_fd) {
+        close(shm->fd);
+    }
+    free(shm);
+}
+
+int ifaddrs_shm_publish(struct ifaddrs_shm *shm, const struct ifaddrs *list) {
+    struct ifaddrs_shm_header *hdr = shm->hdr;
+
+    size_t size = 0;
+    uint32_t count = 0;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        size += SHM_ALIGN(sizeof(struct ifaddrs_shm_entry));
+        if (ifa->ifa_data) {
+            size += SHM_ALIGN(sizeof(struct rtnl_link_stats));
+        }
+        count++;
+    }
+    if (size > hdr->slot_size) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    uint32_t seq = atomic_load_explicit(&hdr->seq, memory_order_relaxed);
+    uint32_t next_seq = seq + 2;
+    int slot = SHM_SLOT(next_seq);
+    atomic_store_explicit(&hdr->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    unsigned char *base = (unsigned char *)hdr;
+    uint32_t offset = hdr->slot[slot];
+    struct ifaddrs_shm_entry *prev = NULL;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        struct ifaddrs_shm_entry *e =
+            (struct ifaddrs_shm_entry *)(base + offset);
+        memset(e, 0, sizeof(*e));
+        if (prev) {
+            prev->next = offset;
+        }
+        offset += SHM_ALIGN(sizeof(*e));
+
+        e->flags = ifa->ifa_flags;
+        strncpy(e->name, ifa->ifa_name, sizeof(e->name) - 1);
+        shm_put_sockaddr(e, IFADDRS_SHM_ADDR, e->addr, ifa->ifa_addr);
+        shm_put_sockaddr(e, IFADDRS_SHM_NETMASK, e->netmask, ifa->ifa_netmask);
+#ifndef IFADDRS_USE_UNION
+        shm_put_sockaddr(
+            e, IFADDRS_SHM_BROADADDR, e->broadaddr, ifa->ifa_broadaddr
+        );
+        shm_put_sockaddr(e, IFADDRS_SHM_DSTADDR, e->dstaddr, ifa->ifa_dstaddr);
+#else
+        if (ifa->ifa_flags & IFF_POINTOPOINT) {
+            shm_put_sockaddr(e, IFADDRS_SHM_DSTADDR, e->dstaddr, ifa->ifa_ifu);
+        } else {
+            shm_put_sockaddr(
+                e, IFADDRS_SHM_BROADADDR, e->broadaddr, ifa->ifa_ifu
+            );
+        }
+#endif
+        // ifa_data is only ever set for links, to struct rtnl_link_stats
+        if (ifa->ifa_data) {
+            e->data = offset;
+            e->data_len = sizeof(struct rtnl_link_stats);
+            memcpy(base + offset, ifa->ifa_data, e->data_len);
+            offset += SHM_ALIGN(e->data_len);
+        }
+        prev = e;
+    }
+    hdr->first[slot] = list ? hdr->slot[slot] : 0;
+    hdr->count[slot] = count;
+
+    atomic_store_explicit(&hdr->seq, next_seq, memory_order_release);
+    return 0;
+}
+
+unsigned int ifaddrs_shm_read_begin(const struct ifaddrs_shm *shm) {
+    return atomic_load_explicit(&shm->hdr->seq, memory_order_acquire);
+}
+
+const struct ifaddrs_shm_entry *
+ifaddrs_shm_first(const struct ifaddrs_shm *shm, unsigned int seq) {
+    // while a write is in progress the previous result is still intact
+    int slot = SHM_SLOT(seq & ~1U);
+    uint32_t first = shm->hdr->first[slot];
+    if (!first) {
+        return NULL;
+    }
+    return shm_at(shm, first, sizeof(struct ifaddrs_shm_entry));
+}
+
+const struct ifaddrs_shm_entry *ifaddrs_shm_next(
+    const struct ifaddrs_shm *shm, const struct ifaddrs_shm_entry *e
+) {
+    // entries only ever point forward, a torn read cannot loop
+    uint32_t here = (const unsigned char *)e - (const unsigned char *)shm->hdr;
+    if (e->next <= here) {
+        return NULL;
+    }
+    return shm_at(shm, e->next, sizeof(struct ifaddrs_shm_entry));
+}
+
+const void *ifaddrs_shm_data(
+    const struct ifaddrs_shm *shm, const struct ifaddrs_shm_entry *e
+) {
+    if (!e->data) {
+        return NULL;
+    }
+    return shm_at(shm, e->data, e->data_len);
+}
+
+int ifaddrs_shm_read_retry(const struct ifaddrs_shm *shm, unsigned int seq) {
+    atomic_thread_fence(memory_order_acquire);
+    uint32_t now = atomic_load_explicit(&shm->hdr->seq, memory_order_relaxed);
+    // the slot that was read gets rewritten once seq reaches its value + 3
+    return now - (seq & ~1U) >= 3;
+}
+
+int ifaddrs_shm_to_list(const struct ifaddrs_shm *shm, struct ifaddrs **ifap) {
+    if (ifap == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+    *ifap = NULL;
+
+    struct ifaddrs_arena *arena;
+    ERR_0(arena = arena_create())
+    ERR_END
+    struct ifaddrs_arena_mark mark = arena_mark(arena);
+
+    struct ifaddrs_list list;
+    unsigned int seq;
+    do {
+        arena_rollback(arena, mark);
+        list.head = NULL;
+        list.tail = NULL;
+
+        seq = ifaddrs_shm_read_begin(shm);
+        for (const struct ifaddrs_shm_entry *e = ifaddrs_shm_first(shm, seq);
+             e; e = ifaddrs_shm_next(shm, e)) {
+            struct ifaddrs_internal *outer;
+            ERR_0(
+                outer = alloc_ifaddr(arena, sizeof(struct sockaddr_in6), false)
+            )
+                arena_destroy(arena);
+            ERR_END
+            struct ifaddrs *ifaddr = &outer->inner;
+
+            ifaddr->ifa_flags = e->flags;
+            memcpy(ifaddr->ifa_name, e->name, sizeof(e->name));
+            ifaddr->ifa_name[sizeof(e->name) - 1] = '\0';
+            shm_get_sockaddr(e, IFADDRS_SHM_ADDR, e->addr, &ifaddr->ifa_addr);
+            shm_get_sockaddr(
+                e, IFADDRS_SHM_NETMASK, e->netmask, &ifaddr->ifa_netmask
+            );
+#ifndef IFADDRS_USE_UNION
+            shm_get_sockaddr(
+                e, IFADDRS_SHM_BROADADDR, e->broadaddr, &ifaddr->ifa_broadaddr
+            );
+            shm_get_sockaddr(
+                e, IFADDRS_SHM_DSTADDR, e->dstaddr, &ifaddr->ifa_dstaddr
+            );
+#else
+            if (e->has & IFADDRS_SHM_DSTADDR) {
+                shm_get_sockaddr(
+                    e, IFADDRS_SHM_DSTADDR, e->dstaddr, &ifaddr->ifa_ifu
+                );
+            } else {
+                shm_get_sockaddr(
+                    e, IFADDRS_SHM_BROADADDR, e->broadaddr, &ifaddr->ifa_ifu
+                );
+            }
+#endif
+            const void *data = ifaddrs_shm_data(shm, e);
+            if (data) {
+                size_t data_len = e->data_len;
+                ERR_0(ifaddr->ifa_data = arena_alloc(arena, data_len))
+                    arena_destroy(arena);
+                ERR_END
+                memcpy(ifaddr->ifa_data, data, data_len);
+            }
+
+            if (!list.tail) {
+                list.head = ifaddr;
+            } else {
+                list.tail->ifa_next = ifaddr;
+            }
+            list.tail = ifaddr;
+        }
+    } while (ifaddrs_shm_read_retry(shm, seq));
+
+    if (!list.head) {
+        arena_destroy(arena);
+        return 0;
+    }
+    *ifap = list.head;
+    return 0;
+}
+
+static struct ifaddrs_shm *shm_map(int fd, bool owns_fd, bool writable) {
+    struct stat st;
+    ERR_NEG(fstat(fd, &st))
+    NULL_END
+    if (st.st_size < (off_t)sizeof(struct ifaddrs_shm_header)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct ifaddrs_shm *shm;
+    ERR_0(shm = calloc(1, sizeof(*shm)))
+    NULL_END
+    shm->fd = fd;
+    shm->owns_fd = owns_fd;
+    shm->len = st.st_size;
+
+    int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *map = mmap(NULL, shm->len, prot, MAP_SHARED, fd, 0);
+    ERR(map == MAP_FAILED)
+        free(shm);
+    NULL_END
+    shm->hdr = map;
+    return shm;
+}
+
+// offset checked against the mapping, NULL if it does not fit
+static const void *
+shm_at(const struct ifaddrs_shm *shm, uint32_t offset, size_t len) {
+    if (offset % 4 != 0 || offset > shm->len || len > shm->len - offset) {
+        return NULL;
+    }
+    return (const unsigned char *)shm->hdr + offset;
+}
+
+static void shm_put_sockaddr(
+    struct ifaddrs_shm_entry *e, unsigned int bit, unsigned int *dst,
+    const struct sockaddr *sa
+) {
+    if (!sa) {
+        return;
+    }
+    memcpy(dst, sa, sockaddr_size(sa));
+    e->has |= bit;
+}
+
+// dst points to room for a struct sockaddr_in6, or is set to NULL
+static void shm_get_sockaddr(
+    const struct ifaddrs_shm_entry *e, unsigned int bit,
+    const unsigned int *src, struct sockaddr **dst
+) {
+    if (!(e->has & bit)) {
+        *dst = NULL;
+        return;
+    }
+    memcpy(*dst, src, sizeof(struct sockaddr_in6));
+}
+
+int ifaddrs_set_retry_policy(const struct ifaddrs_retry_policy *policy) {
+    struct ifaddrs_retry_policy defaults = {0, 0, 0, 0};
+    if (!policy) {
+        policy = &defaults;
+    }
+    if (policy->flags & ~(IFADDRS_RETRY_BOTH | IFADDRS_RETRY_STALE)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    atomic_store(&retry_policy.max_retries, policy->max_retries);
+    atomic_store(&retry_policy.backoff_us, policy->backoff_us);
+    atomic_store(&retry_policy.max_backoff_us, policy->max_backoff_us);
+    atomic_store(&retry_policy.flags, policy->flags);
+
+    if (!(policy->flags & IFADDRS_RETRY_STALE)) {
+        // nothing is going to be served from it any more
+        pthread_mutex_lock(&retry_policy.last_lock);
+        struct ifaddrs *last = retry_policy.last;
+        retry_policy.last = NULL;
+        pthread_mutex_unlock(&retry_policy.last_lock);
+        freeifaddrs(last);
+    }
+    return 0;
+}
+
+void ifaddrs_get_retry_policy(struct ifaddrs_retry_policy *policy) {
+    policy->max_retries = atomic_load(&retry_policy.max_retries);
+    policy->backoff_us = atomic_load(&retry_policy.backoff_us);
+    policy->max_backoff_us = atomic_load(&retry_policy.max_backoff_us);
+    policy->flags = atomic_load(&retry_policy.flags);
+}
+
+int ifaddrs_is_stale(const struct ifaddrs *list) {
+    return list && TO_INTERNAL(list)->arena->stale;
+}
+
+#ifndef IFADDRS_USE_IOCTL
+// the policy is only looked at once a dump has been interrupted
+static unsigned int retry_flags(struct retry_state *retry) {
+    if (!retry->loaded) {
+        ifaddrs_get_retry_policy(&retry->policy);
+        retry->backoff_us = retry->policy.backoff_us;
+        if (retry->policy.max_backoff_us &&
+            retry->backoff_us > retry->policy.max_backoff_us) {
+            retry->backoff_us = retry->policy.max_backoff_us;
+        }
+        retry->loaded = true;
+    }
+    return retry->policy.flags;
+}
+
+// whether to restart an interrupted dump, after the backoff if wait is set
+static bool retry_next(struct retry_state *retry, bool wait) {
+    retry_flags(retry);
+    if (retry->policy.max_retries &&
+        retry->count >= retry->policy.max_retries) {
+        IFADDRS_PROBE(retry_exhausted, retry->count);
+        return false;
+    }
+
+    // the first restart usually gets through, the ones after that wait
+    if (wait && retry->count > 0 && retry->backoff_us) {
+        struct timespec ts = {
+            retry->backoff_us / 1000000, (retry->backoff_us % 1000000) * 1000
+        };
+        while (STATS_SYSCALL(nanosleep(&ts, &ts)) < 0 && errno == EINTR) {
+            continue;
+        }
+        // 0 puts no limit on the wait, short of overflowing
+        unsigned int max_backoff_us = retry->policy.max_backoff_us
+                                          ? retry->policy.max_backoff_us
+                                          : UINT_MAX;
+        if (retry->backoff_us <= max_backoff_us / 2) {
+            retry->backoff_us *= 2;
+        } else {
+            retry->backoff_us = max_backoff_us;
+        }
+    }
+    retry->count++;
+    return true;
+}
+
+// the last full result in place of one the dumps could not deliver. A
+// caller of getifaddrs_ex() only gets one that has the records.
+static int retry_stale(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter, bool ex
+) {
+    if (filter ||
+        !(atomic_load(&retry_policy.flags) & IFADDRS_RETRY_STALE)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    pthread_mutex_lock(&retry_policy.last_lock);
+    int ret = -1;
+    errno = EAGAIN;
+    struct ifaddrs *last = retry_policy.last;
+    if (last && (!ex || TO_INTERNAL(last)->arena->ex)) {
+        ret = list_copy(last, ifap, ex);
+    }
+    pthread_mutex_unlock(&retry_policy.last_lock);
+
+    if (ret == 0) {
+        TO_INTERNAL(*ifap)->arena->stale = true;
+        IFADDRS_PROBE(stale);
+    }
+    return ret;
+}
+
+static void retry_save(const struct ifaddrs *list) {
+    struct ifaddrs *copy;
+    if (list_copy(list, &copy, TO_INTERNAL(list)->arena->ex) < 0) {
+        return;
+    }
+    pthread_mutex_lock(&retry_policy.last_lock);
+    struct ifaddrs *last = retry_policy.last;
+    retry_policy.last = copy;
+    pthread_mutex_unlock(&retry_policy.last_lock);
+    freeifaddrs(last);
+}
+
+// into an arena of its own, for results that outlive the call, with the
+// records of getifaddrs_ex() if ex is set and list has them
+static int
+list_copy(const struct ifaddrs *list, struct ifaddrs **out, bool ex) {
+    *out = NULL;
+    if (!list) {
+        return 0;
+    }
+
+    struct ifaddrs_arena *arena;
+    ERR_0(arena = arena_create())
+    ERR_END
+    arena->ex = ex && TO_INTERNAL(list)->arena->ex;
+    arena->no_stats = TO_INTERNAL(list)->arena->no_stats;
+
+    struct ifaddrs_list copy = {NULL, NULL};
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        bool link = ifa->ifa_addr && ifa->ifa_addr->sa_family == AF_PACKET;
+        struct ifaddrs_internal *outer;
+        ERR_0(outer = alloc_ifaddr(arena, sizeof(struct sockaddr_in6), link))
+            arena_destroy(arena);
+        ERR_END
+        struct ifaddrs *ifaddr = &outer->inner;
+        outer->index = TO_INTERNAL(ifa)->index;
+        if (outer->ex && TO_INTERNAL(ifa)->ex) {
+            *outer->ex = *TO_INTERNAL(ifa)->ex;
+        }
+
+        strcpy(ifaddr->ifa_name, ifa->ifa_name);
+        ifaddr->ifa_flags = ifa->ifa_flags;
+
+        struct sockaddr **dst[] = {
+            &ifaddr->ifa_addr, &ifaddr->ifa_netmask, &ifaddr->ifa_broadaddr,
+#ifndef IFADDRS_USE_UNION
+            &ifaddr->ifa_dstaddr,
+#endif
+        };
+        const struct sockaddr *src[] = {
+            ifa->ifa_addr, ifa->ifa_netmask, ifa->ifa_broadaddr,
+#ifndef IFADDRS_USE_UNION
+            ifa->ifa_dstaddr,
+#endif
+        };
+        for (size_t i = 0; i < sizeof(src) / sizeof(src[0]); i++) {
+            if (src[i] && *dst[i]) {
+                memcpy(*dst[i], src[i], sockaddr_size(src[i]));
+            } else {
+                *dst[i] = NULL;
+            }
+        }
+
+        // ifa_data is only ever set for links, to struct rtnl_link_stats
+        if (ifa->ifa_data) {
+            ERR_0(
+                ifaddr->ifa_data =
+                    arena_alloc(arena, sizeof(struct rtnl_link_stats))
+            )
+                arena_destroy(arena);
+            ERR_END
+            memcpy(
+                ifaddr->ifa_data, ifa->ifa_data, sizeof(struct rtnl_link_stats)
+            );
+        }
+
+        if (!copy.tail) {
+            copy.head = ifaddr;
+        } else {
+            copy.tail->ifa_next = ifaddr;
+        }
+        copy.tail = ifaddr;
+    }
+
+    *out = copy.head;
+    return 0;
+}
+
+#endif
+
+static size_t sockaddr_size(const struct sockaddr *sa) {
+    if (sa->sa_family == AF_INET6) {
+        return sizeof(struct sockaddr_in6);
+    } else if (sa->sa_family == AF_PACKET) {
+        return sizeof(struct sockaddr_ll);
+    }
+    return sizeof(struct sockaddr_in);
+}
+
+void ifaddrs_stats_enable(int on) {
+    atomic_store(&stats_enabled, on != 0);
+}
+
+void ifaddrs_stats_last(struct ifaddrs_stats *stats) {
+    *stats = stats_last;
+}
+
+void ifaddrs_stats_total(struct ifaddrs_stats *stats) {
+    unsigned long long words[STATS_WORDS];
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        words[i] = atomic_load_explicit(&stats_total[i], memory_order_relaxed);
+    }
+    memcpy(stats, words, sizeof(*stats));
+}
+
+void ifaddrs_stats_reset(void) {
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        atomic_store_explicit(&stats_total[i], 0, memory_order_relaxed);
+    }
+}
+
+static void stats_add(enum stats_counter counter, unsigned long long n) {
+    if (!atomic_load_explicit(&stats_enabled, memory_order_relaxed)) {
+        return;
+    }
+    struct ifaddrs_phase_stats *phase = &stats_call.phase[stats_phase];
+    switch (counter) {
+    case STATS_SYSCALLS:
+        phase->syscalls += n;
+        break;
+    case STATS_BYTES:
+        phase->bytes += n;
+        break;
+    case STATS_MESSAGES:
+        phase->messages += n;
+        break;
+    case STATS_ALLOCS:
+        phase->allocs += n;
+        break;
+    case STATS_RETRIES:
+        phase->retries += n;
+        break;
+    case STATS_FALLBACKS:
+        stats_call.fallbacks += n;
+        break;
+    case STATS_UNKNOWN:
+        stats_call.unknown += n;
+        break;
+    }
+}
+
+// everything counted until stats_leave() goes to phase
+static struct stats_timer stats_enter(int phase) {
+    struct stats_timer timer = {stats_phase, 0};
+    stats_phase = phase;
+    if (atomic_load_explicit(&stats_enabled, memory_order_relaxed)) {
+        timer.start = monotonic_ns();
+    }
+    IFADDRS_PROBE(phase_begin, phase);
+    return timer;
+}
+
+static void stats_leave(struct stats_timer timer) {
+    if (timer.start) {
+        stats_call.phase[stats_phase].elapsed_ns +=
+            monotonic_ns() - timer.start;
+    }
+    IFADDRS_PROBE(phase_end, stats_phase);
+    stats_phase = timer.phase;
+}
+
+// counted is false for calls that continue an earlier one
+static void stats_call_begin(bool counted) {
+    if (stats_depth++ > 0) {
+        return;
+    }
+    stats_phase = IFADDRS_PHASE_SETUP;
+    // the whole call is counted or not, whatever happens to the switch
+    // meanwhile, so stats_call only has to be cleared for counted ones
+    stats_counting =
+        atomic_load_explicit(&stats_enabled, memory_order_relaxed);
+    if (stats_counting) {
+        memset(&stats_call, 0, sizeof(stats_call));
+        stats_call.calls = counted;
+        stats_call.phase[IFADDRS_PHASE_SETUP].elapsed_ns = monotonic_ns();
+    }
+    IFADDRS_PROBE(call_begin);
+}
+
+static void stats_call_end(void) {
+    if (--stats_depth > 0) {
+        return;
+    }
+    IFADDRS_PROBE(call_end);
+    if (!stats_counting) {
+        return;
+    }
+    // setup is whatever the other phases did not take
+    struct ifaddrs_phase_stats *setup = &stats_call.phase[IFADDRS_PHASE_SETUP];
+    if (setup->elapsed_ns) {
+        setup->elapsed_ns = monotonic_ns() - setup->elapsed_ns;
+        for (int i = 0; i < IFADDRS_PHASES; i++) {
+            if (i != IFADDRS_PHASE_SETUP) {
+                setup->elapsed_ns -= stats_call.phase[i].elapsed_ns;
+            }
+        }
+    }
+    stats_last = stats_call;
+
+    unsigned long long words[STATS_WORDS];
+    memcpy(words, &stats_call, sizeof(words));
+    for (size_t i = 0; i < STATS_WORDS; i++) {
+        if (words[i]) {
+            atomic_fetch_add_explicit(
+                &stats_total[i], words[i], memory_order_relaxed
+            );
+        }
+    }
+}
+
+// walks a materialized list, for when there is nothing to stream from
+static int foreach_list(getifaddrs_foreach_cb cb, void *ctx) {
+    struct ifaddrs *ifap;
+    ERR_NEG(getifaddrs(&ifap))
+    ERR_END
+
+    int ret = 0;
+    struct ifaddrs *next;
+    for (struct ifaddrs *ifa = ifap; ifa; ifa = next) {
+        next = ifa->ifa_next;
+        ifa->ifa_next = NULL;
+        if ((ret = cb(ifa, ctx)) != 0) {
+            break;
+        }
+    }
+    freeifaddrs(ifap);
+    return ret;
+}
+
+static struct ifaddrs_arena *arena_create(void) {
+    struct ifaddrs_arena_block *block;
+    stats_add(STATS_ALLOCS, 1);
+    if (!(block = calloc(1, sizeof(*block) + ARENA_BLOCK_SIZE))) {
+        return NULL;
+    }
+    block->size = ARENA_BLOCK_SIZE;
+
+    // the arena header lives at the start of its own first block
+    struct ifaddrs_arena *arena = (struct ifaddrs_arena *)block->data;
+    block->used = ARENA_ALIGN(sizeof(struct ifaddrs_arena));
+    arena->current = block;
+    return arena;
+}
+
+static void arena_destroy(struct ifaddrs_arena *arena) {
+    if (!arena) {
+        return;
+    }
+    struct ifaddrs_arena_block *block = arena->current;
+    while (block) {
+        struct ifaddrs_arena_block *prev = block->prev;
+        free(block);
+        block = prev;
+    }
+}
+
+#ifndef IFADDRS_USE_IOCTL
+// arena on a caller supplied, zeroed buffer, only blocks it grows into are
+// freed. It must be rolled back rather than destroyed.
+static struct ifaddrs_arena *arena_create_in(void *buf, size_t size) {
+    struct ifaddrs_arena_block *block = buf;
+    block->prev = NULL;
+    block->size = size - sizeof(*block);
+
+    struct ifaddrs_arena *arena = (struct ifaddrs_arena *)block->data;
+    block->used = ARENA_ALIGN(sizeof(struct ifaddrs_arena));
+    arena->current = block;
+    return arena;
+}
+#endif
+
+// returned memory is zeroed
+static void *arena_alloc(struct ifaddrs_arena *arena, size_t size) {
+    struct ifaddrs_arena_block *block = arena->current;
+    size = ARENA_ALIGN(size);
+    if (block->size - block->used < size) {
+        size_t new_size = block->size * 2;
+        if (new_size < size) {
+            new_size = size;
+        }
+        struct ifaddrs_arena_block *next;
+        stats_add(STATS_ALLOCS, 1);
+        if (!(next = calloc(1, sizeof(*next) + new_size))) {
+            return NULL;
+        }
+        next->size = new_size;
+        next->prev = block;
+        arena->current = next;
+        block = next;
+    }
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static struct ifaddrs_arena_mark arena_mark(struct ifaddrs_arena *arena) {
+    struct ifaddrs_arena_mark mark = {arena->current, arena->current->used};
+    return mark;
+}
+
+// drop everything allocated after mark, e.g. a partial dump
+static void
+arena_rollback(struct ifaddrs_arena *arena, struct ifaddrs_arena_mark mark) {
+    struct ifaddrs_arena_block *block = arena->current;
+    while (block != mark.block) {
+        struct ifaddrs_arena_block *prev = block->prev;
+        free(block);
+        block = prev;
+    }
+    memset(block->data + mark.used, 0, block->used - mark.used);
+    block->used = mark.used;
+    arena->current = block;
+}
+
+// name and sockaddrs are packed right behind the node
+static struct ifaddrs_internal *alloc_ifaddr(
+    struct ifaddrs_arena *arena, size_t socklen, bool hardware_address
+) {
+    size_t node_size = ARENA_ALIGN(sizeof(struct ifaddrs_internal));
+    size_t name_size = ARENA_ALIGN(IFNAMSIZ);
+    size_t sock_size = ARENA_ALIGN(socklen);
+    size_t ex_size = arena->ex ? ARENA_ALIGN(sizeof(struct ifaddrs_ex)) : 0;
+    size_t nsock = 2; // addr, broadaddr
+    if (!hardware_address) {
+        nsock++; // netmask
+#ifndef IFADDRS_USE_UNION
+        nsock++; // dstaddr
+#endif
+    }
+
+    unsigned char *p;
+    if (!(p = arena_alloc(
+              arena, node_size + ex_size + name_size + nsock * sock_size
+          ))) {
+        return NULL;
+    }
+    struct ifaddrs_internal *ifa = (struct ifaddrs_internal *)p;
+    ifa->magic = IFADDRS_MAGIC;
+    ifa->arena = arena;
+    struct ifaddrs *ifp = &ifa->inner;
+    p += node_size;
+
+    if (ex_size) {
+        ifa->ex = (struct ifaddrs_ex *)p;
+        p += ex_size;
+    }
+
+    ifp->ifa_name = (char *)p;
+    p += name_size;
+    ifp->ifa_addr = (struct sockaddr *)p;
+    p += sock_size;
+    ifp->ifa_broadaddr = (struct sockaddr *)p;
+    p += sock_size;
+
+    if (!hardware_address) {
+        ifp->ifa_netmask = (struct sockaddr *)p;
+        p += sock_size;
+#ifndef IFADDRS_USE_UNION
+        ifp->ifa_dstaddr = (struct sockaddr *)p;
+        p += sock_size;
+#endif
+    }
+
+    return ifa;
+}
+
+void ifaddrs_socket_cache_enable(int on) {
+    if (on) {
+        pthread_once(&sockets.once, socket_cache_init);
+    }
+    atomic_store(&sockets.enabled, on != 0);
+    if (!on) {
+        socket_cache_close(&socket_cache);
+    }
+}
+
+static void socket_cache_init(void) {
+    sockets.has_key = pthread_key_create(&sockets.key, socket_cache_exit) == 0;
+    pthread_atfork(NULL, NULL, socket_cache_forked);
+}
+
+// sockets open in the parent are dropped on their next use, only the thread
+// that forked lives on in the child and the others never use theirs again
+static void socket_cache_forked(void) {
+    atomic_fetch_add(&sockets.generation, 1);
+}
+
+static void socket_cache_exit(void *cache) {
+    socket_cache_close(cache);
+}
+
+// the cache of this thread, NULL while the socket cache is off
+static struct socket_cache *socket_cache_get(void) {
+    struct socket_cache *c = &socket_cache;
+    if (!atomic_load_explicit(&sockets.enabled, memory_order_relaxed)) {
+        // turned off since this thread last used it
+        socket_cache_close(c);
+        return NULL;
+    }
+
+    unsigned int generation = atomic_load(&sockets.generation);
+    if (c->generation != generation) {
+        socket_cache_close(c);
+        c->generation = generation;
+    }
+    if (!c->registered && sockets.has_key) {
+        c->registered = pthread_setspecific(sockets.key, c) == 0;
+    }
+    return c;
+}
+
+// a busy socket is only forgotten, the call using it closes it when done
+static void socket_cache_close(struct socket_cache *c) {
+    if (c->ioctl_fd >= 0 && !c->ioctl_busy) {
+        STATS_SYSCALL(close(c->ioctl_fd));
+    }
+    if (c->netlink_fd >= 0 && !c->netlink_busy) {
+        STATS_SYSCALL(close(c->netlink_fd));
+    }
+    c->ioctl_fd = -1;
+    c->ioctl_busy = false;
+    c->netlink_fd = -1;
+    c->netlink_busy = false;
+}
+
+// a socket for SIOCGIF* requests, the one the socket cache keeps if it is on
+static int open_ioctl_socket(void) {
+    struct socket_cache *c = socket_cache_get();
+    if (!c || c->ioctl_busy) {
+        return STATS_SYSCALL(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0));
+    }
+    if (c->ioctl_fd < 0) {
+        ERR_NEG(
+            c->ioctl_fd =
+                STATS_SYSCALL(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+        )
+        ERR_END
+    }
+    c->ioctl_busy = true;
+    return c->ioctl_fd;
+}
+
+static void close_ioctl_socket(int fd) {
+    if (fd < 0) {
+        return;
+    }
+    struct socket_cache *c = &socket_cache;
+    if (c->ioctl_busy && c->ioctl_fd == fd) {
+        c->ioctl_busy = false;
+        if (atomic_load(&sockets.enabled)) {
+            return;
+        }
+        c->ioctl_fd = -1;
+    }
+    STATS_SYSCALL(close(fd));
+}
+
+unsigned int ifaddrs_backend(void) {
+#ifndef IFADDRS_USE_IOCTL
+    unsigned int denied = atomic_load(&backend_denied);
+    unsigned int ok = 0;
+    if (!(denied & BACKEND_NO_NETLINK)) {
+        ok |= IFADDRS_BACKEND_NETLINK;
+        ok |= denied & BACKEND_NO_GETLINK ? 0 : IFADDRS_BACKEND_GETLINK;
+        ok |= denied & BACKEND_NO_GETADDR ? 0 : IFADDRS_BACKEND_GETADDR;
+        ok |= denied & BACKEND_NO_STRICT ? 0 : IFADDRS_BACKEND_STRICT;
+    }
+    return ok;
+#else
+    return 0;
+#endif
+}
+
+unsigned int ifaddrs_backend_reprobe(void) {
+#ifndef IFADDRS_USE_IOCTL
+    atomic_store(&backend_denied, 0);
+    // cached sockets belong to the namespace they were opened in
+    atomic_fetch_add(&sockets.generation, 1);
+    if (!NETLINK_REPLAYING()) {
+        stats_call_begin(false);
+        backend_probe();
+        stats_call_end();
+    }
+#endif
+    return ifaddrs_backend();
+}
+
+#ifndef IFADDRS_USE_IOCTL
+// one small request of each kind, refusals are recorded on the way
+static void backend_probe(void) {
+    struct netlink_session nl;
+    if (netlink_open(&nl) < 0) {
+        return;
+    }
+    netlink_strict(&nl);
+
+    // lo, which every namespace has as ifindex 1
+    struct getlink_msg link_request;
+    init_getlink_one_request(&link_request, NULL, 1);
+    netlink_dump(&nl, &link_request.hdr, RTM_NEWLINK, backend_probe_cb, NULL);
+    struct ifaddrs_filter filter = {IFADDRS_FAMILY_INET, 1, 0, 0};
+    struct getaddr_msg addr_request;
+    init_getaddr_request(&addr_request, &filter);
+    netlink_dump(&nl, &addr_request.hdr, RTM_NEWADDR, backend_probe_cb, NULL);
+    netlink_close(&nl);
+}
+
+static int backend_probe_cb(struct nlmsghdr *nlh, void *ctx) {
+    (void)nlh;
+    (void)ctx;
+    return 0;
+}
+
+// the BACKEND_NO_* bit for refusals of a request of this type
+static unsigned int backend_bit(uint16_t type) {
+    if (type == RTM_GETLINK) {
+        return BACKEND_NO_GETLINK;
+    }
+    if (type == RTM_GETADDR) {
+        return BACKEND_NO_GETADDR;
+    }
+    return 0;
+}
+
+// only the answers that will not change by asking again count
+static void
+backend_deny(struct netlink_session *nl, unsigned int bit, int err) {
+    if (nl && nl->fd < 0) {
+        // recorded replies say nothing about this kernel
+        return;
+    }
+    bool refused = err == EACCES || err == EPERM;
+    if (bit == BACKEND_NO_NETLINK) {
+        refused = refused || err == EAFNOSUPPORT || err == EPROTONOSUPPORT;
+    } else if (bit == BACKEND_NO_STRICT) {
+        refused = refused || err == ENOPROTOOPT || err == EINVAL;
+    }
+    if (bit && refused) {
+        atomic_fetch_or(&backend_denied, bit);
+        IFADDRS_PROBE(backend_denied, bit, err);
+    }
+}
+
+static bool backend_is_denied(unsigned int bit) {
+    return atomic_load_explicit(&backend_denied, memory_order_relaxed) & bit;
+}
+
+static int netlink_open(struct netlink_session *nl) {
+    return netlink_open_with(nl, NULL, 0, true);
+}
+
+// buf, if not NULL, is used until a datagram does not fit into it. reuse
+// lets the session take the socket kept by the socket cache.
+static int netlink_open_with(
+    struct netlink_session *nl, void *buf, size_t size, bool reuse
+) {
+    nl->seq = 0;
+    nl->dumping = false;
+    nl->strict = false;
+    nl->broken = false;
+
+#ifdef IFADDRS_REPLAY
+    if (netlink_replay_current) {
+        nl->transport = &netlink_replay_transport;
+        nl->replay = netlink_replay_current;
+        nl->fd = -1;
+    } else
+#endif
+    {
+        nl->transport = &netlink_kernel_transport;
+        ERR(backend_is_denied(BACKEND_NO_NETLINK))
+            save_errno = EACCES;
+        ERR_END
+        size_t buf_size = buf ? size : atomic_load(&netlink_buf_hint);
+        if (!reuse || !socket_cache_take(nl, buf_size)) {
+            ERR_NEG(nl->fd = STATS_SYSCALL(socket(
+                        AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE
+                    )))
+                backend_deny(NULL, BACKEND_NO_NETLINK, save_errno);
+            ERR_END
+        }
+    }
+
+    if (buf) {
+        nl->buf = buf;
+        nl->buf_size = size;
+        nl->buf_owned = false;
+        return 0;
+    }
+
+    // start big enough for what earlier sessions ran into
+    nl->buf_size = atomic_load(&netlink_buf_hint);
+    nl->buf_owned = true;
+    stats_add(STATS_ALLOCS, 1);
+    ERR_0(nl->buf = malloc(nl->buf_size))
+        nl->transport->close(nl);
+    ERR_END
+    return 0;
+}
+
+static int netlink_reserve(struct netlink_session *nl, size_t size) {
+    if (size <= nl->buf_size) {
+        return 0;
+    }
+
+    size_t new_size = nl->buf_size;
+    while (new_size < size) {
+        new_size *= 2;
+    }
+    struct nlmsghdr *buf;
+    stats_add(STATS_ALLOCS, 1);
+    ERR_0(buf = malloc(new_size))
+    ERR_END
+    if (nl->buf_owned) {
+        free(nl->buf);
+    }
+    nl->buf = buf;
+    nl->buf_size = new_size;
+    nl->buf_owned = true;
+
+    size_t hint = atomic_load(&netlink_buf_hint);
+    while (hint < new_size &&
+           !atomic_compare_exchange_weak(&netlink_buf_hint, &hint, new_size)) {
+        continue;
+    }
+    return 0;
+}
+
+static void netlink_close(struct netlink_session *nl) {
+    if (nl->buf_owned) {
+        free(nl->buf);
+    }
+    nl->transport->close(nl);
+}
+
+// closes a broken session and opens a new one in its place, which starts
+// with a buffer as big as what the old one ran into. False, with *opened
+// cleared if nothing is open any more, if that failed.
+static bool netlink_restart(
+    struct netlink_session *nl, const struct ifaddrs_filter *filter,
+    bool *opened
+) {
+    netlink_close(nl);
+    *opened = netlink_open(nl) == 0;
+    if (*opened && filter && filter->ifindex) {
+        netlink_strict(nl);
+    }
+    return *opened;
+}
+
+// lets the kernel apply the filters in dump requests, best effort
+static void netlink_strict(struct netlink_session *nl) {
+    if (nl->fd < 0 || nl->strict || backend_is_denied(BACKEND_NO_STRICT)) {
+        return;
+    }
+    int one = 1;
+    // stays set on a cached socket, requests without filters are the same
+    // either way
+    if (STATS_SYSCALL(setsockopt(
+            nl->fd, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one)
+        )) == 0) {
+        nl->strict = true;
+    } else {
+        backend_deny(nl, BACKEND_NO_STRICT, errno);
+    }
+}
+
+static ssize_t
+netlink_kernel_send(struct netlink_session *nl, const struct nlmsghdr *req) {
+    struct sockaddr_nl sa = {AF_NETLINK};
+    return STATS_SYSCALL(sendto(
+        nl->fd, req, req->nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)
+    ));
+}
+
+static ssize_t netlink_kernel_recv(
+    struct netlink_session *nl, void *buf, size_t len, int flags
+) {
+    ssize_t ret = STATS_SYSCALL(recv(nl->fd, buf, len, flags | MSG_TRUNC));
+    if (ret > 0) {
+        stats_add(STATS_BYTES, (size_t)ret < len ? (size_t)ret : len);
+    }
+    return ret;
+}
+
+static void netlink_kernel_close(struct netlink_session *nl) {
+    if (!socket_cache_put(nl)) {
+        STATS_SYSCALL(close(nl->fd));
+    }
+}
+
+#ifdef IFADDRS_REPLAY
+static ssize_t
+netlink_replay_send(struct netlink_session *nl, const struct nlmsghdr *req) {
+    struct netlink_replay *replay = nl->replay;
+    if (req->nlmsg_type == RTM_GETLINK) {
+        replay->pos = replay->links;
+        replay->left = replay->links_len;
+    } else if (req->nlmsg_type == RTM_GETADDR) {
+        replay->pos = replay->addrs;
+        replay->left = replay->addrs_len;
+    } else {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    replay->seq = req->nlmsg_seq;
+    return req->nlmsg_len;
+}
+
+static ssize_t netlink_replay_recv(
+    struct netlink_session *nl, void *buf, size_t len, int flags
+) {
+    struct netlink_replay *replay = nl->replay;
+    if (replay->left == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // batch whole messages the way the kernel fills a dump datagram
+    const char *pos = (const char *)replay->pos;
+    size_t size = 0;
+    while (size < replay->left) {
+        const struct nlmsghdr *nlh = (const struct nlmsghdr *)(pos + size);
+        size_t msg_len = NLMSG_ALIGN(nlh->nlmsg_len);
+        if (size > 0 && size + msg_len > NETLINK_BUF_SIZE) {
+            break;
+        }
+        size += msg_len;
+    }
+    if (size > replay->left) {
+        size = replay->left;
+    }
+
+    size_t copied = size < len ? size : len;
+    if (copied > 0) {
+        memcpy(buf, pos, copied);
+        // replies carry the sequence number of the request
+        ssize_t rest = copied;
+        for (struct nlmsghdr *nlh = buf; NLMSG_OK(nlh, rest);
+             nlh = NLMSG_NEXT(nlh, rest)) {
+            nlh->nlmsg_seq = replay->seq;
+        }
+    }
+    if (!(flags & MSG_PEEK)) {
+        replay->pos = (const struct nlmsghdr *)(pos + size);
+        replay->left -= size;
+    }
+    return size;
+}
+
+static void netlink_replay_close(struct netlink_session *nl) {
+    (void)nl;
+}
+
+// length of the dump at the start of the buffer up to and including its
+// NLMSG_DONE, 0 if it is malformed or unterminated
+static size_t netlink_replay_split(const struct nlmsghdr *dump, size_t len) {
+    size_t size = 0;
+    while (len - size >= sizeof(struct nlmsghdr)) {
+        const struct nlmsghdr *nlh =
+            (const struct nlmsghdr *)((const char *)dump + size);
+        if (nlh->nlmsg_len < sizeof(struct nlmsghdr) ||
+            nlh->nlmsg_len > len - size) {
+            return 0;
+        }
+        size_t msg_len = NLMSG_ALIGN(nlh->nlmsg_len);
+        size += msg_len < len - size ? msg_len : len - size;
+        if (nlh->nlmsg_type == NLMSG_DONE) {
+            return size;
+        }
+    }
+    return 0;
+}
+#endif
+
+// every request gets its own sequence number, replies to anything else are
+// skipped by the dump loops
+static int netlink_send(struct netlink_session *nl, struct nlmsghdr *req) {
+    unsigned int bit = backend_bit(req->nlmsg_type);
+    // refused before, the caller goes on with what it does on a refusal
+    ERR(nl->fd >= 0 && backend_is_denied(bit))
+        save_errno = EACCES;
+    ERR_END
+    // replies of the last dump were lost, NLMSG_DONE among them maybe, so
+    // draining could wait forever. Only a new session can go on.
+    ERR(nl->broken && nl->dumping)
+        save_errno = EPIPE;
+    ERR_END
+
+    // only one dump may run on a socket at a time
+    ERR_NEG(netlink_drain(nl))
+    ERR_END
+
+    req->nlmsg_seq = ++nl->seq;
+    nl->request = req->nlmsg_type;
+
+    ERR_WITH_RETRY(nl->transport->send(nl, req) < (ssize_t)req->nlmsg_len)
+        nl->broken = true;
+        backend_deny(nl, bit, save_errno);
+    ERR_END
+    nl->dumping = true;
+    return 0;
+}
+
+// one syscall per datagram while the buffer holds anything the kernel sends,
+// a smaller one, like the stack buffer of getifaddrs_foreach(), peeks at the
+// size first and grows. A datagram that still did not fit, a single message
+// bigger than any seen before, is lost: the buffer is grown for the next call
+// and the dump fails with EMSGSIZE, apart from interrupted ones. The session
+// is of no more use then, see netlink_send().
+static ssize_t netlink_recv(struct netlink_session *nl) {
+    if (nl->buf_size < atomic_load(&netlink_buf_hint)) {
+        return netlink_recv_whole(nl);
+    }
+    return netlink_recv_once(nl);
+}
+
+static ssize_t netlink_recv_once(struct netlink_session *nl) {
+    ssize_t len;
+    ERR_NEG_WITH_RETRY(len = nl->transport->recv(nl, nl->buf, nl->buf_size, 0))
+        // replies may have been lost, NLMSG_DONE among them
+        nl->broken = nl->broken || save_errno != EAGAIN;
+    ERR_END
+
+    if ((size_t)len > nl->buf_size) {
+        nl->broken = true;
+        ERR_NEG(netlink_reserve(nl, len))
+        ERR_END
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return len;
+}
+
+// peeks at the size first so that nothing is lost, for when the datagram
+// cannot be asked for again
+static ssize_t netlink_recv_whole(struct netlink_session *nl) {
+    ssize_t len;
+    ERR_NEG_WITH_RETRY(len = nl->transport->recv(nl, NULL, 0, MSG_PEEK))
+        nl->broken = nl->broken || save_errno != EAGAIN;
+    ERR_END
+    ERR_NEG(netlink_reserve(nl, len))
+    ERR_END
+    return netlink_recv_once(nl);
+}
+
+// read and throw away the rest of a dump that was abandoned half way
+static int netlink_drain(struct netlink_session *nl) {
+    while (nl->dumping) {
+        ssize_t len;
+        // a lost NLMSG_DONE would leave us waiting forever
+        ERR_NEG(len = netlink_recv_whole(nl))
+        ERR_END
+
+        for (struct nlmsghdr *nlh = nl->buf; NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_seq == nl->seq &&
+                (nlh->nlmsg_type == NLMSG_DONE ||
+                 nlh->nlmsg_type == NLMSG_ERROR)) {
+                nl->dumping = false;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+// hands the socket the socket cache keeps for this thread to nl, opening it
+// first if need be. False if the cache is off, the socket is already taken or
+// the kernel may send it datagrams larger than size.
+static bool socket_cache_take(struct netlink_session *nl, size_t size) {
+    struct socket_cache *c = socket_cache_get();
+    if (!c || c->netlink_busy || (c->netlink_fd >= 0 && size < c->recv_size)) {
+        return false;
+    }
+    if (c->netlink_fd < 0) {
+        c->netlink_fd = STATS_SYSCALL(
+            socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)
+        );
+        if (c->netlink_fd < 0) {
+            return false;
+        }
+        c->seq = 0;
+        c->dumping = false;
+        c->strict = false;
+        c->recv_size = 0;
+    }
+
+    c->netlink_busy = true;
+    nl->fd = c->netlink_fd;
+    nl->seq = c->seq;
+    nl->dumping = c->dumping;
+    nl->strict = c->strict;
+    return true;
+}
+
+// takes the socket of nl back if it came from the socket cache. A dump left
+// unfinished is drained by the next session, a socket that failed is closed.
+// False if the caller is to close it.
+static bool socket_cache_put(struct netlink_session *nl) {
+    struct socket_cache *c = &socket_cache;
+    if (!c->netlink_busy || c->netlink_fd != nl->fd) {
+        return false;
+    }
+    c->netlink_busy = false;
+    if (nl->broken || !atomic_load(&sockets.enabled)) {
+        c->netlink_fd = -1;
+        return false;
+    }
+    c->seq = nl->seq;
+    c->dumping = nl->dumping;
+    c->strict = nl->strict;
+    if (nl->buf_size > c->recv_size) {
+        c->recv_size = nl->buf_size;
+    }
+    return true;
+}
+
+static int netlink_error(struct nlmsghdr *nlh) {
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+        return EPROTO;
+    }
+    struct nlmsgerr *err = NLMSG_DATA(nlh);
+    return err->error ? -err->error : EPROTO;
+}
+
+// run one dump to completion, handing every message of the expected type to
+// cb. A callback that fails or returns a positive value to stop abandons the
+// dump, the next netlink_send() drains it.
+static int netlink_dump(
+    struct netlink_session *nl, struct nlmsghdr *req, uint16_t type,
+    netlink_dump_cb cb, void *ctx
+) {
+    ERR_NEG(netlink_send(nl, req))
+    ERR_END
+
+    struct netlink_dump_state state = {type, cb, ctx, false, 0};
+    int ret;
+    while ((ret = netlink_dump_step(nl, &state)) == 0) {
+        continue;
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    return state.stopped;
+}
+
+// reads one datagram of the reply to the last request. Returns 0 if there is
+// more to come, 1 once the dump is over or the callback stopped it.
+static int netlink_dump_step(
+    struct netlink_session *nl, struct netlink_dump_state *state
+) {
+    ssize_t len;
+    ERR_NEG(len = netlink_recv(nl))
+    ERR_END
+
+    for (struct nlmsghdr *nlh = nl->buf; NLMSG_OK(nlh, len);
+         nlh = NLMSG_NEXT(nlh, len)) {
+        if (nlh->nlmsg_seq != nl->seq) {
+            continue;
+        }
+        if (nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
+            state->interrupted = true;
+        }
+        if (nlh->nlmsg_type == NLMSG_DONE) {
+            nl->dumping = false;
+            if (state->interrupted) {
+                errno = EINTR;
+                return -1;
+            }
+            return 1;
+        }
+        if (nlh->nlmsg_type == NLMSG_ERROR) {
+            nl->dumping = false;
+            errno = netlink_error(nlh);
+            backend_deny(nl, backend_bit(nl->request), errno);
+            return -1;
+        }
+
+        // run an interrupted dump to completion so the socket stays usable
+        if (state->interrupted) {
+            continue;
+        }
+
+        if (nlh->nlmsg_type != state->type) {
+            stats_add(STATS_UNKNOWN, 1);
+            IFADDRS_PROBE(unknown_message, nlh->nlmsg_type);
+            continue;
+        }
+        stats_add(STATS_MESSAGES, 1);
+
+        int ret;
+        ERR_NEG(ret = state->cb(nlh, state->ctx))
+        ERR_END
+        if (ret > 0) {
+            state->stopped = ret;
+            return 1;
+        }
+        // the whole reply to a request that was not a dump
+        if (!(nlh->nlmsg_flags & NLM_F_MULTI)) {
+            nl->dumping = false;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// *out is left NULL for messages that do not describe a link
+static int parse_newlink(
+    struct ifaddrs_arena *arena, struct nlmsghdr *nlh,
+    struct ifaddrs_internal **out
+) {
+    *out = NULL;
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+        return 0;
+    }
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+
+    struct ifaddrs_internal *outer;
+    if (ifi->ifi_family == AF_UNSPEC) {
+        ERR_0(outer = alloc_ifaddr(arena, sizeof(struct sockaddr_ll), true))
+        ERR_END
+    } else {
+        stats_add(STATS_UNKNOWN, 1);
+        IFADDRS_PROBE(unknown_family, ifi->ifi_family);
+        return 0;
+    }
+    struct ifaddrs *ifaddr = &outer->inner;
+
+    ifaddr->ifa_flags = ifi->ifi_flags;
+    outer->index = ifi->ifi_index;
+    if (outer->ex) {
+        outer->ex->ifindex = ifi->ifi_index;
+    }
+
+    if (!arena->no_stats) {
+        ERR_0(
+            ifaddr->ifa_data =
+                arena_alloc(arena, sizeof(struct rtnl_link_stats))
+        )
+        ERR_END
+    }
+
+    bool has_broadaddr = false, has_addr = false;
+    ssize_t rtl = IFLA_PAYLOAD(nlh);
+    for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, rtl);
+         rta = RTA_NEXT(rta, rtl)) {
+        size_t payload = RTA_PAYLOAD(rta);
+        void *data = RTA_DATA(rta);
+        if (rta->rta_type == IFLA_IFNAME) {
+            strncpy(ifaddr->ifa_name, data, IFNAMSIZ);
+            ifaddr->ifa_name[IFNAMSIZ - 1] = '\0';
+        } else if (rta->rta_type == IFLA_STATS && ifaddr->ifa_data) {
+            memcpy(
+                ifaddr->ifa_data, data, sizeof(struct rtnl_link_stats)
+            );
+        } else if (rta->rta_type == IFLA_ADDRESS) {
+            has_addr = true;
+            struct sockaddr_ll *sll =
+                (struct sockaddr_ll *)ifaddr->ifa_addr;
+            sll->sll_family = AF_PACKET;
+            if (payload > sizeof(sll->sll_addr)) {
+                ifaddr->ifa_addr = NULL;
+                continue;
+            }
+            memcpy(&sll->sll_addr, data, sizeof(sll->sll_addr));
+            sll->sll_halen = payload;
+            sll->sll_hatype = ifi->ifi_type;
+            sll->sll_ifindex = ifi->ifi_index;
+        } else if (rta->rta_type == IFLA_BROADCAST) {
+            has_broadaddr = true;
+            struct sockaddr_ll *sll =
+                (struct sockaddr_ll *)ifaddr->ifa_broadaddr;
+            sll->sll_family = AF_PACKET;
+            if (payload > sizeof(sll->sll_addr)) {
+                ifaddr->ifa_broadaddr = NULL;
+                continue;
+            }
+            memcpy(&sll->sll_addr, data, sizeof(sll->sll_addr));
+            sll->sll_halen = payload;
+            sll->sll_hatype = ifi->ifi_type;
+            sll->sll_ifindex = ifi->ifi_index;
+        } else if (outer->ex) {
+            parse_link_ex(outer->ex, rta);
+        }
+    }
+
+    if (!has_addr) {
+        ifaddr->ifa_addr = NULL;
+    }
+    if (!has_broadaddr) {
+        ifaddr->ifa_broadaddr = NULL;
+    }
+
+    *out = outer;
+    return 0;
+}
+
+// *out is left NULL for messages that do not describe an address
+static int parse_newaddr(
+    struct ifaddrs_arena *arena, struct nlmsghdr *nlh,
+    struct ifaddrs_internal **out
+) {
+    *out = NULL;
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+        return 0;
+    }
+    struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+
+    struct ifaddrs_internal *outer;
+    if (ifa->ifa_family == AF_INET) {
+        ERR_0(outer = alloc_ifaddr(arena, sizeof(struct sockaddr_in), false))
+        ERR_END
+    } else if (ifa->ifa_family == AF_INET6) {
+        ERR_0(outer = alloc_ifaddr(arena, sizeof(struct sockaddr_in6), false))
+        ERR_END
+    } else {
+        stats_add(STATS_UNKNOWN, 1);
+        IFADDRS_PROBE(unknown_family, ifa->ifa_family);
+        return 0;
+    }
+    struct ifaddrs *ifaddr = &outer->inner;
+    outer->index = ifa->ifa_index;
+    if (outer->ex) {
+        outer->ex->ifindex = ifa->ifa_index;
+        outer->ex->addr_flags = ifa->ifa_flags;
+        outer->ex->prefixlen = ifa->ifa_prefixlen;
+        outer->ex->scope = ifa->ifa_scope;
+        outer->ex->has |= IFADDRS_EX_ADDR;
+    }
+
+    // calculate netmask
+    ifaddr->ifa_netmask->sa_family = ifa->ifa_family;
+    if (ifa->ifa_family == AF_INET) {
+        struct sockaddr_in *sin =
+            (struct sockaddr_in *)ifaddr->ifa_netmask;
+        // a shift by 32 is undefined, /0 has no mask bits
+        sin->sin_addr.s_addr =
+            ifa->ifa_prefixlen
+                ? htonl(~((uint32_t)0) << (32 - ifa->ifa_prefixlen))
+                : 0;
+    } else { // AF_INET6
+        struct sockaddr_in6 *sin6 =
+            (struct sockaddr_in6 *)ifaddr->ifa_netmask;
+        size_t len = ifa->ifa_prefixlen / 8;
+        size_t rem = ifa->ifa_prefixlen % 8;
+        if (len) {
+            memset(sin6->sin6_addr.s6_addr, 0xff, len);
+        }
+        if (rem) {
+            sin6->sin6_addr.s6_addr[len] = 0xffU << (8 - rem);
+        }
+    }
+
+    bool has_dstaddr = false, has_broadaddr = false;
+    ssize_t rtl = IFA_PAYLOAD(nlh);
+    for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, rtl);
+         rta = RTA_NEXT(rta, rtl)) {
+        // size_t payload = RTA_PAYLOAD(rta);
+        void *data = RTA_DATA(rta);
+
+        if (rta->rta_type == IFA_LABEL) {
+            strncpy(ifaddr->ifa_name, data, IFNAMSIZ);
+            ifaddr->ifa_name[IFNAMSIZ - 1] = '\0';
+        } else if (rta->rta_type == IFA_ADDRESS) {
+            ifaddr->ifa_addr->sa_family = ifa->ifa_family;
+            if (ifa->ifa_family == AF_INET) {
+                memcpy(
+                    &((struct sockaddr_in *)ifaddr->ifa_addr)->sin_addr,
+                    data, sizeof(struct in_addr)
+                );
+            } else { // AF_INET6
+                struct sockaddr_in6 *sin6 =
+                    (struct sockaddr_in6 *)ifaddr->ifa_addr;
+                memcpy(&sin6->sin6_addr, data, sizeof(struct in6_addr));
+                if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
+                    sin6->sin6_scope_id = ifa->ifa_index;
+                }
+            }
+        } else if (rta->rta_type == IFA_BROADCAST) {
+            has_broadaddr = true;
+#ifdef IFADDRS_USE_UNION
+            has_dstaddr = false;
+#endif
+            ifaddr->ifa_broadaddr->sa_family = ifa->ifa_family;
+            if (ifa->ifa_family == AF_INET) {
+                memcpy(
+                    &((struct sockaddr_in *)ifaddr->ifa_broadaddr)
+                         ->sin_addr,
+                    data, sizeof(struct in_addr)
+                );
+            } else { // AF_INET6
+                struct sockaddr_in6 *sin6 =
+                    (struct sockaddr_in6 *)ifaddr->ifa_broadaddr;
+                memcpy(&sin6->sin6_addr, data, sizeof(struct in6_addr));
+                if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
+                    sin6->sin6_scope_id = ifa->ifa_index;
+                }
+            }
+        } else if (rta->rta_type == IFA_LOCAL) {
+            has_dstaddr = true;
+#ifdef IFADDRS_USE_UNION
+            has_broadaddr = false;
+#endif
+            ifaddr->ifa_dstaddr->sa_family = ifa->ifa_family;
+            if (ifa->ifa_family == AF_INET) {
+                memcpy(
+                    &((struct sockaddr_in *)ifaddr->ifa_dstaddr)
+                         ->sin_addr,
+                    data, sizeof(struct in_addr)
+                );
+            } else { // AF_INET6
+                struct sockaddr_in6 *sin6 =
+                    (struct sockaddr_in6 *)ifaddr->ifa_dstaddr;
+                memcpy(&sin6->sin6_addr, data, sizeof(struct in6_addr));
+                if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
+                    sin6->sin6_scope_id = ifa->ifa_index;
+                }
+            }
+        } else if (outer->ex) {
+            parse_addr_ex(outer->ex, rta);
+        }
+    }
+
+    if (has_dstaddr) {
+        // swap dstaddr and addr for p2p interfaces
+        struct sockaddr *tmp = ifaddr->ifa_dstaddr;
+        ifaddr->ifa_dstaddr = ifaddr->ifa_addr;
+        ifaddr->ifa_addr = tmp;
+    }
+
+#ifndef IFADDRS_USE_UNION
+    if (!has_dstaddr) {
+        ifaddr->ifa_dstaddr = NULL;
+    }
+    if (!has_broadaddr) {
+        ifaddr->ifa_broadaddr = NULL;
+    }
+#else
+    if (!has_broadaddr && !has_dstaddr) {
+        ifaddr->ifa_broadaddr = NULL;
+    }
+#endif
+
+    *out = outer;
+    return 0;
+}
+
+// link attributes only getifaddrs_ex() keeps
+static void parse_link_ex(struct ifaddrs_ex *ex, struct rtattr *rta) {
+    size_t payload = RTA_PAYLOAD(rta);
+    void *data = RTA_DATA(rta);
+
+    if (rta->rta_type == IFLA_MTU && payload >= sizeof(uint32_t)) {
+        memcpy(&ex->mtu, data, sizeof(uint32_t));
+        ex->has |= IFADDRS_EX_MTU;
+    } else if (rta->rta_type == IFLA_OPERSTATE && payload >= 1) {
+        ex->operstate = *(uint8_t *)data;
+        ex->has |= IFADDRS_EX_OPERSTATE;
+    } else if (rta->rta_type == IFLA_LINKINFO) {
+        ssize_t len = payload;
+        for (struct rtattr *info = data; RTA_OK(info, len);
+             info = RTA_NEXT(info, len)) {
+            if (info->rta_type != IFLA_INFO_KIND) {
+                continue;
+            }
+            size_t n = RTA_PAYLOAD(info);
+            if (n >= sizeof(ex->kind)) {
+                n = sizeof(ex->kind) - 1;
+            }
+            memcpy(ex->kind, RTA_DATA(info), n);
+            ex->kind[n] = '\0';
+            ex->has |= IFADDRS_EX_KIND;
+        }
+    } else if (rta->rta_type == IFLA_STATS64) {
+        if (parse_stats64(&ex->stats64, rta)) {
+            ex->has |= IFADDRS_EX_STATS64;
+        }
+    }
+}
+
+// IFLA_STATS64 of a link, or IFLA_STATS_LINK_64 of a stats message
+static bool parse_stats64(struct ifaddrs_ex_stats *out, struct rtattr *rta) {
+    size_t payload = RTA_PAYLOAD(rta);
+    // older kernels send fewer counters, these ten were always there
+    if (payload < 10 * sizeof(uint64_t)) {
+        return false;
+    }
+    struct rtnl_link_stats64 stats = {0};
+    memcpy(
+        &stats, RTA_DATA(rta), payload < sizeof(stats) ? payload : sizeof(stats)
+    );
+    out->rx_packets = stats.rx_packets;
+    out->tx_packets = stats.tx_packets;
+    out->rx_bytes = stats.rx_bytes;
+    out->tx_bytes = stats.tx_bytes;
+    out->rx_errors = stats.rx_errors;
+    out->tx_errors = stats.tx_errors;
+    out->rx_dropped = stats.rx_dropped;
+    out->tx_dropped = stats.tx_dropped;
+    out->multicast = stats.multicast;
+    out->collisions = stats.collisions;
+    return true;
+}
+
+// address attributes only getifaddrs_ex() keeps
+static void parse_addr_ex(struct ifaddrs_ex *ex, struct rtattr *rta) {
+    size_t payload = RTA_PAYLOAD(rta);
+    void *data = RTA_DATA(rta);
+
+    if (rta->rta_type == IFA_FLAGS && payload >= sizeof(uint32_t)) {
+        // the flags in struct ifaddrmsg are only the lower eight
+        memcpy(&ex->addr_flags, data, sizeof(uint32_t));
+    } else if (rta->rta_type == IFA_CACHEINFO &&
+               payload >= sizeof(struct ifa_cacheinfo)) {
+        struct ifa_cacheinfo ci;
+        memcpy(&ci, data, sizeof(ci));
+        ex->preferred_lft = ci.ifa_prefered;
+        ex->valid_lft = ci.ifa_valid;
+        ex->has |= IFADDRS_EX_LIFETIME;
+    }
+}
+
+// append an attribute to a request built in a buffer of cap bytes that starts
+// with its header. The buffer rather than the header is passed, or the compiler
+// takes attributes for writes past the end of hdr.
+static void nlmsg_put(
+    void *msg, size_t cap, uint16_t type, const void *data, size_t len
+) {
+    struct nlmsghdr *nlh = msg;
+    struct rtattr *rta =
+        (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    if (NLMSG_ALIGN(nlh->nlmsg_len) + RTA_LENGTH(len) > cap) {
+        return;
+    }
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static void
+nlmsg_put_u32(void *msg, size_t cap, uint16_t type, uint32_t value) {
+    nlmsg_put(msg, cap, type, &value, sizeof(value));
+}
+
+static void init_getlink_request(
+    struct getlink_msg *request, const struct ifaddrs_filter *filter
+) {
+    memset(request, 0, sizeof(*request));
+    request->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    request->hdr.nlmsg_type = RTM_GETLINK;
+    request->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request->ifi.ifi_family = AF_UNSPEC;
+    // strict checking rejects anything but 0 here
+    request->ifi.ifi_change = 0;
+
+    if (filter && filter->master) {
+        nlmsg_put_u32(request, sizeof(*request), IFLA_MASTER, filter->master);
+    }
+}
+
+// a single link by name, or by index if name is NULL, instead of a dump
+static void init_getlink_one_request(
+    struct getlink_msg *request, const char *name, int ifindex
+) {
+    init_getlink_request(request, NULL);
+    request->hdr.nlmsg_flags = NLM_F_REQUEST;
+    if (name) {
+        nlmsg_put(
+            request, sizeof(*request), IFLA_IFNAME, name, strlen(name) + 1
+        );
+    } else {
+        request->ifi.ifi_index = ifindex;
+    }
+}
+
+// the counters are most of a link message, kernels before 4.20 send them
+// anyway
+static void getlink_skip_stats(struct getlink_msg *request) {
+    nlmsg_put_u32(
+        request, sizeof(*request), IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS
+    );
+}
+
+static void init_getaddr_request(
+    struct getaddr_msg *request, const struct ifaddrs_filter *filter
+) {
+    memset(request, 0, sizeof(*request));
+    request->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+    request->hdr.nlmsg_type = RTM_GETADDR;
+    request->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request->ifa.ifa_family = AF_UNSPEC;
+
+    if (filter) {
+        unsigned int inet = filter->families &
+                            (IFADDRS_FAMILY_INET | IFADDRS_FAMILY_INET6);
+        if (inet == IFADDRS_FAMILY_INET) {
+            request->ifa.ifa_family = AF_INET;
+        } else if (inet == IFADDRS_FAMILY_INET6) {
+            request->ifa.ifa_family = AF_INET6;
+        }
+        // only honoured by the kernel with strict checking
+        request->ifa.ifa_index = filter->ifindex;
+    }
+}
+
+static void init_getstats_request(struct getstats_msg *request) {
+    memset(request, 0, sizeof(*request));
+    request->hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct if_stats_msg));
+    request->hdr.nlmsg_type = RTM_GETSTATS;
+    request->hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request->ifsm.family = AF_UNSPEC;
+    // nothing but the counters getifaddrs_ex() has as well
+    request->ifsm.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+}
+
+// whether the filter says anything about the link an entry belongs to
+static bool filter_has_link(const struct ifaddrs_filter *filter) {
+    return filter && (filter->ifindex || filter->master || filter->flags);
+}
+
+// what the kernel could not check for us, from the RTM_NEWLINK itself so that
+// nothing is allocated for links that are thrown away
+static bool
+filter_link(const struct ifaddrs_filter *filter, struct nlmsghdr *nlh) {
+    if (!filter_has_link(filter)) {
+        return true;
+    }
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+        return false;
+    }
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    if (filter->ifindex && ifi->ifi_index != filter->ifindex) {
+        return false;
+    }
+    if ((ifi->ifi_flags & filter->flags) != filter->flags) {
+        return false;
+    }
+    if (filter->master) {
+        uint32_t master = 0;
+        ssize_t rtl = IFLA_PAYLOAD(nlh);
+        for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, rtl);
+             rta = RTA_NEXT(rta, rtl)) {
+            if (rta->rta_type == IFLA_MASTER &&
+                RTA_PAYLOAD(rta) >= sizeof(master)) {
+                memcpy(&master, RTA_DATA(rta), sizeof(master));
+            }
+        }
+        if ((int)master != filter->master) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int getlink_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct getlink_ctx *c = ctx;
+
+    if (!filter_link(c->filter, nlh)) {
+        return 0;
+    }
+
+    struct ifaddrs_internal *outer;
+    ERR_NEG(parse_newlink(c->arena, nlh, &outer))
+    ERR_END
+    if (!outer) {
+        return 0;
+    }
+    struct ifaddrs *ifaddr = &outer->inner;
+
+    if (!c->list.tail) {
+        c->list.head = ifaddr;
+        c->list.tail = ifaddr;
+    } else {
+        c->list.tail->ifa_next = ifaddr;
+        c->list.tail = ifaddr;
+    }
+    return 0;
+}
+
+// for AF_PACKET
+static int getifaddrs_getlink(
+    struct ifaddrs_arena *arena, struct netlink_session *nl,
+    const struct ifaddrs_filter *filter, struct ifaddrs_list *out
+) {
+    out->head = NULL;
+    out->tail = NULL;
+    struct ifaddrs_arena_mark mark = arena_mark(arena);
+
+    struct getlink_msg request;
+    init_getlink_request(&request, filter);
+    if (arena->no_stats) {
+        getlink_skip_stats(&request);
+    }
+
+    struct getlink_ctx ctx = {arena, filter, {NULL, NULL}};
+    struct stats_timer timer = stats_enter(IFADDRS_PHASE_GETLINK);
+    int ret = netlink_dump(nl, &request.hdr, RTM_NEWLINK, getlink_cb, &ctx);
+    if (ret < 0 && errno == EINTR) {
+        stats_add(STATS_RETRIES, 1);
+        IFADDRS_PROBE(dump_retry, IFADDRS_PHASE_GETLINK);
+    }
+    stats_leave(timer);
+    ERR_NEG(ret)
+        arena_rollback(arena, mark);
+    ERR_END
+
+    *out = ctx.list;
+    return 0;
+}
+
+static int getaddr_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct getaddr_ctx *c = ctx;
+
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+        return 0;
+    }
+    struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    if (!filter_family(c->filter, ifa->ifa_family)) {
+        return 0;
+    }
+    if (c->filter && c->filter->ifindex &&
+        (int)ifa->ifa_index != c->filter->ifindex) {
+        return 0;
+    }
+
+    // join with the link before allocating, links were already filtered
+    struct ifaddrs *link = NULL;
+    if (c->links) {
+        link = link_index_find(c->links, ifa->ifa_index);
+        if (!link && filter_has_link(c->filter)) {
+            return 0;
+        }
+    } else if (c->filter && c->filter->master) {
+        // no way to tell without the link dump
+        return 0;
+    }
+
+    struct ifaddrs_internal *outer;
+    ERR_NEG(parse_newaddr(c->arena, nlh, &outer))
+    ERR_END
+    if (!outer) {
+        return 0;
+    }
+    struct ifaddrs *ifaddr = &outer->inner;
+
+    if (link) {
+        match_getaddr_with_link(ifaddr, link);
+    } else if (!c->links) {
+        struct link_slot *slot = link_slot_lookup(
+            c->slots, &c->ioctl_sockfd, outer->index, ifaddr->ifa_name
+        );
+        if (!slot) {
+            // gone since the address dump was sent
+            return errno == ENODEV ? 0 : -1;
+        }
+        ifaddr->ifa_flags = slot->flags;
+        // handle ipv6 no IFA_LABEL
+        if (!ifaddr->ifa_name[0]) {
+            strcpy(ifaddr->ifa_name, slot->name);
+        }
+
+        if (c->filter &&
+            (ifaddr->ifa_flags & c->filter->flags) != c->filter->flags) {
+            return 0;
+        }
+    }
+
+    if (!c->list.tail) {
+        c->list.head = ifaddr;
+        c->list.tail = ifaddr;
+    } else {
+        c->list.tail->ifa_next = ifaddr;
+        c->list.tail = ifaddr;
+    }
+    return 0;
+}
+
+static int getifaddrs_getaddr(
+    struct ifaddrs_arena *arena, struct netlink_session *nl,
+    const struct ifaddrs_filter *filter, struct link_index *links,
+    struct ifaddrs_list *out
+) {
+    out->head = NULL;
+    out->tail = NULL;
+    struct ifaddrs_arena_mark mark = arena_mark(arena);
+
+    // only filled in when there is no getlink result
+    struct link_slot slots[LINK_SLOTS];
+    if (!links) {
+        memset(slots, 0, sizeof(slots));
+    }
+
+    struct getaddr_msg request;
+    init_getaddr_request(&request, filter);
+
+    struct getaddr_ctx ctx = {
+        arena, filter, links, -1, links ? NULL : slots, {NULL, NULL}
+    };
+    struct stats_timer timer = stats_enter(IFADDRS_PHASE_GETADDR);
+    int ret = netlink_dump(nl, &request.hdr, RTM_NEWADDR, getaddr_cb, &ctx);
+    if (ret < 0 && errno == EINTR) {
+        stats_add(STATS_RETRIES, 1);
+        IFADDRS_PROBE(dump_retry, IFADDRS_PHASE_GETADDR);
+    }
+    stats_leave(timer);
+    close_ioctl_socket(ctx.ioctl_sockfd);
+    ERR_NEG(ret)
+        arena_rollback(arena, mark);
+    ERR_END
+
+    *out = ctx.list;
+    return 0;
+}
+
+// one link and its addresses, for getifaddrs_for_interface(). The link is
+// asked for directly, the address dump is narrowed down to its index by the
+// kernel under strict checking and by getaddr_cb() otherwise.
+static int getifaddrs_getone(
+    struct ifaddrs_arena *arena, struct netlink_session *nl, const char *name,
+    int ifindex, struct ifaddrs_list *out
+) {
+    netlink_strict(nl);
+
+    struct getlink_msg request;
+    init_getlink_one_request(&request, name, ifindex);
+    struct getlink_ctx lctx = {arena, NULL, {NULL, NULL}};
+    struct stats_timer timer = stats_enter(IFADDRS_PHASE_GETLINK);
+    int ret = netlink_dump(nl, &request.hdr, RTM_NEWLINK, getlink_cb, &lctx);
+    stats_leave(timer);
+    ERR_NEG(ret)
+    ERR_END
+    ERR_0(lctx.list.head)
+        save_errno = ENODEV;
+    ERR_END
+
+    // a table of one is scanned, nothing to allocate
+    struct link_index idx = {lctx.list.head, NULL, 0};
+    struct ifaddrs_filter filter = {0, TO_INTERNAL(idx.links)->index, 0, 0};
+    struct retry_state retry = {0};
+    struct ifaddrs_list addrs;
+    while ((ret = getifaddrs_getaddr(arena, nl, &filter, &idx, &addrs)) < 0 &&
+           errno == EINTR && retry_next(&retry, true)) {
+        continue;
+    }
+    ERR_NEG(ret)
+        if (save_errno == EINTR) {
+            save_errno = EAGAIN;
+        }
+    ERR_END
+
+    *out = lctx.list;
+    if (addrs.head) {
+        out->tail->ifa_next = addrs.head;
+        out->tail = addrs.tail;
+    }
+    return 0;
+}
+
+// the kernel does not have to list addresses in link order, so addresses are
+// joined to their link through an ifindex table instead of walking the links
+static int link_index_build(struct link_index *idx, struct ifaddrs *links) {
+    idx->links = links;
+    idx->slots = NULL;
+    idx->mask = 0;
+
+    size_t n = 0;
+    for (struct ifaddrs *l = links; l; l = l->ifa_next) {
+        n++;
+    }
+
+    // keep the load factor at or below one half
+    size_t cap = 16;
+    while (cap < n * 2) {
+        cap *= 2;
+    }
+    stats_add(STATS_ALLOCS, 1);
+    ERR_0(idx->slots = calloc(cap, sizeof(*idx->slots)))
+    ERR_END
+    idx->mask = cap - 1;
+
+    for (struct ifaddrs *l = links; l; l = l->ifa_next) {
+        int index = TO_INTERNAL(l)->index;
+        size_t i = LINK_INDEX_HASH(index) & idx->mask;
+        while (idx->slots[i]) {
+            // first link wins, like a scan would
+            if (TO_INTERNAL(idx->slots[i])->index == index) {
+                break;
+            }
+            i = (i + 1) & idx->mask;
+        }
+        if (!idx->slots[i]) {
+            idx->slots[i] = l;
+        }
+    }
+    return 0;
+}
+
+static void link_index_free(struct link_index *idx) {
+    free(idx->slots);
+    idx->slots = NULL;
+}
+
+static struct ifaddrs *link_index_find(struct link_index *idx, int index) {
+    if (!idx->slots) {
+        // out of memory for the table, a plain scan still gives the answer
+        for (struct ifaddrs *l = idx->links; l; l = l->ifa_next) {
+            if (TO_INTERNAL(l)->index == index) {
+                return l;
+            }
+        }
+        return NULL;
+    }
+
+    size_t i = LINK_INDEX_HASH(index) & idx->mask;
+    while (idx->slots[i]) {
+        if (TO_INTERNAL(idx->slots[i])->index == index) {
+            return idx->slots[i];
+        }
+        i = (i + 1) & idx->mask;
+    }
+    return NULL;
+}
+
+// (re)sends the request of the current phase, dropping whatever an earlier
+// attempt at it had parsed
+static int async_send(struct getifaddrs_async *op) {
+    struct nlmsghdr *req;
+    if (op->phase == ASYNC_GETLINK) {
+        arena_rollback(op->link_arena, op->mark);
+        struct getlink_ctx lctx = {op->link_arena, op->filter, {NULL, NULL}};
+        struct netlink_dump_state dump = {
+            RTM_NEWLINK, getlink_cb, &op->lctx, false, 0
+        };
+        op->lctx = lctx;
+        op->dump = dump;
+        req = &op->link_request.hdr;
+    } else {
+        arena_rollback(op->arena, op->mark);
+        // the ioctl socket is kept for the next attempt
+        struct getaddr_ctx actx = {
+            op->arena, op->filter, op->has_links ? &op->idx : NULL,
+            op->actx.ioctl_sockfd, op->slots, {NULL, NULL}
+        };
+        if (op->slots) {
+            memset(op->slots, 0, LINK_SLOTS * sizeof(*op->slots));
+        }
+        struct netlink_dump_state dump = {
+            RTM_NEWADDR, getaddr_cb, &op->actx, false, 0
+        };
+        op->actx = actx;
+        op->dump = dump;
+        req = &op->addr_request.hdr;
+    }
+
+    ERR_NEG(netlink_send(&op->nl, req))
+    ERR_END
+    op->sent = true;
+    return 0;
+}
+
+// after a refused link dump, what is left of it is dropped and the address
+// dump goes next
+static int async_without_links(struct getifaddrs_async *op) {
+    ERR_0(op->slots = calloc(LINK_SLOTS, sizeof(*op->slots)))
+    ERR_END
+    arena_rollback(op->link_arena, op->mark);
+    op->lctx.list.head = NULL;
+    op->lctx.list.tail = NULL;
+    op->has_links = false;
+    op->phase = ASYNC_GETADDR;
+    op->mark = arena_mark(op->arena);
+    op->sent = false;
+    return 0;
+}
+
+// joins the lists like getifaddrs_filter() and frees op
+static int async_finish(struct getifaddrs_async *op, struct ifaddrs **ifap) {
+    struct ifaddrs_list result = {NULL, NULL};
+    if (op->want_links) {
+        result = op->lctx.list;
+    }
+    if (!result.tail) {
+        result = op->actx.list;
+    } else if (op->actx.list.head) {
+        result.tail->ifa_next = op->actx.list.head;
+        result.tail = op->actx.list.tail;
+    }
+
+    if (result.head) {
+        // the arena goes with the result now
+        if (op->link_arena == op->arena) {
+            op->link_arena = NULL;
+        }
+        op->arena = NULL;
+        *ifap = result.head;
+    }
+    async_free(op);
+    return 0;
+}
+
+static void async_free(struct getifaddrs_async *op) {
+    if (op->nl.transport) {
+        netlink_close(&op->nl);
+    }
+    link_index_free(&op->idx);
+    close_ioctl_socket(op->actx.ioctl_sockfd);
+    free(op->slots);
+    if (op->link_arena != op->arena) {
+        arena_destroy(op->link_arena);
+    }
+    arena_destroy(op->arena);
+    free(op);
+}
+
+static int foreach_link_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct foreach_ctx *c = ctx;
+
+    struct ifaddrs_internal *outer;
+    ERR_NEG(parse_newlink(c->arena, nlh, &outer))
+    ERR_END
+    if (!outer) {
+        return 0;
+    }
+
+    struct link_slot *slot = &c->links[outer->index % LINK_SLOTS];
+    slot->index = outer->index;
+    slot->flags = outer->inner.ifa_flags;
+    strcpy(slot->name, outer->inner.ifa_name);
+
+    c->stopped = c->cb(&outer->inner, c->cb_ctx);
+    arena_rollback(c->arena, c->mark);
+    return c->stopped != 0;
+}
+
+static int foreach_addr_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct foreach_ctx *c = ctx;
+
+    struct ifaddrs_internal *outer;
+    ERR_NEG(parse_newaddr(c->arena, nlh, &outer))
+    ERR_END
+    if (!outer) {
+        return 0;
+    }
+    struct ifaddrs *ifaddr = &outer->inner;
+
+    // more links than slots, the kernel is asked about the ones that fell out
+    struct link_slot *slot = link_slot_lookup(
+        c->links, &c->ioctl_sockfd, outer->index, ifaddr->ifa_name
+    );
+    if (!slot) {
+        // gone since the address dump was sent
+        return errno == ENODEV ? 0 : -1;
+    }
+    ifaddr->ifa_flags = slot->flags;
+    if (!ifaddr->ifa_name[0]) {
+        strcpy(ifaddr->ifa_name, slot->name);
+    }
+
+    c->stopped = c->cb(ifaddr, c->cb_ctx);
+    arena_rollback(c->arena, c->mark);
+    return c->stopped != 0;
+}
+
+static int getstats_cb(struct nlmsghdr *nlh, void *ctx) {
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct if_stats_msg))) {
+        return 0;
+    }
+    struct if_stats_msg *ifsm = NLMSG_DATA(nlh);
+    struct rtattr *rta =
+        (struct rtattr *)((char *)ifsm + NLMSG_ALIGN(sizeof(*ifsm)));
+    ssize_t rtl = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+    for (; RTA_OK(rta, rtl); rta = RTA_NEXT(rta, rtl)) {
+        if (rta->rta_type == IFLA_STATS_LINK_64) {
+            getstats_put(ctx, ifsm->ifindex, rta);
+        }
+    }
+    return 0;
+}
+
+// for kernels without RTM_GETSTATS, the whole link dump for one attribute
+static int getstats_link_cb(struct nlmsghdr *nlh, void *ctx) {
+    if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+        return 0;
+    }
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    ssize_t rtl = IFLA_PAYLOAD(nlh);
+    for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, rtl);
+         rta = RTA_NEXT(rta, rtl)) {
+        if (rta->rta_type == IFLA_STATS64) {
+            getstats_put(ctx, ifi->ifi_index, rta);
+        }
+    }
+    return 0;
+}
+
+// the counters of every link, into ctx
+static int getstats_dump(struct getstats_ctx *ctx) {
+    struct nlmsghdr buf[IFSTATS_BUF_SIZE / sizeof(struct nlmsghdr)];
+    struct netlink_session nl;
+    ERR_NEG(netlink_open_with(&nl, buf, sizeof(buf), true))
+    ERR_END
+
+    struct getstats_msg request;
+    init_getstats_request(&request);
+    struct getlink_msg link_request;
+    // RTM_GETSTATS appeared in 4.7, before that links carry their counters
+    bool by_link = false;
+    struct retry_state retry = {0};
+    int ret;
+    for (;;) {
+        ctx->count = 0;
+        struct stats_timer timer = stats_enter(IFADDRS_PHASE_GETLINK);
+        if (!by_link) {
+            ret = netlink_dump(
+                &nl, &request.hdr, RTM_NEWSTATS, getstats_cb, ctx
+            );
+        } else {
+            ret = netlink_dump(
+                &nl, &link_request.hdr, RTM_NEWLINK, getstats_link_cb, ctx
+            );
+        }
+        if (ret < 0 && errno == EINTR) {
+            stats_add(STATS_RETRIES, 1);
+            IFADDRS_PROBE(dump_retry, IFADDRS_PHASE_GETLINK);
+        }
+        stats_leave(timer);
+        if (ret == 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            if (retry_next(&retry, true)) {
+                continue;
+            }
+            errno = EAGAIN;
+        } else if (!by_link && (errno == EOPNOTSUPP || errno == EINVAL)) {
+            by_link = true;
+            init_getlink_request(&link_request, NULL);
+            continue;
+        }
+        break;
+    }
+
+    int save_errno = errno;
+    netlink_close(&nl);
+    errno = save_errno;
+    return ret;
+}
+
+static void
+getstats_put(struct getstats_ctx *c, int ifindex, struct rtattr *rta) {
+    if (c->links) {
+        struct ifaddrs *link = link_index_find(c->links, ifindex);
+        if (link) {
+            link_stats_put(link, rta);
+        }
+        return;
+    }
+    if (c->count < c->n) {
+        struct ifaddrs_ifstats *out = &c->stats[c->count];
+        if (!parse_stats64(&out->stats64, rta)) {
+            return;
+        }
+        out->ifindex = ifindex;
+    } else if (RTA_PAYLOAD(rta) < 10 * sizeof(uint64_t)) {
+        return;
+    }
+    c->count++;
+}
+
+// counters fresher than the ones of the message the link was built from
+static void link_stats_put(struct ifaddrs *link, struct rtattr *rta) {
+    struct ifaddrs_ex *ex = TO_INTERNAL(link)->ex;
+    if (ex && parse_stats64(&ex->stats64, rta)) {
+        ex->has |= IFADDRS_EX_STATS64;
+    }
+    if (link->ifa_data) {
+        // cut down the way the kernel fills IFLA_STATS, the two structs have
+        // the same fields in the same order
+        uint64_t in[sizeof(struct rtnl_link_stats) / sizeof(uint32_t)] = {0};
+        uint32_t out[sizeof(in) / sizeof(in[0])];
+        size_t payload = RTA_PAYLOAD(rta);
+        memcpy(in, RTA_DATA(rta), payload < sizeof(in) ? payload : sizeof(in));
+        for (size_t i = 0; i < sizeof(in) / sizeof(in[0]); i++) {
+            out[i] = in[i];
+        }
+        memcpy(link->ifa_data, out, sizeof(out));
+    }
+}
+
+static void
+match_getaddr_with_link(struct ifaddrs *addr, struct ifaddrs *link) {
+    addr->ifa_flags = link->ifa_flags;
+    if (!addr->ifa_name[0]) {
+        strcpy(addr->ifa_name, link->ifa_name);
+    }
+
+    struct ifaddrs_ex *ex = TO_INTERNAL(addr)->ex;
+    const struct ifaddrs_ex *link_ex = TO_INTERNAL(link)->ex;
+    if (ex && link_ex) {
+        ex->mtu = link_ex->mtu;
+        ex->operstate = link_ex->operstate;
+        memcpy(ex->kind, link_ex->kind, sizeof(ex->kind));
+        ex->has |= link_ex->has & IFADDRS_EX_LINK;
+    }
+}
+
+
+int getifaddrs_cache_enable(void) {
+    pthread_mutex_lock(&cache.lock);
+    if (atomic_load(&cache.enabled)) {
+        pthread_mutex_unlock(&cache.lock);
+        return 0;
+    }
+
+    // a child after fork() has to subscribe again, see cache_update()
+    pthread_once(&sockets.once, socket_cache_init);
+    ERR_NEG(cache_open())
+        pthread_mutex_unlock(&cache.lock);
+    ERR_END
+
+    cache.buf_size = NETLINK_BUF_SIZE;
+    ERR_0(cache.buf = malloc(cache.buf_size))
+        cache_reset();
+        pthread_mutex_unlock(&cache.lock);
+    ERR_END
+
+    // the first update is a full dump, and publishes it
+    ERR_NEG(cache_update())
+        cache_reset();
+        pthread_mutex_unlock(&cache.lock);
+    ERR_END
+
+    atomic_store(&cache.enabled, true);
+    pthread_mutex_unlock(&cache.lock);
+    return 0;
+}
+
+void getifaddrs_cache_disable(void) {
+    pthread_mutex_lock(&cache.lock);
+    atomic_store(&cache.enabled, false);
+    cache_reset();
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// the socket notifications arrive on. It belongs to the socket generation it
+// was opened in, a socket inherited across fork() is shared with the parent
+// and each process would take notifications away from the other.
+static int cache_open(void) {
+    cache.generation = atomic_load(&sockets.generation);
+    ERR_NEG(
+        cache.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)
+    )
+    ERR_END
+
+    struct sockaddr_nl sa = {AF_NETLINK};
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    ERR_NEG(bind(cache.fd, (struct sockaddr *)&sa, sizeof(sa)))
+        close(cache.fd);
+        cache.fd = -1;
+    ERR_END
+
+    // a larger queue makes ENOBUFS and the resync after it rarer, the
+    // forced variant needs CAP_NET_ADMIN but is not capped by rmem_max
+    int rcvbuf = CACHE_RCVBUF_SIZE;
+    if (setsockopt(
+            cache.fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)
+        ) < 0) {
+        setsockopt(cache.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    return 0;
+}
+
+static void cache_table_clear(struct cache_table *table) {
+    for (size_t i = 0; i < table->len; i++) {
+        free(table->entries[i].msg);
+    }
+    free(table->entries);
+    table->entries = NULL;
+    table->len = 0;
+    table->cap = 0;
+}
+
+// store a copy of nlh at i, replacing the entry there unless insert is set
+static int cache_table_put(
+    struct cache_table *table, size_t i, bool insert, struct nlmsghdr *nlh,
+    const struct cache_key *key
+) {
+    struct nlmsghdr *copy;
+    stats_add(STATS_ALLOCS, 1);
+    ERR_0(copy = malloc(nlh->nlmsg_len))
+    ERR_END
+    memcpy(copy, nlh, nlh->nlmsg_len);
+    cache.changed = true;
+
+    if (!insert) {
+        free(table->entries[i].msg);
+        table->entries[i].msg = copy;
+        return 0;
+    }
+
+    if (table->len == table->cap) {
+        size_t cap = table->cap ? table->cap * 2 : 64;
+        struct cache_entry *entries;
+        ERR_0(entries = realloc(table->entries, cap * sizeof(*entries)))
+            free(copy);
+        ERR_END
+        table->entries = entries;
+        table->cap = cap;
+    }
+    memmove(
+        &table->entries[i + 1], &table->entries[i],
+        (table->len - i) * sizeof(*table->entries)
+    );
+    table->entries[i].msg = copy;
+    table->entries[i].key = *key;
+    table->len++;
+    return 0;
+}
+
+// keeps the kernel's order for what remains
+static void cache_table_remove(struct cache_table *table, size_t i) {
+    free(table->entries[i].msg);
+    memmove(
+        &table->entries[i], &table->entries[i + 1],
+        (table->len - i - 1) * sizeof(*table->entries)
+    );
+    table->len--;
+    cache.changed = true;
+}
+
+static void cache_key(struct nlmsghdr *nlh, struct cache_key *key) {
+    memset(key, 0, sizeof(*key));
+    if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
+        key->index = ((struct ifinfomsg *)NLMSG_DATA(nlh))->ifi_index;
+        return;
+    }
+
+    struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    key->family = ifa->ifa_family;
+    key->prefixlen = ifa->ifa_prefixlen;
+    key->index = ifa->ifa_index;
+
+    bool has_local = false;
+    ssize_t rtl = IFA_PAYLOAD(nlh);
+    for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, rtl);
+         rta = RTA_NEXT(rta, rtl)) {
+        size_t payload = RTA_PAYLOAD(rta);
+        if (payload > sizeof(key->addr)) {
+            payload = sizeof(key->addr);
+        }
+        // IFA_LOCAL is the address itself on p2p links
+        if (rta->rta_type == IFA_LOCAL) {
+            has_local = true;
+            memcpy(key->addr, RTA_DATA(rta), payload);
+        } else if (rta->rta_type == IFA_ADDRESS && !has_local) {
+            memcpy(key->addr, RTA_DATA(rta), payload);
+        }
+    }
+}
+
+static int cache_table_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct cache_table *table = ctx;
+    struct cache_key key;
+    cache_key(nlh, &key);
+    return cache_table_put(table, table->len, true, nlh, &key);
+}
+
+// dumps list links by ifindex, new ones go where the next dump would put them
+static size_t cache_find_link(uint32_t index, bool *found) {
+    size_t i;
+    for (i = 0; i < cache.links.len; i++) {
+        if (cache.links.entries[i].key.index >= index) {
+            break;
+        }
+    }
+    *found = i < cache.links.len && cache.links.entries[i].key.index == index;
+    return i;
+}
+
+// dumps list ipv4 before ipv6, each by ifindex, then in the order added
+static size_t cache_find_addr(const struct cache_key *key, bool *found) {
+    *found = false;
+    size_t pos = cache.addrs.len;
+    for (size_t i = 0; i < cache.addrs.len; i++) {
+        const struct cache_key *other = &cache.addrs.entries[i].key;
+        if (memcmp(key, other, sizeof(*key)) == 0) {
+            *found = true;
+            return i;
+        }
+        bool after =
+            (key->family == AF_INET && other->family == AF_INET6) ||
+            (key->family == other->family && other->index > key->index);
+        if (after && pos == cache.addrs.len) {
+            pos = i;
+        }
+    }
+    return pos;
+}
+
+// throw away queued notifications, a full dump is about to cover them
+static void cache_discard(void) {
+    struct iovec iov = {cache.buf, cache.buf_size};
+    struct msghdr msg = {NULL, 0, &iov, 1, NULL, 0, 0};
+    while (recvmsg(cache.fd, &msg, MSG_DONTWAIT | MSG_TRUNC) >= 0 ||
+           errno == EINTR || errno == ENOBUFS) {
+        continue;
+    }
+}
+
+static int cache_resync(void) {
+    cache.valid = false;
+    cache_discard();
+
+    struct netlink_session nl;
+    ERR_NEG(netlink_open(&nl))
+    ERR_END
+
+    struct retry_state retry = {0};
+    struct cache_table links = {0};
+    struct getlink_msg link_request;
+    init_getlink_request(&link_request, NULL);
+    while (netlink_dump(
+               &nl, &link_request.hdr, RTM_NEWLINK, cache_table_cb, &links
+           ) < 0) {
+        int save_errno = errno;
+        cache_table_clear(&links);
+        stats_add(STATS_RETRIES, save_errno == EINTR);
+        if (save_errno != EINTR || !retry_next(&retry, true)) {
+            netlink_close(&nl);
+            errno = save_errno == EINTR ? EAGAIN : save_errno;
+            return -1;
+        }
+    }
+
+    struct cache_table addrs = {0};
+    struct getaddr_msg addr_request;
+    init_getaddr_request(&addr_request, NULL);
+    while (netlink_dump(
+               &nl, &addr_request.hdr, RTM_NEWADDR, cache_table_cb, &addrs
+           ) < 0) {
+        int save_errno = errno;
+        cache_table_clear(&addrs);
+        stats_add(STATS_RETRIES, save_errno == EINTR);
+        if (save_errno != EINTR || !retry_next(&retry, true)) {
+            cache_table_clear(&links);
+            netlink_close(&nl);
+            errno = save_errno == EINTR ? EAGAIN : save_errno;
+            return -1;
+        }
+    }
+    netlink_close(&nl);
+
+    cache_table_clear(&cache.links);
+    cache_table_clear(&cache.addrs);
+    cache.links = links;
+    cache.addrs = addrs;
+    cache.valid = true;
+    return 0;
+}
+
+// apply every notification queued since the last call, and publish the
+// tables if that changed them
+static int cache_update(void) {
+    atomic_fetch_add(&cache.updating, 1);
+    int ret = cache_receive();
+    if (ret == 0 && (cache.changed || !atomic_load(&cache.current))) {
+        struct cache_snapshot *snap = cache_snapshot_build();
+        ret = snap ? 0 : -1;
+        cache_publish(snap);
+    } else if (ret < 0) {
+        // notifications were taken off the socket that the snapshot misses
+        int save_errno = errno;
+        cache_publish(NULL);
+        errno = save_errno;
+    }
+    atomic_fetch_sub(&cache.updating, 1);
+    return ret;
+}
+
+static int cache_receive(void) {
+    if (cache.generation != atomic_load(&sockets.generation)) {
+        // forked, or asked to start over by ifaddrs_backend_reprobe()
+        if (cache.fd >= 0) {
+            close(cache.fd);
+            cache.fd = -1;
+        }
+        cache.valid = false;
+        ERR_NEG(cache_open())
+        ERR_END
+    }
+    if (!cache.valid) {
+        ERR_NEG(cache_resync())
+        ERR_END
+    }
+
+    for (;;) {
+        struct sockaddr_nl sa = {AF_NETLINK};
+        struct iovec iov = {cache.buf, cache.buf_size};
+        struct msghdr msg = {&sa, sizeof(sa), &iov, 1, NULL, 0, 0};
+
+        ssize_t len =
+            STATS_SYSCALL(recvmsg(cache.fd, &msg, MSG_DONTWAIT | MSG_TRUNC));
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == ENOBUFS) {
+                // notifications were dropped, patching can no longer work
+                return cache_resync();
+            }
+            return -1;
+        }
+        if (msg.msg_flags & MSG_TRUNC) {
+            // the notification is lost, make sure the next one fits
+            size_t size = cache.buf_size;
+            while (size < (size_t)len) {
+                size *= 2;
+            }
+            struct nlmsghdr *buf;
+            ERR_0(buf = realloc(cache.buf, size))
+            ERR_END
+            cache.buf = buf;
+            cache.buf_size = size;
+            return cache_resync();
+        }
+        if (sa.nl_pid != 0) {
+            continue;
+        }
+        stats_add(STATS_BYTES, len);
+
+        for (struct nlmsghdr *nlh = cache.buf; NLMSG_OK(nlh, len);
+             nlh = NLMSG_NEXT(nlh, len)) {
+            stats_add(STATS_MESSAGES, 1);
+            ERR_NEG(cache_apply(nlh))
+                cache.valid = false;
+            ERR_END
+        }
+    }
+}
+
+static int cache_apply(struct nlmsghdr *nlh) {
+    if (nlh->nlmsg_type == RTM_NEWLINK || nlh->nlmsg_type == RTM_DELLINK) {
+        if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg))) {
+            return 0;
+        }
+        struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+        // bridge port events and the like carry other families
+        if (ifi->ifi_family != AF_UNSPEC) {
+            return 0;
+        }
+
+        struct cache_key key;
+        cache_key(nlh, &key);
+        bool found;
+        size_t i = cache_find_link(key.index, &found);
+        if (nlh->nlmsg_type == RTM_NEWLINK) {
+            return cache_table_put(&cache.links, i, !found, nlh, &key);
+        }
+        if (found) {
+            cache_table_remove(&cache.links, i);
+        }
+        for (size_t j = cache.addrs.len; j-- > 0;) {
+            if (cache.addrs.entries[j].key.index == key.index) {
+                cache_table_remove(&cache.addrs, j);
+            }
+        }
+    } else if (nlh->nlmsg_type == RTM_NEWADDR ||
+               nlh->nlmsg_type == RTM_DELADDR) {
+        if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+            return 0;
+        }
+        struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+        if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6) {
+            return 0;
+        }
 
-            if (!ifp) {
-                *ifap = ifaddr;
-                ifp = ifaddr;
-            } else {
-                ifp->ifa_next = ifaddr;
-                ifp = ifaddr;
-            }
+        struct cache_key key;
+        cache_key(nlh, &key);
+        bool found;
+        size_t i = cache_find_addr(&key, &found);
+        if (nlh->nlmsg_type == RTM_NEWADDR) {
+            return cache_table_put(&cache.addrs, i, !found, nlh, &key);
+        }
+        if (found) {
+            cache_table_remove(&cache.addrs, i);
         }
     }
-
-    free(buf);
-    close(sockfd);
-    return ifp;
+    return 0;
 }
 
-static struct ifaddrs *
-getifaddrs_getaddr(struct ifaddrs **ifap, bool use_getlink_result) {
-    if (ifap == NULL) {
-        errno = EFAULT;
-        return NULL;
+static void cache_reset(void) {
+    if (cache.fd >= 0) {
+        close(cache.fd);
+        cache.fd = -1;
     }
+    free(cache.buf);
+    cache.buf = NULL;
+    cache.buf_size = 0;
+    cache_table_clear(&cache.links);
+    cache_table_clear(&cache.addrs);
+    cache.valid = false;
+    cache_publish(NULL);
+}
 
-    *ifap = NULL;
-
-    int sockfd, ioctl_sockfd;
-    ERR_NEG(sockfd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE))
-    NULL_END
-
-    ERR_NEG(ioctl_sockfd = socket(AF_INET, SOCK_DGRAM, 0))
-        close(sockfd);
-    NULL_END
-
-    struct getaddr_msg {
-        struct nlmsghdr hdr;
-        struct ifaddrmsg ifa __attribute__((aligned(NLMSG_ALIGNTO)));
-    } request = {0};
-    request.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-    request.hdr.nlmsg_type = RTM_GETADDR;
-    request.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
-    request.hdr.nlmsg_seq = 2;
-    request.ifa.ifa_family = AF_UNSPEC;
-
-    struct sockaddr_nl sa = {AF_NETLINK};
-    socklen_t salen = sizeof(sa);
-
-    ERR_WITH_RETRY(
-        sendto(
-            sockfd, &request, sizeof(request), 0, (struct sockaddr *)&sa, salen
-        ) < (ssize_t)sizeof(request)
-    )
-        close(ioctl_sockfd);
-        close(sockfd);
-    NULL_END
+// a copy of the tables in one block, with the lock held
+static struct cache_snapshot *cache_snapshot_build(void) {
+    size_t size = sizeof(struct cache_snapshot) +
+                  (cache.links.len + cache.addrs.len) * sizeof(void *);
+    for (size_t i = 0; i < cache.links.len; i++) {
+        size += NLMSG_ALIGN(cache.links.entries[i].msg->nlmsg_len);
+    }
+    for (size_t i = 0; i < cache.addrs.len; i++) {
+        size += NLMSG_ALIGN(cache.addrs.entries[i].msg->nlmsg_len);
+    }
 
-    // kernel recommend 32k for dump
-    struct nlmsghdr *buf;
-    ERR_0(buf = calloc(1, DUMP_BUF_SIZE))
-        close(ioctl_sockfd);
-        close(sockfd);
+    struct cache_snapshot *snap;
+    stats_add(STATS_ALLOCS, 1);
+    ERR_0(snap = malloc(size))
     NULL_END
+    // one for being published
+    atomic_init(&snap->refs, 1);
+    snap->generation = cache.generation;
+    snap->fd = cache.fd;
+    snap->links = cache.links.len;
+    snap->addrs = cache.addrs.len;
 
-    struct iovec iov = {buf, DUMP_BUF_SIZE};
-    struct msghdr msg = {&sa, salen, &iov, 1, NULL, 0, 0};
+    char *p = (char *)&snap->msgs[snap->links + snap->addrs];
+    const struct cache_table *tables[] = {&cache.links, &cache.addrs};
+    size_t n = 0;
+    for (size_t t = 0; t < 2; t++) {
+        for (size_t i = 0; i < tables[t]->len; i++) {
+            struct nlmsghdr *nlh = tables[t]->entries[i].msg;
+            memcpy(p, nlh, nlh->nlmsg_len);
+            snap->msgs[n++] = (struct nlmsghdr *)p;
+            p += NLMSG_ALIGN(nlh->nlmsg_len);
+        }
+    }
+    cache.changed = false;
+    return snap;
+}
 
-    struct ifaddrs *ifp = *ifap;
+// with the lock held, like snapshot_refresh()
+static void cache_publish(struct cache_snapshot *snap) {
+    struct cache_snapshot *prev = atomic_exchange(&cache.current, snap);
+    if (prev) {
+        unsigned int epoch = atomic_load(&cache.epoch);
+        atomic_store(&cache.epoch, !epoch);
+        while (atomic_load(&cache.readers[epoch]) != 0) {
+            sched_yield();
+        }
+        cache_snapshot_release(prev);
+    }
+}
 
-    int finish = 0;
-    while (!finish) {
-        ssize_t len;
+// new reference to the published snapshot, if any, like snapshot_get()
+static struct cache_snapshot *cache_snapshot_get(void) {
+    unsigned int epoch;
+    for (;;) {
+        epoch = atomic_load(&cache.epoch);
+        atomic_fetch_add(&cache.readers[epoch], 1);
+        if (atomic_load(&cache.epoch) == epoch) {
+            break;
+        }
+        atomic_fetch_sub(&cache.readers[epoch], 1);
+    }
+    struct cache_snapshot *snap = atomic_load(&cache.current);
+    if (snap) {
+        atomic_fetch_add(&snap->refs, 1);
+    }
+    atomic_fetch_sub(&cache.readers[epoch], 1);
+    return snap;
+}
 
-        ERR_NEG_WITH_RETRY(len = recvmsg(sockfd, &msg, 0))
-            freeifaddrs(*ifap);
-            *ifap = NULL;
-            free(buf);
-            close(ioctl_sockfd);
-            close(sockfd);
-        NULL_END
+// the published snapshot if nothing has happened since that it misses, or
+// NULL if only an update under the lock can tell
+static struct cache_snapshot *cache_snapshot_fresh(void) {
+    struct cache_snapshot *snap = cache_snapshot_get();
+    if (!snap) {
+        return NULL;
+    }
+    // in this order: a notification queued before the call is still queued,
+    // or was taken by an update that is running or has published since
+    struct pollfd pfd = {snap->fd, POLLIN, 0};
+    if (snap->generation == atomic_load(&sockets.generation) &&
+        STATS_SYSCALL(poll(&pfd, 1, 0)) == 0 &&
+        atomic_load(&cache.updating) == 0 &&
+        atomic_load(&cache.current) == snap) {
+        return snap;
+    }
+    cache_snapshot_release(snap);
+    return NULL;
+}
 
-        ERR(msg.msg_flags & MSG_TRUNC)
-            freeifaddrs(*ifap);
-            *ifap = NULL;
-            free(buf);
-            close(ioctl_sockfd);
-            close(sockfd);
-        NULL_END
+static void cache_snapshot_release(struct cache_snapshot *snap) {
+    if (snap && atomic_fetch_sub(&snap->refs, 1) == 1) {
+        free(snap);
+    }
+}
 
-        for (struct nlmsghdr *nlh = buf; NLMSG_OK(nlh, len);
-             nlh = NLMSG_NEXT(nlh, len)) {
-            if (nlh->nlmsg_type == NLMSG_DONE) {
-                finish = 1;
-                break;
-            }
-            ERR(nlh->nlmsg_type == NLMSG_ERROR)
-                freeifaddrs(*ifap);
-                *ifap = NULL;
-                free(buf);
-                close(ioctl_sockfd);
-                close(sockfd);
-            NULL_END
+// same result as a fresh dump, built from the cached messages. Only an
+// update takes the lock, the list is built from the published snapshot.
+static int getifaddrs_cached(
+    struct ifaddrs_arena *arena, struct ifaddrs_arena *link_arena,
+    const struct ifaddrs_filter *filter, struct ifaddrs_list *links,
+    struct ifaddrs_list *addrs
+) {
+    struct ifaddrs_arena_mark mark = arena_mark(arena);
+    struct ifaddrs_arena_mark link_mark = arena_mark(link_arena);
 
-            if (nlh->nlmsg_flags & NLM_F_DUMP_INTR) {
-                errno = EINTR;
-                freeifaddrs(*ifap);
-                *ifap = NULL;
-                free(buf);
-                close(ioctl_sockfd);
-                close(sockfd);
-                return NULL;
-            }
+    struct cache_snapshot *snap = cache_snapshot_fresh();
+    if (!snap) {
+        pthread_mutex_lock(&cache.lock);
+        if (!atomic_load(&cache.enabled)) {
+            pthread_mutex_unlock(&cache.lock);
+            errno = ENOENT;
+            return -1;
+        }
+        ERR_NEG(cache_update())
+            pthread_mutex_unlock(&cache.lock);
+        ERR_END
+        // nobody else publishes while the lock is held
+        snap = atomic_load(&cache.current);
+        atomic_fetch_add(&snap->refs, 1);
+        pthread_mutex_unlock(&cache.lock);
+    }
 
-            if (nlh->nlmsg_type != RTM_NEWADDR) {
-                fprintf(stderr, "Unknown message type %d\n", nlh->nlmsg_type);
-                continue;
-            }
+    struct getlink_ctx lctx = {link_arena, filter, {NULL, NULL}};
+    for (size_t i = 0; i < snap->links; i++) {
+        ERR_NEG(getlink_cb(snap->msgs[i], &lctx))
+            cache_snapshot_release(snap);
+            arena_rollback(link_arena, link_mark);
+        ERR_END
+    }
 
-            struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    struct link_index idx;
+    link_index_build(&idx, lctx.list.head);
+    struct getaddr_ctx actx = {arena, filter, &idx, -1, NULL, {NULL, NULL}};
+    if (filter_family(filter, AF_INET) || filter_family(filter, AF_INET6)) {
+        for (size_t i = 0; i < snap->addrs; i++) {
+            ERR_NEG(getaddr_cb(snap->msgs[snap->links + i], &actx))
+                cache_snapshot_release(snap);
+                link_index_free(&idx);
+                arena_rollback(arena, mark);
+                arena_rollback(link_arena, link_mark);
+            ERR_END
+        }
+    }
+    cache_snapshot_release(snap);
 
-            struct ifaddrs_internal *outer;
-            if (ifa->ifa_family == AF_INET) {
-                ERR_0(outer = alloc_ifaddr(sizeof(struct sockaddr_in), false))
-                    freeifaddrs(*ifap);
-                    *ifap = NULL;
-                    free(buf);
-                    close(ioctl_sockfd);
-                    close(sockfd);
-                NULL_END
-            } else if (ifa->ifa_family == AF_INET6) {
-                ERR_0(outer = alloc_ifaddr(sizeof(struct sockaddr_in6), false))
-                    freeifaddrs(*ifap);
-                    *ifap = NULL;
-                    free(buf);
-                    close(ioctl_sockfd);
-                    close(sockfd);
-                NULL_END
-            } else {
-                fprintf(
-                    stderr, "Unknown address family: %d\n", ifa->ifa_family
-                );
-                continue;
-            }
-            struct ifaddrs *ifaddr = &outer->inner;
-            outer->index = ifa->ifa_index;
+    // counters change without a notification, the ones in the cached
+    // messages are where the last link event left them
+    if (link_arena == arena && (!arena->no_stats || arena->ex) &&
+        lctx.list.head) {
+        struct getstats_ctx sctx = {NULL, 0, 0, &idx};
+        ERR_NEG(getstats_dump(&sctx))
+            link_index_free(&idx);
+            arena_rollback(arena, mark);
+        ERR_END
+    }
+    link_index_free(&idx);
 
-            // calculate netmask
-            ifaddr->ifa_netmask->sa_family = ifa->ifa_family;
-            if (ifa->ifa_family == AF_INET) {
-                struct sockaddr_in *sin =
-                    (struct sockaddr_in *)ifaddr->ifa_netmask;
-                sin->sin_addr.s_addr =
-                    htonl(~((uint32_t)0) << (32 - ifa->ifa_prefixlen));
-            } else { // AF_INET6
-                struct sockaddr_in6 *sin6 =
-                    (struct sockaddr_in6 *)ifaddr->ifa_netmask;
-                size_t len = ifa->ifa_prefixlen / 8;
-                size_t rem = ifa->ifa_prefixlen % 8;
-                if (len) {
-                    memset(sin6->sin6_addr.s6_addr, 0xff, len);
-                }
-                if (rem) {
-                    sin6->sin6_addr.s6_addr[len] = 0xffU << (8 - rem);
-                }
-            }
+    *links = lctx.list;
+    *addrs = actx.list;
+    return 0;
+}
+#ifdef IFADDRS_REPLAY
+int getifaddrs_replay(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    const void *dump, size_t len
+) {
+    if ((uintptr_t)dump % NLMSG_ALIGNTO != 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct netlink_replay replay = {0};
+    replay.links = dump;
+    replay.links_len = netlink_replay_split(replay.links, len);
+    replay.addrs =
+        (const struct nlmsghdr *)((const char *)dump + replay.links_len);
+    replay.addrs_len = len - replay.links_len;
+    if (replay.links_len == 0 ||
+        netlink_replay_split(replay.addrs, replay.addrs_len) !=
+            replay.addrs_len) {
+        errno = EINVAL;
+        return -1;
+    }
 
-            bool has_dstaddr = false, has_broadaddr = false;
-            ssize_t rtl = IFA_PAYLOAD(nlh);
-            for (struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, rtl);
-                 rta = RTA_NEXT(rta, rtl)) {
-                // size_t payload = RTA_PAYLOAD(rta);
-                void *data = RTA_DATA(rta);
-
-                if (rta->rta_type == IFA_LABEL) {
-                    strncpy(ifaddr->ifa_name, data, IFNAMSIZ);
-                    ifaddr->ifa_name[IFNAMSIZ - 1] = '\0';
-                } else if (rta->rta_type == IFA_ADDRESS) {
-                    ifaddr->ifa_addr->sa_family = ifa->ifa_family;
-                    if (ifa->ifa_family == AF_INET) {
-                        memcpy(
-                            &((struct sockaddr_in *)ifaddr->ifa_addr)->sin_addr,
-                            data, sizeof(struct in_addr)
-                        );
-                    } else { // AF_INET6
-                        struct sockaddr_in6 *sin6 =
-                            (struct sockaddr_in6 *)ifaddr->ifa_addr;
-                        memcpy(&sin6->sin6_addr, data, sizeof(struct in6_addr));
-                        if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
-                            sin6->sin6_scope_id = ifa->ifa_index;
-                        }
-                    }
-                } else if (rta->rta_type == IFA_BROADCAST) {
-                    has_broadaddr = true;
-#ifdef IFADDRS_USE_UNION
-                    has_dstaddr = false;
-#endif
-                    ifaddr->ifa_broadaddr->sa_family = ifa->ifa_family;
-                    if (ifa->ifa_family == AF_INET) {
-                        memcpy(
-                            &((struct sockaddr_in *)ifaddr->ifa_broadaddr)
-                                 ->sin_addr,
-                            data, sizeof(struct in_addr)
-                        );
-                    } else { // AF_INET6
-                        struct sockaddr_in6 *sin6 =
-                            (struct sockaddr_in6 *)ifaddr->ifa_broadaddr;
-                        memcpy(&sin6->sin6_addr, data, sizeof(struct in6_addr));
-                        if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
-                            sin6->sin6_scope_id = ifa->ifa_index;
-                        }
-                    }
-                } else if (rta->rta_type == IFA_LOCAL) {
-                    has_dstaddr = true;
-#ifdef IFADDRS_USE_UNION
-                    has_broadaddr = false;
-#endif
-                    ifaddr->ifa_dstaddr->sa_family = ifa->ifa_family;
-                    if (ifa->ifa_family == AF_INET) {
-                        memcpy(
-                            &((struct sockaddr_in *)ifaddr->ifa_dstaddr)
-                                 ->sin_addr,
-                            data, sizeof(struct in_addr)
-                        );
-                    } else { // AF_INET6
-                        struct sockaddr_in6 *sin6 =
-                            (struct sockaddr_in6 *)ifaddr->ifa_dstaddr;
-                        memcpy(&sin6->sin6_addr, data, sizeof(struct in6_addr));
-                        if (IN6_IS_ADDR_LINKLOCAL(&sin6->sin6_addr)) {
-                            sin6->sin6_scope_id = ifa->ifa_index;
-                        }
-                    }
-                }
-            }
+    netlink_replay_current = &replay;
+    int ret = getifaddrs_filter(ifap, filter);
+    netlink_replay_current = NULL;
+    return ret;
+}
+#endif
+#else
+int getifaddrs_cache_enable(void) {
+    errno = ENOTSUP;
+    return -1;
+}
 
-            if (has_dstaddr) {
-                // swap dstaddr and addr for p2p interfaces
-                struct sockaddr *tmp = ifaddr->ifa_dstaddr;
-                ifaddr->ifa_dstaddr = ifaddr->ifa_addr;
-                ifaddr->ifa_addr = tmp;
-            }
+void getifaddrs_cache_disable(void) {
+}
 
-#ifndef IFADDRS_USE_UNION
-            if (!has_dstaddr) {
-                free_dstaddr(ifaddr);
-            }
-            if (!has_broadaddr) {
-                free_broadaddr(ifaddr);
-            }
-#else
-            if (!has_broadaddr && !has_dstaddr) {
-                free_broadaddr(ifaddr);
-            }
+#ifdef IFADDRS_REPLAY
+int getifaddrs_replay(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    const void *dump, size_t len
+) {
+    errno = ENOTSUP;
+    return -1;
+}
+#endif
 #endif
 
-            if (!use_getlink_result) {
-                // handle ipv6 no IFA_LABEL
-                if (!ifaddr->ifa_name[0]) {
-                    if_indextoname(ifa->ifa_index, ifaddr->ifa_name);
-                    if (!ifaddr->ifa_name[0]) {
-                        free_ifaddr(outer);
-                        continue;
-                    }
-                }
+static bool filter_family(const struct ifaddrs_filter *filter, int family) {
+    if (!filter || !filter->families) {
+        return true;
+    }
+    switch (family) {
+    case AF_PACKET:
+    case AF_UNSPEC:
+        return filter->families & IFADDRS_FAMILY_PACKET;
+    case AF_INET:
+        return filter->families & IFADDRS_FAMILY_INET;
+    case AF_INET6:
+        return filter->families & IFADDRS_FAMILY_INET6;
+    default:
+        return false;
+    }
+}
 
-                struct ifreq ifr = {0};
-                strcpy(ifr.ifr_name, ifaddr->ifa_name);
-                ERR_NEG_WITH_RETRY(ioctl(ioctl_sockfd, SIOCGIFFLAGS, &ifr))
-                    free_ifaddr(outer);
-                    freeifaddrs(*ifap);
-                    *ifap = NULL;
-                    free(buf);
-                    close(ioctl_sockfd);
-                    close(sockfd);
-                NULL_END
-                ifaddr->ifa_flags = ifr.ifr_flags;
-            }
-
-            if (!ifp) {
-                *ifap = ifaddr;
-                ifp = ifaddr;
-            } else {
-                ifp->ifa_next = ifaddr;
-                ifp = ifaddr;
-            }
-        }
+// the ioctl fallback cannot filter anything up front, so drop what does not
+// match afterwards. The master of an interface is unknown there.
+static void filter_ioctl_result(
+    struct ifaddrs_list *list, const struct ifaddrs_filter *filter
+) {
+    if (!filter) {
+        return;
     }
 
-    free(buf);
-    close(ioctl_sockfd);
-    close(sockfd);
-    return ifp;
-}
+    char name[IFNAMSIZ] = {0};
+    if (filter->ifindex && !if_indextoname(filter->ifindex, name)) {
+        name[0] = '\0';
+    }
+    size_t name_len = strlen(name);
 
-static void
-match_getaddr_with_getlink(struct ifaddrs *links, struct ifaddrs *addrs) {
-    struct ifaddrs *lp = links;
-    for (struct ifaddrs *a = addrs; a; a = a->ifa_next) {
-        struct ifaddrs_internal *outer_a = TO_INTERNAL(a);
-        bool matched = false;
-
-        // assume kernel preserve order first, which is normally true
-        while (!matched && lp) {
-            struct ifaddrs_internal *outer_l = TO_INTERNAL(lp);
-            if (outer_l->index == outer_a->index) {
-                a->ifa_flags = lp->ifa_flags;
-                if (!a->ifa_name[0]) {
-                    strcpy(a->ifa_name, lp->ifa_name);
-                }
-                matched = true;
-                break;
-            }
-            lp = lp->ifa_next;
+    struct ifaddrs **link = &list->head;
+    list->tail = NULL;
+    while (*link) {
+        struct ifaddrs *ifa = *link;
+        bool keep = !filter->master &&
+                    filter_family(filter, ifa->ifa_addr->sa_family) &&
+                    (ifa->ifa_flags & filter->flags) == filter->flags;
+        // aliases like eth0:1 belong to eth0
+        if (keep && filter->ifindex) {
+            keep = name_len && strncmp(ifa->ifa_name, name, name_len) == 0 &&
+                   (ifa->ifa_name[name_len] == '\0' ||
+                    ifa->ifa_name[name_len] == ':');
         }
-
-        // just to be extra sure
-        if (!matched) {
-            for (struct ifaddrs *l = links; l; l = l->ifa_next) {
-                struct ifaddrs_internal *outer_l = TO_INTERNAL(l);
-                if (outer_l->index == outer_a->index) {
-                    a->ifa_flags = l->ifa_flags;
-                    if (!a->ifa_name[0]) {
-                        strcpy(a->ifa_name, l->ifa_name);
-                    }
-                    matched = true;
-                    lp = l;
-                    break;
-                }
-            }
+        if (keep) {
+            list->tail = ifa;
+            link = &ifa->ifa_next;
+        } else {
+            *link = ifa->ifa_next;
         }
     }
 }
-#endif
 
-// fallback ioctl implementation, no ipv6 support
-static struct ifaddrs *
-getifaddrs_ioctl(struct ifaddrs **ifap, bool get_hwaddr) {
+// fallback ioctl implementation. SIOCGIFCONF lists the ipv4 addresses of a
+// device one after the other, aliases included, so what belongs to the device
+// is only asked for along with its first address. ipv6 addresses follow.
+static struct ifaddrs *getifaddrs_ioctl(
+    struct ifaddrs_arena *arena, struct ifaddrs **ifap, bool get_hwaddr
+) {
     if (ifap == NULL) {
         errno = EFAULT;
         return NULL;
     }
 
     *ifap = NULL;
+    struct ifaddrs_arena_mark mark = arena_mark(arena);
 
     int sockfd;
-    ERR_NEG(sockfd = socket(AF_INET, SOCK_DGRAM, 0))
-    NULL_END
-
-    struct ifconf ifc = {0};
-    ifc.ifc_len = 0;
-    ifc.ifc_buf = NULL;
-    ERR_NEG_WITH_RETRY(ioctl(sockfd, SIOCGIFCONF, &ifc))
-        close(sockfd);
-    NULL_END
-
-    ERR_0(ifc.ifc_buf = calloc(1, ifc.ifc_len))
-        close(sockfd);
+    ERR_NEG(sockfd = open_ioctl_socket())
     NULL_END
 
-    ERR_NEG_WITH_RETRY(ioctl(sockfd, SIOCGIFCONF, &ifc))
-        free(ifc.ifc_buf);
-        close(sockfd);
+    struct ifconf ifc;
+    ERR_NEG(ioctl_ifconf(sockfd, &ifc))
+        close_ioctl_socket(sockfd);
     NULL_END
 
     struct ifreq *ifr = ifc.ifc_req;
     size_t n = ifc.ifc_len / sizeof(struct ifreq);
+    stats_add(STATS_MESSAGES, n);
 
+    // device of the previous entry, eth0 for eth0:1
+    char dev[IFNAMSIZ] = "";
+    unsigned int dev_flags = 0;
     struct ifaddrs *ifp = NULL;
     for (size_t i = 0; i < n; i++) {
+        char base[IFNAMSIZ];
+        strncpy(base, ifr[i].ifr_name, IFNAMSIZ);
+        base[IFNAMSIZ - 1] = '\0';
+        char *colon = strchr(base, ':');
+        if (colon) {
+            *colon = '\0';
+        }
+
+        if (strcmp(base, dev) != 0) {
+            strcpy(dev, base);
+            struct ifreq req = {0};
+            strcpy(req.ifr_name, dev);
+            ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(sockfd, SIOCGIFFLAGS, &req)))
+                arena_rollback(arena, mark);
+                *ifap = NULL;
+                free(ifc.ifc_buf);
+                close_ioctl_socket(sockfd);
+            NULL_END
+            dev_flags = (unsigned short)req.ifr_flags;
+
+            struct ifaddrs_internal *hwaddr_outer = NULL;
+            // fatal error if cannot allocate memory
+            ERR(get_hwaddr &&
+                ioctl_link(arena, sockfd, dev, dev_flags, &hwaddr_outer) < 0)
+                arena_rollback(arena, mark);
+                *ifap = NULL;
+                free(ifc.ifc_buf);
+                close_ioctl_socket(sockfd);
+            NULL_END
+            if (hwaddr_outer) {
+                struct ifaddrs *hwaddr = &hwaddr_outer->inner;
+                if (!ifp) {
+                    *ifap = hwaddr;
+                } else {
+                    ifp->ifa_next = hwaddr;
+                }
+                ifp = hwaddr;
+            }
+        }
+
         struct ifaddrs_internal *outer;
-        ERR_0(outer = alloc_ifaddr(sizeof(struct sockaddr_in), false))
-            freeifaddrs(*ifap);
+        ERR_0(outer = alloc_ifaddr(arena, sizeof(struct sockaddr_in), false))
+            arena_rollback(arena, mark);
             *ifap = NULL;
             free(ifc.ifc_buf);
-            close(sockfd);
+            close_ioctl_socket(sockfd);
         NULL_END
         struct ifaddrs *ifaddr = &outer->inner;
 
         strncpy(ifaddr->ifa_name, ifr[i].ifr_name, IFNAMSIZ);
         ifaddr->ifa_name[IFNAMSIZ - 1] = '\0';
+        ifaddr->ifa_flags = dev_flags;
 
         memcpy(ifaddr->ifa_addr, &ifr[i].ifr_addr, sizeof(struct sockaddr_in));
 
-        ERR_NEG_WITH_RETRY(ioctl(sockfd, SIOCGIFFLAGS, &ifr[i]))
-            free_ifaddr(outer);
-            freeifaddrs(*ifap);
-            *ifap = NULL;
-            free(ifc.ifc_buf);
-            close(sockfd);
-        NULL_END
-        ifaddr->ifa_flags = ifr[i].ifr_flags;
-
         bool has_broadaddr = false, has_dstaddr = false;
 
-        ERR_NEG_WITH_RETRY(ioctl(sockfd, SIOCGIFNETMASK, &ifr[i]))
-            free_ifaddr(outer);
-            freeifaddrs(*ifap);
+        // each request starts from the entry as listed, the kernel tells the
+        // addresses sharing a label apart by ifr_addr
+        struct ifreq req = ifr[i];
+        ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(sockfd, SIOCGIFNETMASK, &req)))
+            arena_rollback(arena, mark);
             *ifap = NULL;
             free(ifc.ifc_buf);
-            close(sockfd);
+            close_ioctl_socket(sockfd);
         NULL_END
         memcpy(
-            ifaddr->ifa_netmask, &ifr[i].ifr_netmask, sizeof(struct sockaddr_in)
+            ifaddr->ifa_netmask, &req.ifr_netmask, sizeof(struct sockaddr_in)
         );
 
-        ERR_NEG_WITH_RETRY(ioctl(sockfd, SIOCGIFDSTADDR, &ifr[i]))
-            free_ifaddr(outer);
-            freeifaddrs(*ifap);
+        req = ifr[i];
+        ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(sockfd, SIOCGIFDSTADDR, &req)))
+            arena_rollback(arena, mark);
             *ifap = NULL;
             free(ifc.ifc_buf);
-            close(sockfd);
+            close_ioctl_socket(sockfd);
         NULL_END
         if (!is_zero(
-                (char *)&((struct sockaddr_in *)&ifr[i].ifr_dstaddr)->sin_addr,
+                (char *)&((struct sockaddr_in *)&req.ifr_dstaddr)->sin_addr,
                 sizeof(struct in_addr)
             )) {
             has_dstaddr = true;
             memcpy(
-                ifaddr->ifa_dstaddr, &ifr[i].ifr_dstaddr,
+                ifaddr->ifa_dstaddr, &req.ifr_dstaddr,
                 sizeof(struct sockaddr_in)
             );
         }
 
-        ERR_NEG_WITH_RETRY(ioctl(sockfd, SIOCGIFBRDADDR, &ifr[i]))
-            free_ifaddr(outer);
-            freeifaddrs(*ifap);
+        req = ifr[i];
+        ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(sockfd, SIOCGIFBRDADDR, &req)))
+            arena_rollback(arena, mark);
             *ifap = NULL;
             free(ifc.ifc_buf);
-            close(sockfd);
+            close_ioctl_socket(sockfd);
         NULL_END
         if (!is_zero(
-                (char *)&((struct sockaddr_in *)&ifr[i].ifr_broadaddr)
-                    ->sin_addr,
+                (char *)&((struct sockaddr_in *)&req.ifr_broadaddr)->sin_addr,
                 sizeof(struct in_addr)
             )) {
             has_broadaddr = true;
             memcpy(
-                ifaddr->ifa_broadaddr, &ifr[i].ifr_broadaddr,
+                ifaddr->ifa_broadaddr, &req.ifr_broadaddr,
                 sizeof(struct sockaddr_in)
             );
         }
 
 #ifndef IFADDRS_USE_UNION
         if (!has_dstaddr) {
-            free_dstaddr(ifaddr);
+            ifaddr->ifa_dstaddr = NULL;
         }
         if (!has_broadaddr) {
-            free_broadaddr(ifaddr);
+            ifaddr->ifa_broadaddr = NULL;
         }
 #else
         if (!has_broadaddr && !has_dstaddr) {
-            free_broadaddr(ifaddr);
+            ifaddr->ifa_broadaddr = NULL;
         }
 #endif
 
-        if (get_hwaddr) {
-            struct ifaddrs_internal *hwaddr_outer;
-            // fatal error if cannot allocate memory
-            ERR_0(hwaddr_outer = alloc_ifaddr(sizeof(struct sockaddr_ll), true))
-                free_ifaddr(outer);
-                freeifaddrs(*ifap);
-                *ifap = NULL;
-                free(ifc.ifc_buf);
-                close(sockfd);
-            NULL_END
-            struct ifaddrs *hwaddr = &hwaddr_outer->inner;
+        if (!ifp) {
+            *ifap = ifaddr;
+            ifp = ifaddr;
+        } else {
+            ifp->ifa_next = ifaddr;
+            ifp = ifaddr;
+        }
+    }
 
-            // cannot get hardware broadcast address using ioctl
-            free(hwaddr->ifa_broadaddr);
-            hwaddr->ifa_broadaddr = NULL;
+    struct ifaddrs_list list = {*ifap, ifp};
+    ERR_NEG(ioctl_inet6(arena, &sockfd, &list))
+        arena_rollback(arena, mark);
+        *ifap = NULL;
+        free(ifc.ifc_buf);
+        close_ioctl_socket(sockfd);
+    NULL_END
+    *ifap = list.head;
+    ifp = list.tail;
 
-            hwaddr->ifa_flags = ifaddr->ifa_flags;
-            strcpy(hwaddr->ifa_name, ifaddr->ifa_name);
+    free(ifc.ifc_buf);
+    close_ioctl_socket(sockfd);
+    return ifp;
+}
 
-            // if we cannot get it, just ignore
-            bool ioctl_error = false;
-            while (ioctl(sockfd, SIOCGIFHWADDR, &ifr[i]) < 0) {
-                if (errno != EINTR) {
-                    ioctl_error = true;
-                    break;
-                } else {
-                    continue;
-                }
+// SIOCGIFCONF into a buffer sized after what earlier calls needed, so that
+// it is normally asked for once. A list that filled the buffer may have been
+// cut short and is asked for again with twice the room.
+static int ioctl_ifconf(int sockfd, struct ifconf *ifc) {
+    size_t size = atomic_load(&ifconf_hint);
+    for (;;) {
+        stats_add(STATS_ALLOCS, 1);
+        ERR_0(ifc->ifc_buf = malloc(size))
+        ERR_END
+        ifc->ifc_len = size;
+        ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(sockfd, SIOCGIFCONF, ifc)))
+            free(ifc->ifc_buf);
+        ERR_END
+        if ((size_t)ifc->ifc_len < size) {
+            break;
+        }
+        free(ifc->ifc_buf);
+        size *= 2;
+    }
+
+    size_t hint = atomic_load(&ifconf_hint);
+    while (hint < size &&
+           !atomic_compare_exchange_weak(&ifconf_hint, &hint, size)) {
+        continue;
+    }
+    return 0;
+}
+
+// the AF_PACKET entry of a device, *out is left NULL if it has none
+static int ioctl_link(
+    struct ifaddrs_arena *arena, int sockfd, const char *name,
+    unsigned int flags, struct ifaddrs_internal **out
+) {
+    *out = NULL;
+    struct ifreq req = {0};
+    strcpy(req.ifr_name, name);
+
+    // if we cannot get it, just ignore
+    int ret;
+    while ((ret = STATS_SYSCALL(ioctl(sockfd, SIOCGIFHWADDR, &req))) < 0 &&
+           errno == EINTR) {
+        continue;
+    }
+    if (ret < 0) {
+        return 0;
+    }
+    struct sockaddr hwaddr = req.ifr_hwaddr;
+    while ((ret = STATS_SYSCALL(ioctl(sockfd, SIOCGIFINDEX, &req))) < 0 &&
+           errno == EINTR) {
+        continue;
+    }
+    if (ret < 0) {
+        return 0;
+    }
+
+    struct ifaddrs_internal *outer;
+    ERR_0(outer = alloc_ifaddr(arena, sizeof(struct sockaddr_ll), true))
+    ERR_END
+    struct ifaddrs *ifaddr = &outer->inner;
+
+    // cannot get hardware broadcast address using ioctl
+    ifaddr->ifa_broadaddr = NULL;
+
+    ifaddr->ifa_flags = flags;
+    strcpy(ifaddr->ifa_name, name);
+    outer->index = req.ifr_ifindex;
+
+    struct sockaddr_ll *sll = (struct sockaddr_ll *)ifaddr->ifa_addr;
+    sll->sll_family = AF_PACKET;
+    memcpy(sll->sll_addr, hwaddr.sa_data, ETH_ALEN);
+    sll->sll_halen = ETH_ALEN;
+    sll->sll_hatype = hwaddr.sa_family;
+    sll->sll_ifindex = req.ifr_ifindex;
+
+    *out = outer;
+    return 0;
+}
+
+// IPv6 addresses, which SIOCGIFCONF leaves out, from /proc/net/if_inet6. The
+// file is read in pieces into a buffer on the stack and each line becomes an
+// entry as soon as it is complete. Without the file there is no IPv6.
+static int ioctl_inet6(
+    struct ifaddrs_arena *arena, int *sockfd, struct ifaddrs_list *list
+) {
+    int fd;
+    while ((fd = STATS_SYSCALL(
+                open("/proc/net/if_inet6", O_RDONLY | O_CLOEXEC)
+            )) < 0 &&
+           errno == EINTR) {
+        continue;
+    }
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct link_slot slots[LINK_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    char buf[IF_INET6_BUF_SIZE];
+    size_t len = 0;
+    for (;;) {
+        ssize_t n;
+        ERR_NEG_WITH_RETRY(
+            n = STATS_SYSCALL(read(fd, buf + len, sizeof(buf) - len))
+        )
+            close(fd);
+        ERR_END
+        if (n == 0) {
+            break;
+        }
+        stats_add(STATS_BYTES, n);
+        len += n;
+
+        char *line = buf, *eol;
+        while ((eol = memchr(line, '\n', buf + len - line))) {
+            *eol = '\0';
+            struct in6_addr addr;
+            int index;
+            unsigned int prefixlen;
+            char *name;
+            if (!parse_if_inet6(line, &addr, &index, &prefixlen, &name)) {
+                stats_add(STATS_UNKNOWN, 1);
+                line = eol + 1;
+                continue;
             }
-            if (!ioctl_error) {
-                struct sockaddr_ll *sll =
-                    (struct sockaddr_ll *)hwaddr->ifa_addr;
-                sll->sll_family = AF_PACKET;
-                memcpy(sll->sll_addr, ifr[i].ifr_hwaddr.sa_data, ETH_ALEN);
-                sll->sll_halen = ETH_ALEN;
-                sll->sll_hatype = ifr[i].ifr_hwaddr.sa_family;
-
-                sll->sll_ifindex = if_nametoindex(ifaddr->ifa_name);
-                if (sll->sll_ifindex != 0) {
-                    if (!ifp) {
-                        *ifap = hwaddr;
-                        ifp = hwaddr;
-                    } else {
-                        ifp->ifa_next = hwaddr;
-                        ifp = hwaddr;
-                    }
-                } else {
-                    free_ifaddr(outer);
-                }
+            stats_add(STATS_MESSAGES, 1);
+            line = eol + 1;
+
+            struct link_slot *slot =
+                link_slot_lookup(slots, sockfd, index, name);
+            // gone since the file was read
+            if (!slot && errno == ENODEV) {
+                continue;
+            }
+            ERR_0(slot)
+                close(fd);
+            ERR_END
+
+            struct ifaddrs_internal *outer;
+            ERR_0(
+                outer = alloc_ifaddr(arena, sizeof(struct sockaddr_in6), false)
+            )
+                close(fd);
+            ERR_END
+            struct ifaddrs *ifaddr = &outer->inner;
+            outer->index = index;
+            strcpy(ifaddr->ifa_name, slot->name);
+            ifaddr->ifa_flags = slot->flags;
+
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ifaddr->ifa_addr;
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_addr = addr;
+            if (IN6_IS_ADDR_LINKLOCAL(&addr)) {
+                sin6->sin6_scope_id = index;
+            }
+
+            sin6 = (struct sockaddr_in6 *)ifaddr->ifa_netmask;
+            sin6->sin6_family = AF_INET6;
+            size_t bytes = prefixlen / 8;
+            size_t rem = prefixlen % 8;
+            if (bytes) {
+                memset(sin6->sin6_addr.s6_addr, 0xff, bytes);
+            }
+            if (rem) {
+                sin6->sin6_addr.s6_addr[bytes] = 0xffU << (8 - rem);
+            }
+
+            ifaddr->ifa_broadaddr = NULL;
+#ifndef IFADDRS_USE_UNION
+            ifaddr->ifa_dstaddr = NULL;
+#endif
+
+            if (!list->tail) {
+                list->head = ifaddr;
             } else {
-                free_ifaddr(outer);
+                list->tail->ifa_next = ifaddr;
             }
+            list->tail = ifaddr;
         }
 
-        if (!ifp) {
-            *ifap = ifaddr;
-            ifp = ifaddr;
+        len = buf + len - line;
+        // no line is that long
+        ERR(len == sizeof(buf))
+            close(fd);
+            save_errno = EIO;
+        ERR_END
+        memmove(buf, line, len);
+    }
+
+    close(fd);
+    return 0;
+}
+
+// "<32 hex digits> <ifindex> <prefixlen> <scope> <flags> <name>", the numbers
+// in hex. line ends at the newline, which has been replaced by a nul
+static bool parse_if_inet6(
+    char *line, struct in6_addr *addr, int *index, unsigned int *prefixlen,
+    char **name
+) {
+    for (size_t i = 0; i < 2 * sizeof(addr->s6_addr); i++) {
+        char c = line[i];
+        unsigned int digit;
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
         } else {
-            ifp->ifa_next = ifaddr;
-            ifp = ifaddr;
+            return false;
         }
+        unsigned char *byte = &addr->s6_addr[i / 2];
+        *byte = (i % 2 ? *byte << 4 : 0) | digit;
     }
 
-    free(ifc.ifc_buf);
-    close(sockfd);
-    return ifp;
+    char *p = line + 2 * sizeof(addr->s6_addr), *end;
+    unsigned long value = strtoul(p, &end, 16);
+    if (end == p || value == 0 || value > INT_MAX) {
+        return false;
+    }
+    *index = value;
+    p = end;
+    value = strtoul(p, &end, 16);
+    if (end == p || value > 128) {
+        return false;
+    }
+    *prefixlen = value;
+    // scope and flags
+    for (int i = 0; i < 2; i++) {
+        p = end;
+        strtoul(p, &end, 16);
+        if (end == p) {
+            return false;
+        }
+    }
+
+    p = end;
+    while (*p == ' ') {
+        p++;
+    }
+    if (!*p || strlen(p) >= IFNAMSIZ) {
+        return false;
+    }
+    *name = p;
+    return true;
+}
+
+// the slot of a link, asked for the first time an address on it comes along
+// and reused for the others. The name comes from the label of the address if
+// it has one, from SIOCGIFNAME otherwise. *sockfd is opened when first needed.
+static struct link_slot *link_slot_lookup(
+    struct link_slot *slots, int *sockfd, int index, const char *label
+) {
+    struct link_slot *slot = &slots[(unsigned int)index % LINK_SLOTS];
+    if (slot->index == index) {
+        return slot;
+    }
+
+    if (*sockfd < 0) {
+        ERR_NEG(*sockfd = open_ioctl_socket())
+        NULL_END
+    }
+    struct ifreq ifr = {0};
+    if (label[0]) {
+        // the name of the link, with ":alias" appended for an alias
+        strncpy(ifr.ifr_name, label, IFNAMSIZ - 1);
+        char *colon = strchr(ifr.ifr_name, ':');
+        if (colon) {
+            *colon = '\0';
+        }
+    } else {
+        ifr.ifr_ifindex = index;
+        ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(*sockfd, SIOCGIFNAME, &ifr)))
+        NULL_END
+    }
+    ERR_NEG_WITH_RETRY(STATS_SYSCALL(ioctl(*sockfd, SIOCGIFFLAGS, &ifr)))
+    NULL_END
+
+    slot->index = index;
+    slot->flags = ifr.ifr_flags;
+    memcpy(slot->name, ifr.ifr_name, IFNAMSIZ);
+    slot->name[IFNAMSIZ - 1] = '\0';
+    return slot;
 }
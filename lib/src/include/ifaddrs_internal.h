@@ -1,27 +1,776 @@
 #ifndef IFADDRS_INTERNAL_H
 #define IFADDRS_INTERNAL_H
 
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "macros.h"
 #include "ifaddrs.h"
 
+struct ifaddrs_arena;
+
+// in every node of this library, where glibc's nodes have their address
+#define IFADDRS_MAGIC 0x69666164
+
 struct ifaddrs_internal {
     struct ifaddrs inner;
     int index;
+    // IFADDRS_MAGIC
+    unsigned int magic;
+    // owner of this node and everything it points to
+    struct ifaddrs_arena *arena;
+    // NULL unless the arena keeps extended records
+    struct ifaddrs_ex *ex;
 };
 
 #define TO_INTERNAL(ifa) CONTAINER_OF_UNCHECKED(ifa, struct ifaddrs_internal, inner)
 
-static struct ifaddrs_internal *alloc_ifaddr(size_t socklen, bool addr_only);
-static void free_ifaddr(struct ifaddrs_internal *ifa);
-static struct ifaddrs *getifaddrs_ioctl(struct ifaddrs **ifap, bool get_hwaddr);
+// the whole result list lives in a chain of blocks, freed in one go
+struct ifaddrs_list {
+    struct ifaddrs *head;
+    struct ifaddrs *tail;
+};
+
+struct ifaddrs_arena_block {
+    struct ifaddrs_arena_block *prev;
+    size_t size;
+    size_t used;
+    _Alignas(max_align_t) unsigned char data[];
+};
+
+struct ifaddrs_arena {
+    struct ifaddrs_arena_block *current;
+    // holds a list served under IFADDRS_RETRY_STALE
+    bool stale;
+    // entries get a struct ifaddrs_ex, for getifaddrs_ex()
+    bool ex;
+    // links get no ifa_data and are dumped without their counters
+    bool no_stats;
+};
+
+struct ifaddrs_arena_mark {
+    struct ifaddrs_arena_block *block;
+    size_t used;
+};
+
+struct ifaddrs_snapshot {
+    atomic_uint refs;
+    // CLOCK_MONOTONIC
+    uint64_t taken_ns;
+    struct ifaddrs *list;
+};
+
+// readers announce themselves in the counter of the current epoch while they
+// load the pointer and take their reference, and announce themselves again if
+// the epoch moved on meanwhile. A refresh flips the epoch and waits for the
+// old counter to drain before dropping the old snapshot.
+struct ifaddrs_snapshots {
+    _Atomic(struct ifaddrs_snapshot *) current;
+    atomic_uint epoch;
+    atomic_uint readers[2];
+    atomic_uint max_age_ms;
+    // held while taking a new snapshot
+    pthread_mutex_t refresh_lock;
+};
+
+#define SNAPSHOT_MAX_AGE_MS 1000
+
+#if defined(__x86_64__)
+// SSE2 is always there, AVX2 is checked for when the tables are built
+#define OWNER_X86
+#endif
+
+// exact lookups binary search down to a window this wide and compare all of
+// it at once, the ipv4 arrays have this much padding for the vector loads
+#define OWNER_WINDOW 8
+
+// the prefixes of one length, a run of net4 or net6 sorted by network
+struct owner_group {
+    size_t start;
+    size_t count;
+    unsigned int len;
+};
+
+// the tables of one refresh in a single block. ipv4 values are in host byte
+// order. Addresses are sorted, prefixes are grouped by length, longest first,
+// so that the longest match is the first group with an exact hit for the
+// masked address.
+struct owner_table {
+    bool avx2;
+    size_t n4;
+    uint32_t *addr4;
+    int *addr4_index;
+    size_t p4;
+    uint32_t *net4;
+    unsigned char *len4;
+    int *net4_index;
+    size_t g4;
+    struct owner_group *group4;
+    size_t n6;
+    struct in6_addr *addr6;
+    int *addr6_index;
+    size_t p6;
+    struct in6_addr *net6;
+    int *net6_index;
+    size_t g6;
+    struct owner_group *group6;
+};
+
+// one address of the list while the tables are sorted
+struct owner_entry {
+    int family;
+    struct in6_addr addr;
+    struct in6_addr net;
+    unsigned int prefixlen;
+    bool has_prefix;
+    int index;
+    size_t pos;
+};
+
+// readers are counted like those of struct ifaddrs_snapshots, but only for
+// the length of a lookup
+struct ifaddrs_owner_index {
+    _Atomic(struct owner_table *) current;
+    atomic_uint epoch;
+    atomic_uint readers[2];
+    // held while swapping in new tables
+    pthread_mutex_t refresh_lock;
+};
+
+// struct ifaddrs_retry_policy, read field by field when a dump is interrupted
+struct ifaddrs_retry {
+    atomic_uint max_retries;
+    atomic_uint backoff_us;
+    atomic_uint max_backoff_us;
+    atomic_uint flags;
+    // copy of the last full result, kept under IFADDRS_RETRY_STALE
+    pthread_mutex_t last_lock;
+    struct ifaddrs *last;
+};
+
+// restarts one call has made so far
+struct retry_state {
+    bool loaded;
+    unsigned int count;
+    struct ifaddrs_retry_policy policy;
+    unsigned int backoff_us;
+};
+
+// sockets a thread keeps between calls while the socket cache is on, -1 when
+// it has none. A socket is busy while a call of this thread uses it, a nested
+// call, e.g. from a getifaddrs_foreach() callback, opens one of its own.
+struct socket_cache {
+    // fork generation the sockets were opened in
+    unsigned int generation;
+    // the thread exit destructor knows about this cache
+    bool registered;
+    int ioctl_fd;
+    bool ioctl_busy;
+    int netlink_fd;
+    bool netlink_busy;
+    // state of netlink_fd carried from one session to the next, sequence
+    // numbers go on so that replies to earlier sessions are never mistaken
+    // for replies to the current one
+    uint32_t seq;
+    bool dumping;
+    bool strict;
+    // largest buffer netlink_fd has been read into. The kernel fills dump
+    // datagrams up to that, sessions with a smaller buffer do not take it.
+    size_t recv_size;
+};
+
+struct ifaddrs_sockets {
+    atomic_bool enabled;
+    // bumped in the child after fork(), sockets from before are shared with
+    // the parent
+    atomic_uint generation;
+    pthread_once_t once;
+    // closes the sockets of a thread when it exits
+    pthread_key_t key;
+    bool has_key;
+};
+
+// start of a shared mapping, followed by two slots. The writer fills the slot
+// readers are not using and then moves seq on by two. While it writes, seq is
+// odd and readers keep to the other slot.
+struct ifaddrs_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t seq;
+    uint32_t size;
+    uint32_t slot_size;
+    uint32_t slot[2];
+    // first entry and entry count of what each slot holds
+    uint32_t first[2];
+    uint32_t count[2];
+};
+
+struct ifaddrs_shm {
+    int fd;
+    bool owns_fd;
+    size_t len;
+    struct ifaddrs_shm_header *hdr;
+};
+
+#define SHM_MAGIC 0x49464153 // IFAS
+#define SHM_VERSION 1
+#define SHM_SLOT_SIZE (1024 * 1024)
+#define SHM_ALIGN(n) (((n) + 7) & ~(size_t)7)
+// the slot holding the result published as of seq
+#define SHM_SLOT(seq) (((seq) >> 1) & 1)
+
+// what the hooks count, everything but the last two per phase
+enum stats_counter {
+    STATS_SYSCALLS,
+    STATS_BYTES,
+    STATS_MESSAGES,
+    STATS_ALLOCS,
+    STATS_RETRIES,
+    STATS_FALLBACKS,
+    STATS_UNKNOWN,
+};
+
+// phase to go back to and when the current one started, 0 when not counting
+struct stats_timer {
+    int phase;
+    uint64_t start;
+};
+
+#define STATS_WORDS (sizeof(struct ifaddrs_stats) / sizeof(unsigned long long))
+
+// counts the system call expr makes each time it is evaluated
+#define STATS_SYSCALL(expr) (stats_add(STATS_SYSCALLS, 1), (expr))
+
+// USDT probes for perf and bpftrace, in builds with IFADDRS_USDT
+#ifdef IFADDRS_USDT
+#include <sys/sdt.h>
+#define IFADDRS_PROBE(...) STAP_PROBEV(ifaddrs, __VA_ARGS__)
+#else
+#define IFADDRS_PROBE(...) \
+    do {                   \
+    } while (0)
+#endif
+
+// what the kernel has refused, learned by the calls as they go and kept for
+// the whole process so that later calls do not ask again
+#define BACKEND_NO_NETLINK 0x1
+#define BACKEND_NO_GETLINK 0x2
+#define BACKEND_NO_GETADDR 0x4
+#define BACKEND_NO_STRICT 0x8
+
+#ifndef NETLINK_GET_STRICT_CHK
+#define NETLINK_GET_STRICT_CHK 12
+#endif
+
+#define ARENA_ALIGN(n) \
+    (((n) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+#define ARENA_BLOCK_SIZE 16384
+// SIOCGIFCONF room for this many addresses before anything is known
+#define IFCONF_BUF_SIZE (32 * sizeof(struct ifreq))
+// /proc/net/if_inet6 is read in pieces of this size, a line is under 64 bytes
+#define IF_INET6_BUF_SIZE 4096
+
+// what an address needs from its link, direct mapped by ifindex, for when
+// there is no list of links to join with
+#define LINK_SLOTS 256
+
+struct link_slot {
+    int index;
+    unsigned int flags;
+    char name[IFNAMSIZ];
+};
+
+// what addresses take over from the extended record of their link
+#define IFADDRS_EX_LINK \
+    (IFADDRS_EX_MTU | IFADDRS_EX_OPERSTATE | IFADDRS_EX_KIND)
+
+static struct ifaddrs_arena *arena_create(void);
+static void arena_destroy(struct ifaddrs_arena *arena);
+#ifndef IFADDRS_USE_IOCTL
+static struct ifaddrs_arena *arena_create_in(void *buf, size_t size);
+#endif
+static void *arena_alloc(struct ifaddrs_arena *arena, size_t size);
+static struct ifaddrs_arena_mark arena_mark(struct ifaddrs_arena *arena);
+static void
+arena_rollback(struct ifaddrs_arena *arena, struct ifaddrs_arena_mark mark);
+
 #ifndef IFADDRS_USE_IOCTL
-static struct ifaddrs *getifaddrs_getlink(struct ifaddrs **ifap);
-static struct ifaddrs *getifaddrs_getaddr(struct ifaddrs **ifap, bool use_getlink_result);
-static void match_getaddr_with_getlink(struct ifaddrs *links, struct ifaddrs *addrs);
+struct netlink_session;
+
+// where requests go and replies come from. recv reports the full length of
+// the datagram even when it did not fit, like MSG_TRUNC, and honours MSG_PEEK
+struct netlink_transport {
+    ssize_t (*send)(struct netlink_session *nl, const struct nlmsghdr *req);
+    ssize_t (*recv)(
+        struct netlink_session *nl, void *buf, size_t len, int flags
+    );
+    void (*close)(struct netlink_session *nl);
+};
+
+#ifdef IFADDRS_REPLAY
+// recorded replies, see getifaddrs_replay()
+struct netlink_replay {
+    const struct nlmsghdr *links;
+    size_t links_len;
+    const struct nlmsghdr *addrs;
+    size_t addrs_len;
+    // rest of the dump being replied to
+    const struct nlmsghdr *pos;
+    size_t left;
+    uint32_t seq;
+};
+
+#define NETLINK_REPLAYING() (netlink_replay_current != NULL)
+#else
+#define NETLINK_REPLAYING() false
+#endif
+
+struct netlink_session {
+    const struct netlink_transport *transport;
+#ifdef IFADDRS_REPLAY
+    struct netlink_replay *replay;
 #endif
+    // -1 when not talking to the kernel
+    int fd;
+    // sequence number and type of the last request sent
+    uint32_t seq;
+    uint16_t request;
+    // reply to seq has not been read up to NLMSG_DONE yet
+    bool dumping;
+    // NETLINK_GET_STRICT_CHK is set on fd
+    bool strict;
+    // a send or receive failed, fd is not to be reused
+    bool broken;
+    struct nlmsghdr *buf;
+    size_t buf_size;
+    // false while buf belongs to the caller of netlink_open_with()
+    bool buf_owned;
+};
+
+typedef int (*netlink_dump_cb)(struct nlmsghdr *nlh, void *ctx);
+
+// a dump in progress, its replies are read one datagram at a time
+struct netlink_dump_state {
+    uint16_t type;
+    netlink_dump_cb cb;
+    void *ctx;
+    // NLM_F_DUMP_INTR was seen, the rest of the dump is only read
+    bool interrupted;
+    // value the callback stopped with
+    int stopped;
+};
+
+// open addressing table from ifindex to link entry, for the getaddr join
+struct link_index {
+    struct ifaddrs *links;
+    struct ifaddrs **slots;
+    size_t mask;
+};
+
+// the kernel sizes dump datagrams after the largest buffer it has seen
+// passed to recvmsg, up to 32k, unless a single message needs more
+#define NETLINK_BUF_SIZE 32768
+// notifications are not batched, the queue just has to absorb bursts
+#define CACHE_RCVBUF_SIZE (1024 * 1024)
+
+// getifaddrs_foreach() keeps all of its state on the stack
+#define FOREACH_ARENA_SIZE 2048
+#define FOREACH_BUF_SIZE 8192
+// a stats message is a few hundred bytes, one datagram holds dozens of links
+#define IFSTATS_BUF_SIZE 8192
+
+struct foreach_ctx {
+    // one entry at a time, rolled back to mark after the callback
+    struct ifaddrs_arena *arena;
+    struct ifaddrs_arena_mark mark;
+    getifaddrs_foreach_cb cb;
+    void *cb_ctx;
+    // value the callback stopped with
+    int stopped;
+    struct link_slot *links;
+    // for links that fell out of the table, -1 until first needed
+    int ioctl_sockfd;
+};
+
+#define LINK_INDEX_HASH(index) ((size_t)((uint32_t)(index) * 2654435761U))
+
+struct getlink_ctx {
+    struct ifaddrs_arena *arena;
+    const struct ifaddrs_filter *filter;
+    struct ifaddrs_list list;
+};
+
+struct getaddr_ctx {
+    struct ifaddrs_arena *arena;
+    const struct ifaddrs_filter *filter;
+    // result of the link dump, NULL if there is none
+    struct link_index *links;
+    // without one, links are asked for once each and kept in slots. The
+    // socket is -1 until first needed.
+    int ioctl_sockfd;
+    struct link_slot *slots;
+    struct ifaddrs_list list;
+};
+
+struct getlink_msg {
+    struct nlmsghdr hdr;
+    struct ifinfomsg ifi __attribute__((aligned(NLMSG_ALIGNTO)));
+    // room for filter attributes
+    char attrs[64] __attribute__((aligned(NLMSG_ALIGNTO)));
+};
 
-#endif
\ No newline at end of file
+struct getaddr_msg {
+    struct nlmsghdr hdr;
+    struct ifaddrmsg ifa __attribute__((aligned(NLMSG_ALIGNTO)));
+};
+
+struct getstats_msg {
+    struct nlmsghdr hdr;
+    struct if_stats_msg ifsm __attribute__((aligned(NLMSG_ALIGNTO)));
+};
+
+struct getstats_ctx {
+    struct ifaddrs_ifstats *stats;
+    size_t n;
+    // links seen, including the ones that did not fit
+    size_t count;
+    // instead of stats, the counters go into these links when they are set
+    struct link_index *links;
+};
+
+// doubles as the IFADDRS_PHASE_* being counted
+enum getifaddrs_async_phase {
+    ASYNC_GETLINK = IFADDRS_PHASE_GETLINK,
+    ASYNC_GETADDR = IFADDRS_PHASE_GETADDR,
+};
+
+// getifaddrs_filter() taken apart so that it never waits for the kernel
+struct getifaddrs_async {
+    struct netlink_session nl;
+    enum getifaddrs_async_phase phase;
+    // the request of the current phase went out, its reply is being read
+    bool sent;
+    struct netlink_dump_state dump;
+    // where to roll back to when the current phase has to start over
+    struct ifaddrs_arena_mark mark;
+    // same for the link dump, when the address dump takes it along
+    struct ifaddrs_arena_mark link_mark;
+    struct retry_state retry;
+    struct ifaddrs_arena *arena;
+    // same as arena when links are part of the result
+    struct ifaddrs_arena *link_arena;
+    bool want_links;
+    bool want_addrs;
+    // NULL, or points at filter_copy
+    const struct ifaddrs_filter *filter;
+    struct ifaddrs_filter filter_copy;
+    struct getlink_msg link_request;
+    struct getaddr_msg addr_request;
+    struct getlink_ctx lctx;
+    struct getaddr_ctx actx;
+    struct link_index idx;
+    // false once the link dump was refused, addresses then look their links
+    // up in slots
+    bool has_links;
+    struct link_slot *slots;
+};
+
+// identifies a link by its ifindex, and an address the way the kernel does
+// for RTM_DELADDR
+struct cache_key {
+    unsigned char family;
+    unsigned char prefixlen;
+    uint32_t index;
+    unsigned char addr[16];
+};
+
+struct cache_entry {
+    struct nlmsghdr *msg;
+    // worked out once when the entry is stored, lookups only compare these
+    struct cache_key key;
+};
+
+// copies of the netlink messages last seen for each link or address
+struct cache_table {
+    struct cache_entry *entries;
+    size_t len;
+    size_t cap;
+};
+
+// what the tables held after an update, for readers to build their lists
+// from without the lock. Never changed once published.
+struct cache_snapshot {
+    atomic_uint refs;
+    // sockets.generation and the subscribed socket at the time, for telling
+    // whether notifications are queued that the snapshot misses
+    unsigned int generation;
+    int fd;
+    size_t links;
+    size_t addrs;
+    // the links, then the addresses, copies of the messages follow the array
+    struct nlmsghdr *msgs[];
+};
+
+// readers of the published snapshot are counted like those of struct
+// ifaddrs_snapshots
+struct ifaddrs_cache {
+    pthread_mutex_t lock;
+    atomic_bool enabled;
+    // false until the tables have been filled by a full dump
+    bool valid;
+    // the tables differ from the published snapshot
+    bool changed;
+    // subscribed to link and address notifications
+    int fd;
+    // sockets.generation when fd was opened
+    unsigned int generation;
+    struct nlmsghdr *buf;
+    size_t buf_size;
+    struct cache_table links;
+    struct cache_table addrs;
+    _Atomic(struct cache_snapshot *) current;
+    atomic_uint epoch;
+    atomic_uint readers[2];
+    // updates between taking notifications off the socket and publishing
+    atomic_uint updating;
+};
+#endif
+
+static int getifaddrs_run(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter,
+    unsigned int opts
+);
+static int
+for_interface_run(struct ifaddrs **ifap, const char *name, int ifindex);
+static int foreach_run(getifaddrs_foreach_cb cb, void *ctx);
+static int getifstats_run(struct ifaddrs_ifstats *stats, size_t n);
+static int
+async_start(struct getifaddrs_async **op, const struct ifaddrs_filter *filter);
+static int async_step(struct getifaddrs_async *op, struct ifaddrs **ifap);
+static struct ifaddrs_internal *
+alloc_ifaddr(struct ifaddrs_arena *arena, size_t socklen, bool addr_only);
+static struct ifaddrs *getifaddrs_ioctl(
+    struct ifaddrs_arena *arena, struct ifaddrs **ifap, bool get_hwaddr
+);
+static int ioctl_ifconf(int sockfd, struct ifconf *ifc);
+static int ioctl_link(
+    struct ifaddrs_arena *arena, int sockfd, const char *name,
+    unsigned int flags, struct ifaddrs_internal **out
+);
+static int ioctl_inet6(
+    struct ifaddrs_arena *arena, int *sockfd, struct ifaddrs_list *list
+);
+static bool parse_if_inet6(
+    char *line, struct in6_addr *addr, int *index, unsigned int *prefixlen,
+    char **name
+);
+static struct link_slot *link_slot_lookup(
+    struct link_slot *slots, int *sockfd, int index, const char *label
+);
+static int foreach_list(getifaddrs_foreach_cb cb, void *ctx);
+static void stats_add(enum stats_counter counter, unsigned long long n);
+static struct stats_timer stats_enter(int phase);
+static void stats_leave(struct stats_timer timer);
+static void stats_call_begin(bool counted);
+static void stats_call_end(void);
+static size_t sockaddr_size(const struct sockaddr *sa);
+static struct ifaddrs_snapshot *snapshot_get(void);
+static struct ifaddrs_snapshot *snapshot_refresh(void);
+static uint64_t monotonic_ns(void);
+static struct owner_table *owner_table_build(const struct ifaddrs *list);
+static int owner_ifindex(const struct ifaddrs *ifa);
+static bool own_node(const struct ifaddrs *ifa);
+static bool owner_scoped(const struct owner_entry *e);
+static bool owner_seen(
+    const struct owner_entry *run, size_t n, const struct owner_entry *e
+);
+static unsigned int owner_prefixlen(const unsigned char *mask, size_t len);
+static int owner_cmp_addr(const void *a, const void *b);
+static int owner_cmp_prefix(const void *a, const void *b);
+static struct owner_table *
+owner_enter(struct ifaddrs_owner_index *index, unsigned int *epoch);
+static void owner_leave(struct ifaddrs_owner_index *index, unsigned int epoch);
+static bool owner_lookup4(
+    const struct owner_table *t, uint32_t addr, struct ifaddrs_owner *owner
+);
+static bool owner_lookup6(
+    const struct owner_table *t, const struct in6_addr *addr, uint32_t scope,
+    struct ifaddrs_owner *owner
+);
+static size_t owner_find4(
+    const struct owner_table *t, const uint32_t *v, size_t n, uint32_t x
+);
+static size_t
+owner_find6(const struct in6_addr *v, size_t n, const struct in6_addr *x);
+static size_t owner_pick6(
+    const struct in6_addr *v, const int *index, size_t n, size_t k,
+    uint32_t scope
+);
+static void
+owner_mask(unsigned char *net, const unsigned char *addr, unsigned int len);
+static void owner_group_add(
+    struct owner_group *groups, size_t *count, size_t pos, unsigned int len
+);
+#ifdef OWNER_X86
+static size_t owner_find4_sse2(const uint32_t *v, size_t n, uint32_t x);
+static size_t owner_find4_avx2(const uint32_t *v, size_t n, uint32_t x);
+static void owner_prefix4_avx2(
+    const struct owner_table *t, const uint32_t *addrs, uint32_t *pos
+);
+#endif
+static struct ifaddrs_shm *shm_map(int fd, bool owns_fd, bool writable);
+static const void *
+shm_at(const struct ifaddrs_shm *shm, uint32_t offset, size_t len);
+static void shm_put_sockaddr(
+    struct ifaddrs_shm_entry *e, unsigned int bit, unsigned int *dst,
+    const struct sockaddr *sa
+);
+static void shm_get_sockaddr(
+    const struct ifaddrs_shm_entry *e, unsigned int bit,
+    const unsigned int *src, struct sockaddr **dst
+);
+static void socket_cache_init(void);
+static void socket_cache_forked(void);
+static void socket_cache_exit(void *cache);
+static struct socket_cache *socket_cache_get(void);
+static void socket_cache_close(struct socket_cache *c);
+static int open_ioctl_socket(void);
+static void close_ioctl_socket(int fd);
+static bool filter_family(const struct ifaddrs_filter *filter, int family);
+static void filter_ioctl_result(
+    struct ifaddrs_list *list, const struct ifaddrs_filter *filter
+);
+#ifndef IFADDRS_USE_IOCTL
+static bool retry_next(struct retry_state *retry, bool wait);
+static unsigned int retry_flags(struct retry_state *retry);
+static int retry_stale(
+    struct ifaddrs **ifap, const struct ifaddrs_filter *filter, bool ex
+);
+static void retry_save(const struct ifaddrs *list);
+static int
+list_copy(const struct ifaddrs *list, struct ifaddrs **out, bool ex);
+static void backend_probe(void);
+static int backend_probe_cb(struct nlmsghdr *nlh, void *ctx);
+static unsigned int backend_bit(uint16_t type);
+static void
+backend_deny(struct netlink_session *nl, unsigned int bit, int err);
+static bool backend_is_denied(unsigned int bit);
+static int netlink_open(struct netlink_session *nl);
+static int netlink_open_with(
+    struct netlink_session *nl, void *buf, size_t size, bool reuse
+);
+static bool socket_cache_take(struct netlink_session *nl, size_t size);
+static bool socket_cache_put(struct netlink_session *nl);
+static void netlink_close(struct netlink_session *nl);
+static bool netlink_restart(
+    struct netlink_session *nl, const struct ifaddrs_filter *filter,
+    bool *opened
+);
+static int netlink_send(struct netlink_session *nl, struct nlmsghdr *req);
+static ssize_t netlink_recv(struct netlink_session *nl);
+static ssize_t netlink_recv_once(struct netlink_session *nl);
+static ssize_t netlink_recv_whole(struct netlink_session *nl);
+static int netlink_reserve(struct netlink_session *nl, size_t size);
+static ssize_t
+netlink_kernel_send(struct netlink_session *nl, const struct nlmsghdr *req);
+static ssize_t netlink_kernel_recv(
+    struct netlink_session *nl, void *buf, size_t len, int flags
+);
+static void netlink_kernel_close(struct netlink_session *nl);
+#ifdef IFADDRS_REPLAY
+static ssize_t
+netlink_replay_send(struct netlink_session *nl, const struct nlmsghdr *req);
+static ssize_t netlink_replay_recv(
+    struct netlink_session *nl, void *buf, size_t len, int flags
+);
+static void netlink_replay_close(struct netlink_session *nl);
+static size_t netlink_replay_split(const struct nlmsghdr *dump, size_t len);
+#endif
+static int netlink_drain(struct netlink_session *nl);
+static int netlink_dump(
+    struct netlink_session *nl, struct nlmsghdr *req, uint16_t type,
+    netlink_dump_cb cb, void *ctx
+);
+static int netlink_dump_step(
+    struct netlink_session *nl, struct netlink_dump_state *state
+);
+static int parse_newlink(
+    struct ifaddrs_arena *arena, struct nlmsghdr *nlh,
+    struct ifaddrs_internal **out
+);
+static int parse_newaddr(
+    struct ifaddrs_arena *arena, struct nlmsghdr *nlh,
+    struct ifaddrs_internal **out
+);
+static void parse_link_ex(struct ifaddrs_ex *ex, struct rtattr *rta);
+static void parse_addr_ex(struct ifaddrs_ex *ex, struct rtattr *rta);
+static bool parse_stats64(struct ifaddrs_ex_stats *out, struct rtattr *rta);
+static void netlink_strict(struct netlink_session *nl);
+static int getifaddrs_getlink(
+    struct ifaddrs_arena *arena, struct netlink_session *nl,
+    const struct ifaddrs_filter *filter, struct ifaddrs_list *out
+);
+static int getifaddrs_getaddr(
+    struct ifaddrs_arena *arena, struct netlink_session *nl,
+    const struct ifaddrs_filter *filter, struct link_index *links,
+    struct ifaddrs_list *out
+);
+static int getifaddrs_getone(
+    struct ifaddrs_arena *arena, struct netlink_session *nl, const char *name,
+    int ifindex, struct ifaddrs_list *out
+);
+static bool filter_has_link(const struct ifaddrs_filter *filter);
+static bool
+filter_link(const struct ifaddrs_filter *filter, struct nlmsghdr *nlh);
+static int link_index_build(struct link_index *idx, struct ifaddrs *links);
+static struct ifaddrs *link_index_find(struct link_index *idx, int index);
+static void link_index_free(struct link_index *idx);
+static void match_getaddr_with_link(struct ifaddrs *addr, struct ifaddrs *link);
+static void init_getlink_request(
+    struct getlink_msg *request, const struct ifaddrs_filter *filter
+);
+static void init_getlink_one_request(
+    struct getlink_msg *request, const char *name, int ifindex
+);
+static void getlink_skip_stats(struct getlink_msg *request);
+static void init_getaddr_request(
+    struct getaddr_msg *request, const struct ifaddrs_filter *filter
+);
+static int getlink_cb(struct nlmsghdr *nlh, void *ctx);
+static int getaddr_cb(struct nlmsghdr *nlh, void *ctx);
+static int foreach_link_cb(struct nlmsghdr *nlh, void *ctx);
+static int foreach_addr_cb(struct nlmsghdr *nlh, void *ctx);
+static void init_getstats_request(struct getstats_msg *request);
+static int getstats_cb(struct nlmsghdr *nlh, void *ctx);
+static int getstats_link_cb(struct nlmsghdr *nlh, void *ctx);
+static void
+getstats_put(struct getstats_ctx *c, int ifindex, struct rtattr *rta);
+static int getstats_dump(struct getstats_ctx *ctx);
+static void link_stats_put(struct ifaddrs *link, struct rtattr *rta);
+static int async_send(struct getifaddrs_async *op);
+static int async_without_links(struct getifaddrs_async *op);
+static int async_finish(struct getifaddrs_async *op, struct ifaddrs **ifap);
+static void async_free(struct getifaddrs_async *op);
+static int cache_open(void);
+static int cache_resync(void);
+static int cache_update(void);
+static int cache_receive(void);
+static int cache_apply(struct nlmsghdr *nlh);
+static void cache_reset(void);
+static struct cache_snapshot *cache_snapshot_build(void);
+static void cache_publish(struct cache_snapshot *snap);
+static struct cache_snapshot *cache_snapshot_get(void);
+static struct cache_snapshot *cache_snapshot_fresh(void);
+static void cache_snapshot_release(struct cache_snapshot *snap);
+static int getifaddrs_cached(
+    struct ifaddrs_arena *arena, struct ifaddrs_arena *link_arena,
+    const struct ifaddrs_filter *filter, struct ifaddrs_list *links,
+    struct ifaddrs_list *addrs
+);
+#endif
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef IFADDRS_NETLINK_DUMP_H
+#define IFADDRS_NETLINK_DUMP_H
+
+// replies the way the kernel sends them, built one message at a time: the
+// RTM_GETLINK dump up to its NLMSG_DONE, then the RTM_GETADDR one
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if_arp.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+struct test_dump {
+    // messages back to back, 4-byte aligned like netlink wants them
+    uint32_t data[16384];
+    size_t len;
+};
+
+static inline struct nlmsghdr *
+dump_begin(struct test_dump *d, uint16_t type, const void *body, size_t len) {
+    struct nlmsghdr *nlh = (struct nlmsghdr *)((char *)d->data + d->len);
+    memset(nlh, 0, NLMSG_SPACE(len));
+    nlh->nlmsg_len = NLMSG_LENGTH(len);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = NLM_F_MULTI;
+    memcpy(NLMSG_DATA(nlh), body, len);
+    return nlh;
+}
+
+static inline void dump_put(
+    struct nlmsghdr *nlh, unsigned short type, const void *data, size_t len
+) {
+    struct rtattr *rta =
+        (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    memset(rta, 0, RTA_SPACE(len));
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_SPACE(len);
+}
+
+static inline void dump_end(struct test_dump *d, struct nlmsghdr *nlh) {
+    d->len += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static inline void dump_done(struct test_dump *d) {
+    int error = 0;
+    dump_end(d, dump_begin(d, NLMSG_DONE, &error, sizeof(error)));
+}
+
+// an ethernet link whose counters are all index * 10
+static inline struct nlmsghdr *
+dump_link(struct test_dump *d, uint16_t type, int index, const char *name) {
+    struct ifinfomsg ifi = {0};
+    ifi.ifi_family = AF_UNSPEC;
+    ifi.ifi_type = ARPHRD_ETHER;
+    ifi.ifi_index = index;
+    ifi.ifi_flags = IFF_UP | IFF_BROADCAST | IFF_RUNNING | IFF_MULTICAST;
+    struct nlmsghdr *nlh = dump_begin(d, type, &ifi, sizeof(ifi));
+
+    dump_put(nlh, IFLA_IFNAME, name, strlen(name) + 1);
+    unsigned char mac[6] = {0x02, 0, 0, 0, 0, index};
+    dump_put(nlh, IFLA_ADDRESS, mac, sizeof(mac));
+    struct rtnl_link_stats64 stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.rx_packets = stats.tx_packets = index * 10;
+    stats.rx_bytes = stats.tx_bytes = index * 10;
+    dump_put(nlh, IFLA_STATS64, &stats, sizeof(stats));
+    dump_end(d, nlh);
+    return nlh;
+}
+
+// addr is a struct in_addr or struct in6_addr
+static inline struct nlmsghdr *dump_addr(
+    struct test_dump *d, uint16_t type, int family, int index,
+    const void *addr, unsigned int prefixlen
+) {
+    struct ifaddrmsg ifa = {0};
+    ifa.ifa_family = family;
+    ifa.ifa_prefixlen = prefixlen;
+    ifa.ifa_flags = IFA_F_PERMANENT;
+    ifa.ifa_index = index;
+    struct nlmsghdr *nlh = dump_begin(d, type, &ifa, sizeof(ifa));
+
+    size_t len = family == AF_INET ? 4 : 16;
+    dump_put(nlh, IFA_ADDRESS, addr, len);
+    if (family == AF_INET) {
+        dump_put(nlh, IFA_LOCAL, addr, len);
+    }
+    dump_end(d, nlh);
+    return nlh;
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef IFADDRS_TEST_H
+#define IFADDRS_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// a failed check is reported and the test goes on, main returns TEST_RESULT
+static int test_failures;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);         \
+            test_failures++;                                                   \
+        }                                                                      \
+    } while (0)
+
+#define TEST_RESULT (test_failures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+#endif
@@ -0,0 +1,61 @@
+// getifaddrs_async_step() on a kernel that refuses RTM_GETLINK: the same
+// addresses as getifaddrs_filter(), with their links looked up by ioctl
+#include <poll.h>
+
+#include "whitebox.h"
+
+// "<name>:<family>:<flags>" for each entry
+static void describe(struct ifaddrs *list, char *out, size_t size) {
+    out[0] = '\0';
+    size_t len = 0;
+    for (struct ifaddrs *ifa = list; ifa && len < size; ifa = ifa->ifa_next) {
+        len += snprintf(
+            out + len, size - len, "%s%s:%d:%x", len ? " " : "",
+            ifa->ifa_name, ifa->ifa_addr ? ifa->ifa_addr->sa_family : -1,
+            ifa->ifa_flags
+        );
+    }
+}
+
+static int run_async(
+    const struct ifaddrs_filter *filter, struct ifaddrs **ifap
+) {
+    struct getifaddrs_async *op;
+    int fd = getifaddrs_async_start(&op, filter);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret;
+    do {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        CHECK(poll(&pfd, 1, 5000) == 1);
+        ret = getifaddrs_async_step(op, ifap);
+    } while (ret == 1);
+    return ret;
+}
+
+int main(void) {
+    atomic_store(&backend_denied, BACKEND_NO_GETLINK);
+
+    struct ifaddrs *sync, *async;
+    CHECK(getifaddrs(&sync) == 0);
+    CHECK(run_async(NULL, &async) == 0);
+    static char want[16384], got[16384];
+    describe(sync, want, sizeof(want));
+    describe(async, got, sizeof(got));
+    if (strcmp(want, got) != 0) {
+        fprintf(stderr, "%s\n%s\n", want, got);
+        test_failures++;
+    }
+    CHECK(sync != NULL);
+    freeifaddrs(sync);
+    freeifaddrs(async);
+
+    // nothing but links asked for, and those refused
+    struct ifaddrs_filter links = {IFADDRS_FAMILY_PACKET, 0, 0, 0};
+    async = (struct ifaddrs *)&links;
+    CHECK(run_async(&links, &async) == 0 && async == NULL);
+
+    atomic_store(&backend_denied, 0);
+    return TEST_RESULT;
+}
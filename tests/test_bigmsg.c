@@ -0,0 +1,63 @@
+// a link message bigger than any receive buffer so far: its datagram is lost,
+// and getifaddrs() starts over on a new session with a buffer that fits
+// instead of going on without links
+#include "whitebox.h"
+
+static struct test_dump d;
+
+// "<name>:<family>" for each entry
+static void describe(struct ifaddrs *list, char *out, size_t size) {
+    out[0] = '\0';
+    size_t len = 0;
+    for (struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        len += snprintf(
+            out + len, size - len, "%s%s:%d", len ? " " : "", ifa->ifa_name,
+            ifa->ifa_addr ? ifa->ifa_addr->sa_family : -1
+        );
+    }
+}
+
+int main(void) {
+    dump_link(&d, RTM_NEWLINK, 1, "eth1");
+    struct nlmsghdr *nlh = dump_link(&d, RTM_NEWLINK, 2, "eth2");
+    // an attribute nobody parses, the way a long IFLA_AF_SPEC or VF list
+    // makes a message big
+    d.len -= NLMSG_ALIGN(nlh->nlmsg_len);
+    static char filler[NETLINK_BUF_SIZE + 1024];
+    dump_put(nlh, IFLA_UNSPEC, filler, sizeof(filler));
+    dump_end(&d, nlh);
+    CHECK(nlh->nlmsg_len > NETLINK_BUF_SIZE);
+    dump_done(&d);
+    for (int i = 1; i <= 2; i++) {
+        struct in_addr in = {htonl(0x0a000000 | i)};
+        dump_addr(&d, RTM_NEWADDR, AF_INET, i, &in, 24);
+    }
+    dump_done(&d);
+
+    CHECK(atomic_load(&netlink_buf_hint) < nlh->nlmsg_len);
+    struct ifaddrs *list = NULL;
+    CHECK(getifaddrs_replay(&list, NULL, d.data, d.len) == 0);
+    char state[256];
+    describe(list, state, sizeof(state));
+    if (strcmp(state, "eth1:17 eth2:17 eth1:2 eth2:2") != 0) {
+        fprintf(stderr, "%s\n", state);
+        test_failures++;
+    }
+    freeifaddrs(list);
+    CHECK(atomic_load(&netlink_buf_hint) >= nlh->nlmsg_len);
+
+    // a session that lost part of a dump refuses the next one instead of
+    // waiting for an NLMSG_DONE that may never come
+    struct netlink_replay replay;
+    replay_start(&replay, &d);
+    struct netlink_session nl;
+    CHECK(netlink_open(&nl) == 0);
+    nl.broken = true;
+    nl.dumping = true;
+    struct getlink_msg request;
+    init_getlink_request(&request, NULL);
+    CHECK(netlink_send(&nl, &request.hdr) == -1 && errno == EPIPE);
+    netlink_close(&nl);
+    replay_stop();
+    return TEST_RESULT;
+}
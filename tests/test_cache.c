@@ -0,0 +1,144 @@
+// the notification cache patched by RTM_DELLINK, and starting over from a
+// full dump once notifications were dropped or did not fit. Notifications
+// come from a socketpair standing in for the subscribed netlink socket.
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+// the kernel reports dropped notifications as ENOBUFS, which a socketpair
+// never does
+static bool drop_next;
+
+static ssize_t test_recvmsg(int fd, struct msghdr *msg, int flags) {
+    if (drop_next) {
+        drop_next = false;
+        errno = ENOBUFS;
+        return -1;
+    }
+    return recvmsg(fd, msg, flags);
+}
+
+#define recvmsg test_recvmsg
+#include "whitebox.h"
+#undef recvmsg
+
+static struct test_dump a, b, big;
+
+// "<name>:<family>" for each entry of what getifaddrs() gives now
+static void describe(char *out, size_t size) {
+    out[0] = '\0';
+    struct ifaddrs *list;
+    CHECK(getifaddrs(&list) == 0);
+    size_t len = 0;
+    for (struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        // links keep their counters, from a dump of their own
+        CHECK(ifa->ifa_addr->sa_family != AF_PACKET || ifa->ifa_data);
+        len += snprintf(
+            out + len, size - len, "%s%s:%d", len ? " " : "", ifa->ifa_name,
+            ifa->ifa_addr ? ifa->ifa_addr->sa_family : -1
+        );
+    }
+    freeifaddrs(list);
+}
+
+#define CHECK_STATE(expected)                                                  \
+    do {                                                                       \
+        char state[512];                                                       \
+        describe(state, sizeof(state));                                        \
+        if (strcmp(state, expected) != 0) {                                    \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, state);         \
+            test_failures++;                                                   \
+        }                                                                      \
+    } while (0)
+
+// what the cache does with the notifications queued so far, with full dumps
+// coming from d
+static void update(const struct test_dump *d) {
+    struct netlink_replay replay;
+    replay_start(&replay, d);
+    pthread_mutex_lock(&cache.lock);
+    CHECK(cache_update() == 0);
+    pthread_mutex_unlock(&cache.lock);
+    replay_stop();
+}
+
+static void notify(int fd, const struct test_dump *d) {
+    CHECK(send(fd, d->data, d->len, 0) == (ssize_t)d->len);
+}
+
+int main(void) {
+    // eth1 to eth3 with an ipv4 address each, and an ipv6 one on eth3
+    char name[IFNAMSIZ];
+    for (int i = 1; i <= 3; i++) {
+        snprintf(name, sizeof(name), "eth%d", i);
+        dump_link(&a, RTM_NEWLINK, i, name);
+    }
+    dump_done(&a);
+    for (int i = 1; i <= 3; i++) {
+        struct in_addr in = {htonl(0x0a000000 | i)};
+        dump_addr(&a, RTM_NEWADDR, AF_INET, i, &in, 24);
+    }
+    struct in6_addr in6 = {{{0x20, 0x01, 0x0d, 0xb8, [15] = 3}}};
+    dump_addr(&a, RTM_NEWADDR, AF_INET6, 3, &in6, 64);
+    dump_done(&a);
+
+    // eth1 and eth4 with an ipv4 address each
+    dump_link(&b, RTM_NEWLINK, 1, "eth1");
+    dump_link(&b, RTM_NEWLINK, 4, "eth4");
+    dump_done(&b);
+    struct in_addr in = {htonl(0x0a000001)};
+    dump_addr(&b, RTM_NEWADDR, AF_INET, 1, &in, 24);
+    in.s_addr = htonl(0x0a000004);
+    dump_addr(&b, RTM_NEWADDR, AF_INET, 4, &in, 24);
+    dump_done(&b);
+
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, sv) == 0);
+    pthread_once(&sockets.once, socket_cache_init);
+    cache.fd = sv[0];
+    cache.generation = atomic_load(&sockets.generation);
+    cache.buf_size = NETLINK_BUF_SIZE;
+    cache.buf = malloc(cache.buf_size);
+    CHECK(cache.buf != NULL);
+    update(&a);
+    atomic_store(&cache.enabled, true);
+    CHECK_STATE("eth1:17 eth2:17 eth3:17 eth1:2 eth2:2 eth3:2 eth3:10");
+
+    // with nothing queued, the published tables are current and a call does
+    // not need the lock
+    struct cache_snapshot *snap = cache_snapshot_fresh();
+    CHECK(snap != NULL && snap->links == 3 && snap->addrs == 4);
+    cache_snapshot_release(snap);
+
+    // a link going away takes its addresses along, without a notification
+    // for each
+    struct test_dump del = {0};
+    dump_link(&del, RTM_DELLINK, 3, "eth3");
+    notify(sv[1], &del);
+    CHECK(cache_snapshot_fresh() == NULL);
+    CHECK_STATE("eth1:17 eth2:17 eth1:2 eth2:2");
+
+    // nothing queued, nothing dumped
+    update(&b);
+    CHECK_STATE("eth1:17 eth2:17 eth1:2 eth2:2");
+
+    // dropped notifications leave only a full dump to trust
+    drop_next = true;
+    update(&b);
+    CHECK(!drop_next);
+    CHECK_STATE("eth1:17 eth4:17 eth1:2 eth4:2");
+
+    // so does one bigger than the buffer, which then grows to fit the next
+    for (int i = 0; big.len <= NETLINK_BUF_SIZE; i++) {
+        in.s_addr = htonl(0x0a010000 | i);
+        dump_addr(&big, RTM_NEWADDR, AF_INET, 1, &in, 32);
+    }
+    notify(sv[1], &big);
+    update(&a);
+    CHECK(cache.buf_size >= big.len);
+    CHECK_STATE("eth1:17 eth2:17 eth3:17 eth1:2 eth2:2 eth3:2 eth3:10");
+
+    getifaddrs_cache_disable();
+    close(sv[1]);
+    return TEST_RESULT;
+}
@@ -0,0 +1,95 @@
+// getifaddrs_foreach() stopped early by its callback, with the socket cache
+// on: the rest of the dump must not be left queued on the cached socket for
+// the next call on the thread to read as its own
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <ifaddrs.h>
+#include <net/if.h>
+
+#include "test.h"
+
+#define MAX_ENTRIES 256
+
+struct entry {
+    char name[IFNAMSIZ];
+    int family;
+};
+
+struct walk {
+    struct entry entries[MAX_ENTRIES];
+    int count;
+    int stop_after;
+};
+
+static int walk_cb(const struct ifaddrs *ifa, void *ctx) {
+    struct walk *w = ctx;
+    CHECK(ifa->ifa_next == NULL);
+    if (w->count < MAX_ENTRIES) {
+        struct entry *e = &w->entries[w->count];
+        strncpy(e->name, ifa->ifa_name, sizeof(e->name) - 1);
+        e->family = ifa->ifa_addr ? ifa->ifa_addr->sa_family : -1;
+    }
+    w->count++;
+    return w->count == w->stop_after ? 42 : 0;
+}
+
+static struct entry baseline[MAX_ENTRIES];
+static int baseline_count;
+
+static int list_entries(struct entry *entries) {
+    struct ifaddrs *list;
+    CHECK(getifaddrs(&list) == 0);
+    int n = 0;
+    for (struct ifaddrs *ifa = list; ifa && n < MAX_ENTRIES;
+         ifa = ifa->ifa_next) {
+        memset(&entries[n], 0, sizeof(entries[n]));
+        strncpy(entries[n].name, ifa->ifa_name, sizeof(entries[n].name) - 1);
+        entries[n++].family = ifa->ifa_addr ? ifa->ifa_addr->sa_family : -1;
+    }
+    freeifaddrs(list);
+    return n;
+}
+
+// each on a new thread, so that the walk is the first to use the cached
+// socket and getifaddrs() inherits what it left behind
+static void *stop_then_list(void *arg) {
+    struct walk *w = arg;
+    CHECK(getifaddrs_foreach(walk_cb, w) == (w->stop_after ? 42 : 0));
+    int seen = w->stop_after ? w->stop_after : baseline_count;
+    CHECK(w->count == seen);
+    CHECK(memcmp(w->entries, baseline, seen * sizeof(baseline[0])) == 0);
+
+    static struct entry after[MAX_ENTRIES];
+    memset(after, 0, sizeof(after));
+    CHECK(list_entries(after) == baseline_count);
+    CHECK(memcmp(after, baseline, baseline_count * sizeof(after[0])) == 0);
+    return NULL;
+}
+
+int main(void) {
+    ifaddrs_socket_cache_enable(1);
+    baseline_count = list_entries(baseline);
+    CHECK(baseline_count > 0);
+
+    // the full walk sees what getifaddrs() does
+    static struct walk w;
+    CHECK(getifaddrs_foreach(walk_cb, &w) == 0);
+    CHECK(w.count == baseline_count);
+    CHECK(
+        memcmp(w.entries, baseline, baseline_count * sizeof(baseline[0])) == 0
+    );
+
+    // stopped after k entries, in the link dump and in the address dump
+    for (int k = 0; k <= baseline_count; k++) {
+        memset(&w, 0, sizeof(w));
+        w.stop_after = k;
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, stop_then_list, &w) == 0);
+        pthread_join(thread, NULL);
+    }
+
+    ifaddrs_socket_cache_enable(0);
+    return TEST_RESULT;
+}
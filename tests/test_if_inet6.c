@@ -0,0 +1,68 @@
+// lines of /proc/net/if_inet6 as the ioctl backend reads them
+#include "whitebox.h"
+
+static bool parse(
+    const char *text, struct in6_addr *addr, int *index,
+    unsigned int *prefixlen, char *name
+) {
+    char line[128];
+    snprintf(line, sizeof(line), "%s", text);
+    char *p;
+    if (!parse_if_inet6(line, addr, index, prefixlen, &p)) {
+        return false;
+    }
+    snprintf(name, IFNAMSIZ, "%s", p);
+    return true;
+}
+
+static bool valid(const char *text) {
+    struct in6_addr addr;
+    int index;
+    unsigned int prefixlen;
+    char name[IFNAMSIZ];
+    return parse(text, &addr, &index, &prefixlen, name);
+}
+
+int main(void) {
+    struct in6_addr addr;
+    int index;
+    unsigned int prefixlen;
+    char name[IFNAMSIZ];
+    CHECK(parse(
+        "fe800000000000000000000000000001 02 40 20 80     eth0", &addr,
+        &index, &prefixlen, name
+    ));
+    const struct in6_addr ll = {{{0xfe, 0x80, [15] = 1}}};
+    CHECK(memcmp(&addr, &ll, sizeof(addr)) == 0);
+    CHECK(index == 2);
+    CHECK(prefixlen == 64);
+    CHECK(strcmp(name, "eth0") == 0);
+
+    // the widest of each field
+    CHECK(parse(
+        "20010db8000000000000000000abcdef 7fffffff 80 00 00 abcdefghijklmno",
+        &addr, &index, &prefixlen, name
+    ));
+    CHECK(addr.s6_addr[13] == 0xab && addr.s6_addr[15] == 0xef);
+    CHECK(index == 0x7fffffff);
+    CHECK(prefixlen == 128);
+    CHECK(strcmp(name, "abcdefghijklmno") == 0);
+
+    CHECK(!valid(""));
+    CHECK(!valid("fe80000000000000000000000000001 02 40 20 80 eth0"));
+    CHECK(!valid("fe80000000000000000000000000000g 02 40 20 80 eth0"));
+    CHECK(!valid("FE800000000000000000000000000001 02 40 20 80 eth0"));
+    CHECK(!valid("fe800000000000000000000000000001 00 40 20 80 eth0"));
+    CHECK(
+        !valid("fe800000000000000000000000000001 80000000 40 20 80 eth0")
+    );
+    CHECK(!valid("fe800000000000000000000000000001 02 81 20 80 eth0"));
+    CHECK(!valid("fe800000000000000000000000000001 02 40 20 wlan0"));
+    CHECK(!valid("fe800000000000000000000000000001 02 40"));
+    CHECK(!valid("fe800000000000000000000000000001 02 40 20 80"));
+    CHECK(!valid("fe800000000000000000000000000001 02 40 20 80     "));
+    CHECK(!valid(
+        "fe800000000000000000000000000001 02 40 20 80 abcdefghijklmnop"
+    ));
+    return TEST_RESULT;
+}
@@ -0,0 +1,44 @@
+// getifstats() with room for fewer links than there are, from links that
+// carry their counters the way kernels before RTM_GETSTATS send them
+#include "whitebox.h"
+
+#define LINKS 5
+
+int main(void) {
+    static struct test_dump d;
+    char name[IFNAMSIZ];
+    for (int i = 1; i <= LINKS; i++) {
+        snprintf(name, sizeof(name), "eth%d", i);
+        dump_link(&d, RTM_NEWLINK, i, name);
+    }
+    dump_done(&d);
+    dump_done(&d);
+    struct netlink_replay replay;
+    replay_start(&replay, &d);
+
+    // a short array is filled, the rest counted, nothing past it written
+    struct ifaddrs_ifstats stats[LINKS + 3];
+    memset(stats, 0xff, sizeof(stats));
+    CHECK(getifstats(stats, 2) == LINKS);
+    for (int i = 0; i < 2; i++) {
+        CHECK(stats[i].ifindex == i + 1);
+        CHECK(stats[i].stats64.rx_packets == (i + 1) * 10ULL);
+        CHECK(stats[i].stats64.tx_bytes == (i + 1) * 10ULL);
+        CHECK(stats[i].stats64.rx_errors == 0);
+    }
+    CHECK(stats[2].ifindex == -1);
+
+    // asking how many there are
+    CHECK(getifstats(NULL, 0) == LINKS);
+
+    CHECK(getifstats(stats, LINKS) == LINKS);
+    CHECK(stats[LINKS - 1].ifindex == LINKS);
+    memset(stats, 0xff, sizeof(stats));
+    CHECK(getifstats(stats, LINKS + 3) == LINKS);
+    CHECK(stats[LINKS - 1].stats64.rx_packets == LINKS * 10ULL);
+    CHECK(stats[LINKS].ifindex == -1);
+
+    CHECK(getifstats(NULL, 1) == -1 && errno == EFAULT);
+    replay_stop();
+    return TEST_RESULT;
+}
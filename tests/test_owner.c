@@ -0,0 +1,339 @@
+// ifaddrs_lookup_owner() and the batch version against a walk of the list,
+// for addresses on both sides of every prefix boundary, through each of the
+// kernels the CPU has
+#include <arpa/inet.h>
+
+#include "whitebox.h"
+
+static const char *const names[] = {"lo", "a0", "b0", "c0"};
+
+static const struct {
+    const char *addr;
+    unsigned int prefixlen;
+    int index;
+} addrs4[] = {
+    {"127.0.0.1", 8, 1},     {"10.0.0.1", 8, 2},       {"10.1.0.1", 16, 3},
+    {"10.1.2.1", 24, 4},     {"10.1.2.129", 25, 2},    {"10.1.2.200", 32, 3},
+    {"192.168.0.1", 31, 4},  {"192.168.0.7", 30, 2},   {"172.16.0.1", 12, 3},
+    {"100.64.0.1", 10, 4},   {"198.51.100.1", 28, 2},  {"1.2.3.4", 0, 1},
+    // the same network again belongs to the first interface with it
+    {"10.1.2.2", 24, 2},
+},
+  addrs6[] = {
+      {"::1", 128, 1},
+      {"2001:db8::1", 64, 2},
+      {"2001:db8::8000:0:0:1", 65, 3},
+      {"2001:db8::ffff:ffff:ffff:fffe", 127, 4},
+      {"2001:db8:1::1", 48, 3},
+      {"fe80::2", 64, 2},
+      {"fe80::3", 64, 3},
+  };
+
+#define COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static struct ifaddrs *build_list(void) {
+    static struct test_dump d;
+    d.len = 0;
+    for (size_t i = 0; i < COUNT(names); i++) {
+        dump_link(&d, RTM_NEWLINK, i + 1, names[i]);
+    }
+    dump_done(&d);
+    for (size_t i = 0; i < COUNT(addrs4); i++) {
+        struct in_addr in;
+        inet_pton(AF_INET, addrs4[i].addr, &in);
+        dump_addr(
+            &d, RTM_NEWADDR, AF_INET, addrs4[i].index, &in,
+            addrs4[i].prefixlen
+        );
+    }
+    for (size_t i = 0; i < COUNT(addrs6); i++) {
+        struct in6_addr in6;
+        inet_pton(AF_INET6, addrs6[i].addr, &in6);
+        dump_addr(
+            &d, RTM_NEWADDR, AF_INET6, addrs6[i].index, &in6,
+            addrs6[i].prefixlen
+        );
+    }
+    dump_done(&d);
+
+    struct ifaddrs *list = NULL;
+    CHECK(getifaddrs_replay(&list, NULL, d.data, d.len) == 0);
+    return list;
+}
+
+static int index_of(const char *name) {
+    for (size_t i = 0; i < COUNT(names); i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// what a lookup has to come up with, by going through every entry
+static int reference(
+    const struct ifaddrs *list, int family, const unsigned char *addr,
+    struct ifaddrs_owner *owner
+) {
+    size_t len = family == AF_INET ? 4 : 16;
+    memset(owner, 0, sizeof(*owner));
+    int best = -1;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family) {
+            continue;
+        }
+        const unsigned char *a, *m;
+        if (family == AF_INET) {
+            a = (const void *)&((struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            m = (const void *)&((struct sockaddr_in *)ifa->ifa_netmask)
+                    ->sin_addr;
+        } else {
+            a = (const void *)&((struct sockaddr_in6 *)ifa->ifa_addr)
+                    ->sin6_addr;
+            m = (const void *)&((struct sockaddr_in6 *)ifa->ifa_netmask)
+                    ->sin6_addr;
+        }
+        if (!owner->ifindex && memcmp(a, addr, len) == 0) {
+            owner->ifindex = index_of(ifa->ifa_name);
+        }
+        bool match = true;
+        int prefixlen = 0;
+        for (size_t i = 0; i < len; i++) {
+            match = match && (a[i] & m[i]) == (addr[i] & m[i]);
+            prefixlen += __builtin_popcount(m[i]);
+        }
+        if (match && prefixlen > best) {
+            best = prefixlen;
+            owner->prefix_ifindex = index_of(ifa->ifa_name);
+            owner->prefixlen = prefixlen;
+        }
+    }
+    return owner->ifindex != 0;
+}
+
+// every address, its neighbours and the first and last address of every
+// prefix and theirs
+static size_t queries4(const struct ifaddrs *list, struct in_addr *out) {
+    size_t n = 0;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET) {
+            continue;
+        }
+        uint32_t addr = ntohl(
+            ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr
+        );
+        uint32_t mask = ntohl(
+            ((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr.s_addr
+        );
+        uint32_t around[] = {addr, addr & mask, addr | ~mask};
+        for (size_t i = 0; i < COUNT(around); i++) {
+            for (int delta = -1; delta <= 1; delta++) {
+                out[n++].s_addr = htonl(around[i] + delta);
+            }
+        }
+    }
+    return n;
+}
+
+static size_t queries6(const struct ifaddrs *list, struct in6_addr *out) {
+    size_t n = 0;
+    for (const struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET6) {
+            continue;
+        }
+        struct in6_addr addr =
+            ((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+        struct in6_addr mask =
+            ((struct sockaddr_in6 *)ifa->ifa_netmask)->sin6_addr;
+        struct in6_addr first = addr, last = addr;
+        for (size_t i = 0; i < 16; i++) {
+            first.s6_addr[i] &= mask.s6_addr[i];
+            last.s6_addr[i] |= ~mask.s6_addr[i];
+        }
+        struct in6_addr around[] = {addr, first, last};
+        for (size_t i = 0; i < COUNT(around); i++) {
+            for (int delta = -1; delta <= 1; delta++) {
+                // with the carry, so that ...:ffff + 1 leaves the prefix
+                struct in6_addr q = around[i];
+                for (int j = 15; j >= 0; j--) {
+                    unsigned int byte = q.s6_addr[j] + delta;
+                    q.s6_addr[j] = byte;
+                    if (delta == 0 || byte <= 0xff) {
+                        break;
+                    }
+                }
+                out[n++] = q;
+            }
+        }
+    }
+    return n;
+}
+
+static void check_all(struct ifaddrs_owner_index *index, struct ifaddrs *list) {
+    static struct in_addr q4[256];
+    static struct in6_addr q6[256];
+    static struct ifaddrs_owner batch[256];
+    size_t n4 = queries4(list, q4), n6 = queries6(list, q6);
+
+    int found = ifaddrs_lookup_owner_batch(index, AF_INET, q4, n4, batch);
+    int expected = 0;
+    for (size_t i = 0; i < n4; i++) {
+        struct ifaddrs_owner want, got;
+        expected += reference(list, AF_INET, (void *)&q4[i], &want);
+        struct sockaddr_in sin = {0};
+        sin.sin_family = AF_INET;
+        sin.sin_addr = q4[i];
+        CHECK(
+            ifaddrs_lookup_owner(index, (struct sockaddr *)&sin, &got) ==
+            (want.ifindex != 0)
+        );
+        CHECK(memcmp(&got, &want, sizeof(want)) == 0);
+        CHECK(memcmp(&batch[i], &want, sizeof(want)) == 0);
+    }
+    CHECK(found == expected);
+
+    found = ifaddrs_lookup_owner_batch(index, AF_INET6, q6, n6, batch);
+    expected = 0;
+    for (size_t i = 0; i < n6; i++) {
+        struct ifaddrs_owner want, got;
+        expected += reference(list, AF_INET6, (void *)&q6[i], &want);
+        struct sockaddr_in6 sin6 = {0};
+        sin6.sin6_family = AF_INET6;
+        sin6.sin6_addr = q6[i];
+        CHECK(
+            ifaddrs_lookup_owner(index, (struct sockaddr *)&sin6, &got) ==
+            (want.ifindex != 0)
+        );
+        CHECK(memcmp(&got, &want, sizeof(want)) == 0);
+        CHECK(memcmp(&batch[i], &want, sizeof(want)) == 0);
+    }
+    CHECK(found == expected);
+}
+
+static void check_one(
+    struct ifaddrs_owner_index *index, int family, const char *addr,
+    int ifindex, int prefix_ifindex, unsigned int prefixlen
+) {
+    struct sockaddr_storage ss = {0};
+    ss.ss_family = family;
+    if (family == AF_INET) {
+        inet_pton(family, addr, &((struct sockaddr_in *)&ss)->sin_addr);
+    } else {
+        inet_pton(family, addr, &((struct sockaddr_in6 *)&ss)->sin6_addr);
+    }
+    struct ifaddrs_owner owner;
+    int ret = ifaddrs_lookup_owner(index, (struct sockaddr *)&ss, &owner);
+    if (ret != (ifindex != 0) || owner.ifindex != ifindex ||
+        owner.prefix_ifindex != prefix_ifindex ||
+        owner.prefixlen != prefixlen) {
+        fprintf(
+            stderr, "%s: %d %d/%d/%u\n", addr, ret, owner.ifindex,
+            owner.prefix_ifindex, owner.prefixlen
+        );
+        test_failures++;
+    }
+}
+
+static void check_scoped(
+    struct ifaddrs_owner_index *index, const char *addr, uint32_t scope,
+    int ifindex, int prefix_ifindex
+) {
+    struct sockaddr_in6 sin6 = {0};
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_scope_id = scope;
+    inet_pton(AF_INET6, addr, &sin6.sin6_addr);
+    struct ifaddrs_owner owner;
+    int ret = ifaddrs_lookup_owner(index, (struct sockaddr *)&sin6, &owner);
+    if (ret != (ifindex != 0) || owner.ifindex != ifindex ||
+        owner.prefix_ifindex != prefix_ifindex) {
+        fprintf(
+            stderr, "%s%%%u: %d %d/%d\n", addr, scope, ret, owner.ifindex,
+            owner.prefix_ifindex
+        );
+        test_failures++;
+    }
+}
+
+// a node of the C library, which knows nothing of the ifindex
+struct foreign_node {
+    struct ifaddrs ifa;
+    struct sockaddr_in addr;
+    struct sockaddr_in netmask;
+    char name[IFNAMSIZ];
+};
+
+static void check_foreign(void) {
+    static struct foreign_node node;
+    node.ifa.ifa_name = node.name;
+    node.ifa.ifa_addr = (struct sockaddr *)&node.addr;
+    node.ifa.ifa_netmask = (struct sockaddr *)&node.netmask;
+    strcpy(node.name, "lo");
+    node.addr.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &node.addr.sin_addr);
+    node.netmask.sin_family = AF_INET;
+    node.netmask.sin_addr.s_addr = htonl(0xff000000);
+
+    struct ifaddrs_owner_index *index = ifaddrs_owner_index_create(&node.ifa);
+    CHECK(index != NULL);
+    if (!index) {
+        return;
+    }
+    int ifindex = if_nametoindex("lo");
+    check_one(index, AF_INET, "127.0.0.1", ifindex, ifindex, 8);
+    ifaddrs_owner_index_destroy(index);
+}
+
+int main(void) {
+    check_foreign();
+
+    struct ifaddrs *list = build_list();
+    struct ifaddrs_owner_index *index = ifaddrs_owner_index_create(list);
+    CHECK(index != NULL);
+    if (!list || !index) {
+        return TEST_RESULT;
+    }
+    // more prefixes than one window, or the batch kernel is not used
+    struct owner_table *t = atomic_load(&index->current);
+    CHECK(t->p4 > OWNER_WINDOW);
+
+    // spelled out, in case the reference walk shares a mistake
+    check_one(index, AF_INET, "10.1.2.200", 3, 3, 32);
+    check_one(index, AF_INET, "10.1.2.128", 0, 2, 25);
+    check_one(index, AF_INET, "10.1.2.127", 0, 4, 24);
+    check_one(index, AF_INET, "10.1.3.0", 0, 3, 16);
+    check_one(index, AF_INET, "10.255.255.255", 0, 2, 8);
+    check_one(index, AF_INET, "11.0.0.0", 0, 1, 0);
+    check_one(index, AF_INET, "192.168.0.0", 0, 4, 31);
+    check_one(index, AF_INET, "192.168.0.3", 0, 1, 0);
+    check_one(index, AF_INET, "192.168.0.4", 0, 2, 30);
+    check_one(index, AF_INET6, "2001:db8::7fff:ffff:ffff:ffff", 0, 2, 64);
+    check_one(index, AF_INET6, "2001:db8::8000:0:0:0", 0, 3, 65);
+    check_one(index, AF_INET6, "2001:db8::ffff:ffff:ffff:fffd", 0, 3, 65);
+    check_one(index, AF_INET6, "2001:db8::ffff:ffff:ffff:ffff", 0, 4, 127);
+    check_one(index, AF_INET6, "2001:db8:1:ffff::", 0, 3, 48);
+    check_one(index, AF_INET6, "fe80::3", 3, 2, 64);
+    check_one(index, AF_INET6, "2001:db9::", 0, 0, 0);
+
+    // with a scope, only what is on that link
+    check_scoped(index, "fe80::2", 2, 2, 2);
+    check_scoped(index, "fe80::2", 3, 0, 3);
+    check_scoped(index, "fe80::3", 3, 3, 3);
+    check_scoped(index, "fe80::3", 4, 0, 0);
+
+#ifdef OWNER_X86
+    if (t->avx2) {
+        check_all(index, list);
+        t->avx2 = false;
+    }
+#endif
+    check_all(index, list);
+
+    // what is left after a refresh to nothing
+    CHECK(ifaddrs_owner_index_refresh(index, NULL) == 0);
+    check_one(index, AF_INET, "10.1.2.200", 0, 0, 0);
+    check_one(index, AF_INET6, "::1", 0, 0, 0);
+
+    ifaddrs_owner_index_destroy(index);
+    freeifaddrs(list);
+    return TEST_RESULT;
+}
@@ -0,0 +1,165 @@
+// the seqlock of a shared mapping as a reader sees it while the writer
+// publishes, and the reader not leaving the mapping however the offsets in
+// it are corrupted
+#include "whitebox.h"
+
+// links 1 to links, each with an ipv4 address
+static struct ifaddrs *make_list(int links) {
+    static struct test_dump d;
+    d.len = 0;
+    char name[IFNAMSIZ];
+    for (int i = 1; i <= links; i++) {
+        snprintf(name, sizeof(name), "eth%d", i);
+        dump_link(&d, RTM_NEWLINK, i, name);
+    }
+    dump_done(&d);
+    for (int i = 1; i <= links; i++) {
+        struct in_addr in = {htonl(0x0a000000 | i)};
+        dump_addr(&d, RTM_NEWADDR, AF_INET, i, &in, 24);
+    }
+    dump_done(&d);
+
+    struct ifaddrs *list = NULL;
+    CHECK(getifaddrs_replay(&list, NULL, d.data, d.len) == 0);
+    return list;
+}
+
+static int count_entries(const struct ifaddrs_shm *shm, unsigned int seq) {
+    int n = 0;
+    for (const struct ifaddrs_shm_entry *e = ifaddrs_shm_first(shm, seq); e;
+         e = ifaddrs_shm_next(shm, e)) {
+        n++;
+    }
+    return n;
+}
+
+static int count_list(const struct ifaddrs_shm *shm) {
+    struct ifaddrs *list;
+    CHECK(ifaddrs_shm_to_list(shm, &list) == 0);
+    int n = 0;
+    for (struct ifaddrs *ifa = list; ifa; ifa = ifa->ifa_next) {
+        n++;
+    }
+    freeifaddrs(list);
+    return n;
+}
+
+static void check_seqlock(struct ifaddrs_shm *shm) {
+    struct ifaddrs *a = make_list(2), *b = make_list(3), *c = make_list(4);
+
+    CHECK(ifaddrs_shm_publish(shm, a) == 0);
+    unsigned int seq = ifaddrs_shm_read_begin(shm);
+    CHECK(count_entries(shm, seq) == 4);
+    const struct ifaddrs_shm_entry *e = ifaddrs_shm_first(shm, seq);
+    CHECK(e != NULL && strcmp(e->name, "eth1") == 0);
+    CHECK(e != NULL && ifaddrs_shm_data(shm, e) != NULL);
+
+    // one publish goes to the other slot, what was read stays valid
+    CHECK(ifaddrs_shm_publish(shm, b) == 0);
+    CHECK(count_entries(shm, seq) == 4);
+    CHECK(ifaddrs_shm_read_retry(shm, seq) == 0);
+
+    // a second one overwrites it, the reader has to start again and then
+    // finds the latest
+    CHECK(ifaddrs_shm_publish(shm, c) == 0);
+    CHECK(ifaddrs_shm_read_retry(shm, seq) != 0);
+    seq = ifaddrs_shm_read_begin(shm);
+    CHECK(count_entries(shm, seq) == 8);
+    CHECK(ifaddrs_shm_read_retry(shm, seq) == 0);
+
+    // a reader starting while a write is in progress reads the previous
+    // result, and retries once the write after that one has begun
+    struct ifaddrs_shm_header *hdr = shm->hdr;
+    atomic_fetch_add(&hdr->seq, 1);
+    unsigned int odd = ifaddrs_shm_read_begin(shm);
+    CHECK(count_entries(shm, odd) == 8);
+    CHECK(ifaddrs_shm_read_retry(shm, odd) == 0);
+    atomic_fetch_add(&hdr->seq, 1);
+    CHECK(ifaddrs_shm_read_retry(shm, odd) == 0);
+    atomic_fetch_add(&hdr->seq, 1);
+    CHECK(ifaddrs_shm_read_retry(shm, odd) != 0);
+    atomic_fetch_sub(&hdr->seq, 3);
+
+    freeifaddrs(a);
+    freeifaddrs(b);
+    freeifaddrs(c);
+}
+
+static void check_bounds(const struct ifaddrs_shm *shm) {
+    uint32_t len = shm->len;
+    CHECK(shm_at(shm, 0, sizeof(struct ifaddrs_shm_header)) != NULL);
+    CHECK(shm_at(shm, len - 8, 8) != NULL);
+    CHECK(shm_at(shm, len, 0) != NULL);
+    CHECK(shm_at(shm, len - 4, 8) == NULL);
+    CHECK(shm_at(shm, len + 4, 0) == NULL);
+    CHECK(shm_at(shm, UINT32_MAX & ~3U, 16) == NULL);
+    CHECK(shm_at(shm, 4, SIZE_MAX) == NULL);
+    CHECK(shm_at(shm, 2, 4) == NULL);
+}
+
+// every offset a reader follows, pointed outside the mapping, backwards and
+// off alignment
+static void check_corrupt(struct ifaddrs_shm *shm, struct ifaddrs_shm *reader) {
+    struct ifaddrs_shm_header *hdr = shm->hdr;
+    unsigned int seq = ifaddrs_shm_read_begin(shm);
+    int slot = SHM_SLOT(seq);
+    struct ifaddrs_shm_entry *e =
+        (struct ifaddrs_shm_entry *)ifaddrs_shm_first(shm, seq);
+    CHECK(e != NULL);
+    if (!e) {
+        return;
+    }
+    uint32_t here = (unsigned char *)e - (unsigned char *)hdr;
+    struct ifaddrs_shm_entry saved = *e;
+    uint32_t first = hdr->first[slot];
+
+    uint32_t nexts[] = {shm->len, UINT32_MAX & ~3U, here, here - 4, here + 2};
+    for (size_t i = 0; i < sizeof(nexts) / sizeof(nexts[0]); i++) {
+        e->next = nexts[i];
+        CHECK(ifaddrs_shm_next(shm, e) == NULL);
+        CHECK(count_entries(reader, seq) == 1);
+        CHECK(count_list(reader) == 1);
+    }
+    *e = saved;
+
+    e->data = shm->len - 4;
+    e->data_len = 64;
+    CHECK(ifaddrs_shm_data(reader, e) == NULL);
+    e->data = 4;
+    e->data_len = UINT32_MAX;
+    CHECK(ifaddrs_shm_data(reader, e) == NULL);
+    CHECK(count_list(reader) == 8);
+    *e = saved;
+
+    uint32_t firsts[] = {shm->len, UINT32_MAX & ~3U, first + 2};
+    for (size_t i = 0; i < sizeof(firsts) / sizeof(firsts[0]); i++) {
+        hdr->first[slot] = firsts[i];
+        CHECK(ifaddrs_shm_first(reader, seq) == NULL);
+        CHECK(count_list(reader) == 0);
+    }
+    hdr->first[slot] = first;
+    CHECK(count_list(reader) == 8);
+}
+
+int main(void) {
+    struct ifaddrs_shm *shm = ifaddrs_shm_create(-1, 0);
+    CHECK(shm != NULL);
+    if (!shm) {
+        return TEST_RESULT;
+    }
+    struct ifaddrs_shm *reader = ifaddrs_shm_open(ifaddrs_shm_fd(shm));
+    CHECK(reader != NULL);
+    if (!reader) {
+        ifaddrs_shm_close(shm);
+        return TEST_RESULT;
+    }
+    CHECK(count_entries(reader, ifaddrs_shm_read_begin(reader)) == 0);
+
+    check_seqlock(shm);
+    check_bounds(reader);
+    check_corrupt(shm, reader);
+
+    ifaddrs_shm_close(reader);
+    ifaddrs_shm_close(shm);
+    return TEST_RESULT;
+}
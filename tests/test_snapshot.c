@@ -0,0 +1,60 @@
+// readers acquire and release snapshots while every acquire is also allowed
+// to refresh, so snapshots are replaced and freed under the readers' feet
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <ifaddrs.h>
+
+#include "test.h"
+
+#define READERS 8
+#define RUN_MS 500
+
+static atomic_bool stop;
+static atomic_ulong acquired;
+
+static void *reader(void *arg) {
+    (void)arg;
+    while (!atomic_load(&stop)) {
+        struct ifaddrs_snapshot *snap = ifaddrs_snapshot_acquire();
+        CHECK(snap != NULL);
+        if (!snap) {
+            break;
+        }
+        for (const struct ifaddrs *ifa = ifaddrs_snapshot_list(snap); ifa;
+             ifa = ifa->ifa_next) {
+            CHECK(ifa->ifa_name && strlen(ifa->ifa_name) > 0);
+        }
+        ifaddrs_snapshot_release(snap);
+        atomic_fetch_add(&acquired, 1);
+    }
+    return NULL;
+}
+
+int main(void) {
+    ifaddrs_snapshot_set_max_age(0);
+
+    pthread_t threads[READERS];
+    for (int i = 0; i < READERS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, reader, NULL) == 0);
+    }
+    struct timespec run = {0, RUN_MS * 1000000L};
+    nanosleep(&run, NULL);
+    atomic_store(&stop, true);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(atomic_load(&acquired) > 0);
+
+    // the last reference of the published snapshot is dropped by the next
+    // refresh, the one handed out here is still valid afterwards
+    struct ifaddrs_snapshot *a = ifaddrs_snapshot_acquire();
+    struct ifaddrs_snapshot *b = ifaddrs_snapshot_acquire();
+    CHECK(a && b);
+    ifaddrs_snapshot_release(a);
+    ifaddrs_snapshot_release(b);
+    return TEST_RESULT;
+}
@@ -0,0 +1,54 @@
+// the copy IFADDRS_RETRY_STALE falls back to, for callers with and without
+// the records of getifaddrs_ex()
+#include "whitebox.h"
+
+static struct test_dump d;
+
+static struct ifaddrs *stale(bool ex) {
+    struct ifaddrs *list = NULL;
+    if (retry_stale(&list, NULL, ex) < 0) {
+        CHECK(errno == EAGAIN && list == NULL);
+        return NULL;
+    }
+    CHECK(ifaddrs_is_stale(list));
+    return list;
+}
+
+int main(void) {
+    dump_link(&d, RTM_NEWLINK, 1, "eth1");
+    dump_done(&d);
+    struct in_addr in = {htonl(0x0a000001)};
+    dump_addr(&d, RTM_NEWADDR, AF_INET, 1, &in, 24);
+    dump_done(&d);
+
+    struct ifaddrs_retry_policy policy = {1, 0, 0, IFADDRS_RETRY_STALE};
+    CHECK(ifaddrs_set_retry_policy(&policy) == 0);
+    CHECK(stale(false) == NULL);
+
+    // saved by a plain call: nothing for getifaddrs_ex()
+    struct ifaddrs *list;
+    CHECK(getifaddrs_replay(&list, NULL, d.data, d.len) == 0);
+    retry_save(list);
+    freeifaddrs(list);
+    CHECK(stale(true) == NULL);
+    list = stale(false);
+    CHECK(list && !ifaddrs_ex(list));
+    freeifaddrs(list);
+
+    // saved with the records, which only getifaddrs_ex() gets back
+    struct netlink_replay replay;
+    replay_start(&replay, &d);
+    CHECK(getifaddrs_ex(&list, NULL) == 0);
+    replay_stop();
+    retry_save(list);
+    freeifaddrs(list);
+    list = stale(true);
+    CHECK(list && ifaddrs_ex(list) && ifaddrs_ex(list)->ifindex == 1);
+    freeifaddrs(list);
+    list = stale(false);
+    CHECK(list && !ifaddrs_ex(list));
+    freeifaddrs(list);
+
+    CHECK(ifaddrs_set_retry_policy(NULL) == 0);
+    return TEST_RESULT;
+}
@@ -0,0 +1,28 @@
+#ifndef IFADDRS_WHITEBOX_H
+#define IFADDRS_WHITEBOX_H
+
+// tests of the internals build the library into themselves, so that its
+// static functions and state can be reached
+#include "ifaddrs.c"
+
+#include "netlink_dump.h"
+#include "test.h"
+
+// netlink sessions of the calling thread get their replies from d, as
+// getifaddrs_replay() does, until replay_stop()
+static inline void
+replay_start(struct netlink_replay *replay, const struct test_dump *d) {
+    memset(replay, 0, sizeof(*replay));
+    replay->links = (const struct nlmsghdr *)d->data;
+    replay->links_len = netlink_replay_split(replay->links, d->len);
+    replay->addrs =
+        (const struct nlmsghdr *)((const char *)d->data + replay->links_len);
+    replay->addrs_len = d->len - replay->links_len;
+    netlink_replay_current = replay;
+}
+
+static inline void replay_stop(void) {
+    netlink_replay_current = NULL;
+}
+
+#endif